@@ -0,0 +1,702 @@
+﻿#include <windows.h>
+#include <d2d1.h>
+#include <wincodec.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <string>
+#include <vector>
+#include <random>
+#include "DrawingObject.h"
+#include "DocumentFile.h"
+#include "TileCache.h"
+
+#pragma comment(lib, "d2d1.lib")
+#pragma comment(lib, "windowscodecs.lib")
+
+// --- ヘッドレスベンチマーク ---
+// 形状認識 (AddPoint / Finalize / Complement)、保存と読み込み、描画 (CDocument::DrawAll、タイルキャッシュ) の処理時間を
+// ウィンドウを作らずに計測する。描画は WIC ビットマップのレンダーターゲット (ソフトウェア) で行う
+//
+// 使い方: AIPaintBench.exe [--iterations N] [--frames N] [--objects N,N,...] [--csv] [document.aipd ...]
+// 指定したドキュメントのストロークは、合成したコーパスに加えて認識の計測に使う
+
+// --- 計測値の集計 ---
+class CTimingSamples {
+private:
+    std::vector<double> m_samples; // ミリ秒
+
+public:
+    void Add(double ms) { m_samples.push_back(ms); }
+    size_t GetCount() const { return m_samples.size(); }
+
+    double GetMean() const {
+        double sum = 0.0;
+        for (double s : m_samples) sum += s;
+        return m_samples.empty() ? 0.0 : sum / m_samples.size();
+    }
+
+    // p は 0～1 (0.5 で中央値)
+    double GetPercentile(double p) const {
+        if (m_samples.empty()) return 0.0;
+        std::vector<double> sorted = m_samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+        return sorted[min(index, sorted.size() - 1)];
+    }
+};
+
+// --- 高分解能タイマー ---
+class CStopwatch {
+private:
+    LARGE_INTEGER m_frequency;
+    LARGE_INTEGER m_start;
+
+public:
+    CStopwatch() {
+        QueryPerformanceFrequency(&m_frequency);
+        Restart();
+    }
+    void Restart() { QueryPerformanceCounter(&m_start); }
+    double GetElapsedMs() const {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return (double)(now.QuadPart - m_start.QuadPart) * 1000.0 / (double)m_frequency.QuadPart;
+    }
+};
+
+// --- ベンチマーク設定 ---
+struct BenchOptions {
+    int iterations = 3;  // 認識コーパスの繰り返し回数
+    int frames = 60;     // 描画の計測フレーム数
+    std::vector<size_t> objectCounts = { 100, 1000, 10000 };
+    bool csv = false;
+    std::vector<std::wstring> documents;
+};
+
+// --- ストロークのコーパス ---
+typedef std::vector<D2D1_POINT_2F> StrokeSamples;
+
+struct StrokeCorpus {
+    std::string name;
+    CFreehandStroke::ShapeType expected; // 期待する判定結果 (不明な場合は None)
+    std::vector<StrokeSamples> strokes;
+};
+
+// マウス入力と同じく整数座標に丸める
+static D2D1_POINT_2F PixelPoint(double x, double y) {
+    return D2D1::Point2F((float)std::floor(x + 0.5), (float)std::floor(y + 0.5));
+}
+
+static StrokeSamples MakeLineSamples(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<double> position(100.0, 900.0);
+    std::uniform_real_distribution<double> angle(0.0, 6.283185307179586);
+    std::uniform_real_distribution<double> jitter(-1.0, 1.0);
+
+    // サンプル間隔は高レートの入力を想定して 0.5～2 ピクセル程度にする
+    double x0 = position(rng), y0 = position(rng), a = angle(rng);
+    double length = min(800.0, 2.0 * (double)count) + 20.0;
+    StrokeSamples samples;
+    samples.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        double t = count > 1 ? (double)i / (count - 1) : 0.0;
+        double normal = jitter(rng);
+        samples.push_back(PixelPoint(x0 + std::cos(a) * length * t - std::sin(a) * normal,
+                                     y0 + std::sin(a) * length * t + std::cos(a) * normal));
+    }
+    return samples;
+}
+
+static StrokeSamples MakeEllipseSamples(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<double> position(300.0, 700.0);
+    std::uniform_real_distribution<double> radius(40.0, 250.0);
+    std::uniform_real_distribution<double> angle(0.0, 6.283185307179586);
+    std::uniform_real_distribution<double> jitter(-1.0, 1.0);
+
+    double cx = position(rng), cy = position(rng);
+    double rx = radius(rng), ry = radius(rng), rotation = angle(rng), start = angle(rng);
+    StrokeSamples samples;
+    samples.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        double t = start + 6.283185307179586 * (double)i / (double)max(count - 1, (size_t)1);
+        double ex = rx * std::cos(t) + jitter(rng);
+        double ey = ry * std::sin(t) + jitter(rng);
+        samples.push_back(PixelPoint(cx + ex * std::cos(rotation) - ey * std::sin(rotation),
+                                     cy + ex * std::sin(rotation) + ey * std::cos(rotation)));
+    }
+    return samples;
+}
+
+// 頂点を順に結ぶ折れ線を辺の長さに比例した点数でなぞる
+static StrokeSamples TraceVertices(const D2D1_POINT_2F* vertices, size_t vertexCount, size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<double> jitter(-1.0, 1.0);
+
+    std::vector<double> lengths(vertexCount, 0.0);
+    for (size_t k = 1; k < vertexCount; ++k) {
+        double dx = (double)vertices[k].x - vertices[k - 1].x;
+        double dy = (double)vertices[k].y - vertices[k - 1].y;
+        lengths[k] = lengths[k - 1] + std::sqrt(dx * dx + dy * dy);
+    }
+
+    StrokeSamples samples;
+    samples.reserve(count);
+    size_t segment = 1;
+    for (size_t i = 0; i < count; ++i) {
+        double d = lengths[vertexCount - 1] * (double)i / (double)max(count - 1, (size_t)1);
+        while (segment < vertexCount - 1 && d > lengths[segment]) ++segment;
+        double span = lengths[segment] - lengths[segment - 1];
+        double t = span > 0.0 ? (d - lengths[segment - 1]) / span : 0.0;
+        D2D1_POINT_2F a = vertices[segment - 1], b = vertices[segment];
+        samples.push_back(PixelPoint(a.x + (b.x - a.x) * t + jitter(rng), a.y + (b.y - a.y) * t + jitter(rng)));
+    }
+    return samples;
+}
+
+static StrokeSamples MakeRectangleSamples(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<double> position(300.0, 700.0);
+    std::uniform_real_distribution<double> half(40.0, 200.0);
+    std::uniform_real_distribution<double> angle(0.0, 6.283185307179586);
+
+    double cx = position(rng), cy = position(rng), hu = half(rng), hv = half(rng), a = angle(rng);
+    double ux = std::cos(a), uy = std::sin(a);
+    const double corners[5][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 }, { -1, -1 } };
+    D2D1_POINT_2F vertices[5];
+    for (int k = 0; k < 5; ++k) {
+        double u = corners[k][0] * hu, v = corners[k][1] * hv;
+        vertices[k] = D2D1::Point2F((float)(cx + u * ux - v * uy), (float)(cy + u * uy + v * ux));
+    }
+    return TraceVertices(vertices, 5, count, rng);
+}
+
+static StrokeSamples MakePolylineSamples(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<double> position(200.0, 800.0);
+    std::uniform_real_distribution<double> length(100.0, 300.0);
+    std::uniform_real_distribution<double> turn(1.2, 2.2); // 70～125度の折れ曲がり
+
+    // 向きを交互に変えるジグザグの3辺
+    double x = position(rng), y = position(rng), heading = turn(rng);
+    D2D1_POINT_2F vertices[4];
+    vertices[0] = D2D1::Point2F((float)x, (float)y);
+    for (int k = 1; k < 4; ++k) {
+        double l = length(rng);
+        x += std::cos(heading) * l;
+        y += std::sin(heading) * l;
+        vertices[k] = D2D1::Point2F((float)x, (float)y);
+        heading += (k % 2 ? 1.0 : -1.0) * turn(rng);
+    }
+    return TraceVertices(vertices, 4, count, rng);
+}
+
+static StrokeSamples MakeCurveSamples(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<double> position(300.0, 700.0);
+    std::uniform_real_distribution<double> amplitude(40.0, 150.0);
+    std::uniform_real_distribution<double> length(250.0, 600.0);
+    std::uniform_real_distribution<double> angle(0.0, 6.283185307179586);
+    std::uniform_real_distribution<double> jitter(-1.0, 1.0);
+
+    // 正弦波の1周期 (S字) を回転させた曲線
+    double x0 = position(rng), y0 = position(rng), a = amplitude(rng), l = length(rng), rotation = angle(rng);
+    StrokeSamples samples;
+    samples.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        double t = (double)i / (double)max(count - 1, (size_t)1);
+        double u = l * t;
+        double v = a * std::sin(6.283185307179586 * t) + jitter(rng);
+        samples.push_back(PixelPoint(x0 + u * std::cos(rotation) - v * std::sin(rotation),
+                                     y0 + u * std::sin(rotation) + v * std::cos(rotation)));
+    }
+    return samples;
+}
+
+static StrokeSamples MakeScribbleSamples(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<double> position(200.0, 800.0);
+    std::uniform_real_distribution<double> turn(-0.35, 0.35);
+    std::uniform_real_distribution<double> step(1.0, 4.0);
+
+    double x = position(rng), y = position(rng), heading = 0.0;
+    StrokeSamples samples;
+    samples.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        heading += turn(rng);
+        x += std::cos(heading) * step(rng);
+        y += std::sin(heading) * step(rng);
+        samples.push_back(PixelPoint(x, y));
+    }
+    return samples;
+}
+
+static void BuildSyntheticCorpora(std::vector<StrokeCorpus>& corpora) {
+    const size_t sizes[] = { 10, 100, 1000, 10000, 100000 };
+    std::mt19937 rng(12345); // 実行ごとに同じコーパスになるように固定する
+
+    struct Generator {
+        const char* name;
+        CFreehandStroke::ShapeType expected;
+        StrokeSamples (*make)(size_t, std::mt19937&);
+    };
+    const Generator generators[] = {
+        { "line", CFreehandStroke::ShapeType::Line, MakeLineSamples },
+        { "ellipse", CFreehandStroke::ShapeType::Ellipse, MakeEllipseSamples },
+        { "rectangle", CFreehandStroke::ShapeType::Rectangle, MakeRectangleSamples },
+        { "polyline", CFreehandStroke::ShapeType::Polyline, MakePolylineSamples },
+        { "curve", CFreehandStroke::ShapeType::Curve, MakeCurveSamples },
+        { "scribble", CFreehandStroke::ShapeType::None, MakeScribbleSamples },
+    };
+
+    for (const Generator& generator : generators) {
+        for (size_t size : sizes) {
+            // 長いストロークほど本数を減らし、コーパスごとの点の総数をそろえる
+            size_t strokeCount = max((size_t)4, min((size_t)200, (size_t)100000 / size));
+            StrokeCorpus corpus;
+            corpus.name = std::string(generator.name) + "/" + std::to_string(size);
+            corpus.expected = generator.expected;
+            for (size_t i = 0; i < strokeCount; ++i) {
+                corpus.strokes.push_back(generator.make(size, rng));
+            }
+            corpora.push_back(std::move(corpus));
+        }
+    }
+}
+
+// 保存済みドキュメントのストロークを入力点列として取り出す (記録したコーパス)
+static bool LoadRecordedCorpus(const std::wstring& path, std::vector<StrokeCorpus>& corpora) {
+    CDocument document;
+    if (FAILED(LoadDocumentFile(document, path.c_str()))) return false;
+
+    std::vector<ObjectId> ids;
+    document.GetObjectIds(ids);
+    StrokeCorpus corpus;
+    corpus.name.assign(path.begin(), path.end()); // 表示用 (ASCII 以外は崩れてもよい)
+    corpus.expected = CFreehandStroke::ShapeType::None;
+    for (ObjectId id : ids) {
+        auto stroke = ObjectCast<CFreehandStroke>(document.FindObject(id));
+        if (!stroke) continue;
+        StrokeSamples samples;
+        samples.reserve(stroke->GetPointCount());
+        stroke->VisitPoints([&](D2D1_POINT_2F p) {
+            samples.push_back(p);
+            return true;
+        });
+        corpus.strokes.push_back(std::move(samples));
+    }
+    if (corpus.strokes.empty()) return false;
+    corpora.push_back(std::move(corpus));
+    return true;
+}
+
+
+// --- 認識のベンチマーク ---
+// 入力の再生 (AddPoint)、確定 (Finalize)、補完判定 (Complement) をストロークごとに計測する
+static void RunRecognitionBenchmark(const std::vector<StrokeCorpus>& corpora, const BenchOptions& options) {
+    if (options.csv) {
+        printf("recognition,corpus,strokes,add_median_ms,add_p95_ms,finalize_median_ms,finalize_p95_ms,complement_median_ms,complement_p95_ms,complement_max_ms,expected_rate\n");
+    }
+    else {
+        printf("\n[recognition] per-stroke latency (ms)\n");
+        printf("%-22s %7s %10s %10s %10s %10s %10s %10s %8s\n",
+            "corpus", "strokes", "add p50", "add p95", "final p50", "final p95", "cmpl p50", "cmpl p95", "expected");
+    }
+
+    const D2D1_COLOR_F color = D2D1::ColorF(0.0f, 0.0f, 0.0f, 1.0f);
+    const float width = 3.0f;
+
+    for (const StrokeCorpus& corpus : corpora) {
+        CTimingSamples addTimes, finalizeTimes, complementTimes;
+        size_t matched = 0, total = 0;
+
+        for (int iteration = 0; iteration < options.iterations; ++iteration) {
+            for (const StrokeSamples& samples : corpus.strokes) {
+                auto stroke = std::make_shared<CFreehandStroke>(color, width);
+
+                CStopwatch watch;
+                for (const D2D1_POINT_2F& p : samples) {
+                    stroke->AddPoint(p);
+                }
+                addTimes.Add(watch.GetElapsedMs());
+
+                // ジオメトリはここでは作らない (描画のベンチマークで計測する)
+                watch.Restart();
+                stroke->Finalize(nullptr);
+                finalizeTimes.Add(watch.GetElapsedMs());
+
+                watch.Restart();
+                stroke->Complement();
+                complementTimes.Add(watch.GetElapsedMs());
+
+                if (corpus.expected != CFreehandStroke::ShapeType::None) {
+                    ++total;
+                    if (stroke->m_detectedShape == corpus.expected) ++matched;
+                }
+            }
+        }
+
+        double rate = total > 0 ? 100.0 * matched / total : 0.0;
+        if (options.csv) {
+            printf("recognition,%s,%zu,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.1f\n",
+                corpus.name.c_str(), corpus.strokes.size(),
+                addTimes.GetPercentile(0.5), addTimes.GetPercentile(0.95),
+                finalizeTimes.GetPercentile(0.5), finalizeTimes.GetPercentile(0.95),
+                complementTimes.GetPercentile(0.5), complementTimes.GetPercentile(0.95),
+                complementTimes.GetPercentile(1.0), rate);
+        }
+        else {
+            char expected[16] = "-";
+            if (total > 0) snprintf(expected, sizeof(expected), "%.1f%%", rate);
+            printf("%-22s %7zu %10.4f %10.4f %10.4f %10.4f %10.4f %10.4f %8s\n",
+                corpus.name.c_str(), corpus.strokes.size(),
+                addTimes.GetPercentile(0.5), addTimes.GetPercentile(0.95),
+                finalizeTimes.GetPercentile(0.5), finalizeTimes.GetPercentile(0.95),
+                complementTimes.GetPercentile(0.5), complementTimes.GetPercentile(0.95), expected);
+        }
+    }
+}
+
+
+// --- 描画のベンチマーク ---
+
+static const UINT BenchTargetWidth = 1920;
+static const UINT BenchTargetHeight = 1080;
+
+// 描画用のドキュメント (フリーハンド 70%、直線 15%、楕円 15%) を作る
+static void BuildRenderDocument(CDocument& document, size_t objectCount, ID2D1Factory* pFactory) {
+    std::mt19937 rng(67890 + (unsigned int)objectCount);
+    std::uniform_int_distribution<int> kind(0, 99);
+    std::uniform_int_distribution<size_t> strokeLength(50, 300);
+    std::uniform_real_distribution<float> hue(0.0f, 1.0f);
+    std::uniform_real_distribution<double> x(0.0, (double)BenchTargetWidth);
+    std::uniform_real_distribution<double> y(0.0, (double)BenchTargetHeight);
+
+    for (size_t i = 0; i < objectCount; ++i) {
+        D2D1_COLOR_F color = D2D1::ColorF(hue(rng), hue(rng), hue(rng), 1.0f);
+        int k = kind(rng);
+        if (k < 70) {
+            // 画面全体に散らばるよう、生成後に平行移動する
+            StrokeSamples samples = MakeScribbleSamples(strokeLength(rng), rng);
+            double dx = x(rng) - samples.front().x, dy = y(rng) - samples.front().y;
+            auto stroke = std::make_shared<CFreehandStroke>(color, 3.0f);
+            for (const D2D1_POINT_2F& p : samples) {
+                stroke->AddPoint(PixelPoint(p.x + dx, p.y + dy));
+            }
+            stroke->Finalize(pFactory);
+            document.AddObject(stroke, false);
+        }
+        else if (k < 85) {
+            D2D1_POINT_2F a = PixelPoint(x(rng), y(rng));
+            D2D1_POINT_2F b = PixelPoint(a.x + x(rng) * 0.1, a.y + y(rng) * 0.1);
+            document.AddObject(std::make_shared<CLineSegment>(a, b, color, 3.0f), false);
+        }
+        else {
+            D2D1_ELLIPSE ellipse = D2D1::Ellipse(PixelPoint(x(rng), y(rng)), (float)(10.0 + x(rng) * 0.05), (float)(10.0 + y(rng) * 0.05));
+            document.AddObject(std::make_shared<CEllipseSegment>(ellipse, color, 3.0f, (float)(hue(rng) * 180.0f)), false);
+        }
+    }
+}
+
+// 1 フレームを描画して EndDraw までの時間を返す (pClip を指定すると部分再描画)
+static double DrawFrame(ID2D1RenderTarget* pRT, CRenderContext& context, const CDocument& document, const D2D1_RECT_F* pClip, HRESULT& hr) {
+    CStopwatch watch;
+    pRT->BeginDraw();
+    if (pClip) pRT->PushAxisAlignedClip(*pClip, D2D1_ANTIALIAS_MODE_ALIASED);
+    pRT->Clear(D2D1::ColorF(D2D1::ColorF::White));
+    document.DrawAll(context, pClip);
+    if (pClip) pRT->PopAxisAlignedClip();
+    hr = pRT->EndDraw();
+    return watch.GetElapsedMs();
+}
+
+// タイルキャッシュを使って 1 フレームを描画した時間を返す (スクロール・拡大縮小の計測用)
+// 描画が間に合わないタイルは次のフレームに回るため、アプリと同じく1フレームの時間はほぼ予算内に収まる
+static double DrawTiledFrame(ID2D1RenderTarget* pRT, CRenderContext& context, const CDocument& document,
+    CTileCache& tiles, const CViewport& viewport, HRESULT& hr) {
+    CStopwatch watch;
+    D2D1_RECT_F area = D2D1::RectF(0.0f, 0.0f, (float)BenchTargetWidth, (float)BenchTargetHeight);
+    hr = tiles.Prepare(pRT, context, document, viewport, area);
+    if (FAILED(hr)) return watch.GetElapsedMs();
+
+    pRT->BeginDraw();
+    pRT->Clear(D2D1::ColorF(D2D1::ColorF::White));
+    tiles.Draw(pRT);
+    hr = pRT->EndDraw();
+    return watch.GetElapsedMs();
+}
+
+// すべてのタイルを無効にし、描き直しが完了するまでの時間を返す (Undo や読み込みの後を想定)
+static double RebuildTiles(ID2D1RenderTarget* pRT, CRenderContext& context, const CDocument& document,
+    CTileCache& tiles, const CViewport& viewport, HRESULT& hr) {
+    CStopwatch watch;
+    tiles.InvalidateAll();
+    do {
+        DrawTiledFrame(pRT, context, document, tiles, viewport, hr);
+    } while (SUCCEEDED(hr) && !tiles.IsComplete());
+    return watch.GetElapsedMs();
+}
+
+static HRESULT RunRenderBenchmark(const BenchOptions& options) {
+    ID2D1Factory* pFactory = nullptr;
+    IWICImagingFactory* pWICFactory = nullptr;
+    IWICBitmap* pBitmap = nullptr;
+    ID2D1RenderTarget* pRT = nullptr;
+
+    // タイルの並列記録ではワーカースレッドからもファクトリを使う
+    HRESULT hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &pFactory);
+    if (SUCCEEDED(hr)) {
+        hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&pWICFactory));
+    }
+    if (SUCCEEDED(hr)) {
+        hr = pWICFactory->CreateBitmap(BenchTargetWidth, BenchTargetHeight, GUID_WICPixelFormat32bppPBGRA, WICBitmapCacheOnLoad, &pBitmap);
+    }
+    if (SUCCEEDED(hr)) {
+        // WIC ビットマップへの描画は常にソフトウェアで行われる (GPU に依存しない比較用)
+        D2D1_RENDER_TARGET_PROPERTIES props = D2D1::RenderTargetProperties(
+            D2D1_RENDER_TARGET_TYPE_DEFAULT,
+            D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED));
+        hr = pFactory->CreateWicBitmapRenderTarget(pBitmap, props, &pRT);
+    }
+
+    if (SUCCEEDED(hr)) {
+        if (options.csv) {
+            printf("render,objects,pass,frames,median_ms,p95_ms,max_ms,first_frame_ms\n");
+        }
+        else {
+            printf("\n[render] per-frame draw time (ms), %ux%u WIC target\n", BenchTargetWidth, BenchTargetHeight);
+            printf("%-8s %-8s %7s %10s %10s %10s %12s\n", "objects", "pass", "frames", "p50", "p95", "max", "first frame");
+        }
+    }
+
+    for (size_t n = 0; SUCCEEDED(hr) && n < options.objectCounts.size(); ++n) {
+        size_t objectCount = options.objectCounts[n];
+        CDocument document;
+        BuildRenderDocument(document, objectCount, pFactory);
+
+        CRenderContext context;
+        context.SetTarget(pRT);
+
+        // 最初のフレームはブラシなどの作成を含むため別に記録する
+        double firstFrame = DrawFrame(pRT, context, document, nullptr, hr);
+
+        // 全体の再描画と、256px 四方の部分再描画 (入力中の無効化範囲を想定)、
+        // タイルキャッシュを使ったスクロール (1 フレームに 24px) と拡大縮小 (1 フレームに 10%)、
+        // 表示中のタイルすべての描き直し (1 枚ずつ描画する場合と、ワーカースレッドで並列に記録する場合)
+        std::mt19937 rng(424242);
+        std::uniform_real_distribution<float> x(0.0f, (float)BenchTargetWidth - 256.0f);
+        std::uniform_real_distribution<float> y(0.0f, (float)BenchTargetHeight - 256.0f);
+        const char* passNames[] = { "full", "partial", "pan", "zoom", "rebuild", "rebuild-mt" };
+        const int passCount = sizeof(passNames) / sizeof(passNames[0]);
+        for (int pass = 0; pass < passCount && SUCCEEDED(hr); ++pass) {
+            CTimingSamples frameTimes;
+            CTileCache tiles;
+            CViewport viewport;
+            tiles.SetParallelRecording(pass == 5);
+            for (int frame = 0; frame < options.frames && SUCCEEDED(hr); ++frame) {
+                if (pass >= 4) {
+                    frameTimes.Add(RebuildTiles(pRT, context, document, tiles, viewport, hr));
+                    continue;
+                }
+                if (pass >= 2) {
+                    if (pass == 2) {
+                        viewport.Pan(-24.0f, (frame / 30) % 2 == 0 ? -8.0f : 8.0f);
+                    }
+                    else {
+                        // 30 フレームごとに縮小と拡大を切り替える
+                        D2D1_POINT_2F center = D2D1::Point2F(BenchTargetWidth * 0.5f, BenchTargetHeight * 0.5f);
+                        viewport.ZoomAt(center, (frame / 30) % 2 == 0 ? 1.0f / 1.1f : 1.1f);
+                    }
+                    frameTimes.Add(DrawTiledFrame(pRT, context, document, tiles, viewport, hr));
+                    continue;
+                }
+
+                D2D1_RECT_F clip = D2D1::RectF();
+                if (pass == 1) {
+                    float left = x(rng), top = y(rng);
+                    clip = D2D1::RectF(left, top, left + 256.0f, top + 256.0f);
+                }
+                frameTimes.Add(DrawFrame(pRT, context, document, pass == 1 ? &clip : nullptr, hr));
+            }
+
+            if (options.csv) {
+                printf("render,%zu,%s,%zu,%.6f,%.6f,%.6f,%.6f\n", objectCount, passNames[pass], frameTimes.GetCount(),
+                    frameTimes.GetPercentile(0.5), frameTimes.GetPercentile(0.95), frameTimes.GetPercentile(1.0), firstFrame);
+            }
+            else {
+                printf("%-8zu %-8s %7zu %10.3f %10.3f %10.3f %12.3f\n", objectCount, passNames[pass], frameTimes.GetCount(),
+                    frameTimes.GetPercentile(0.5), frameTimes.GetPercentile(0.95), frameTimes.GetPercentile(1.0), firstFrame);
+            }
+        }
+        context.DiscardResources();
+    }
+
+    if (pRT) pRT->Release();
+    if (pBitmap) pBitmap->Release();
+    if (pWICFactory) pWICFactory->Release();
+    if (pFactory) pFactory->Release();
+    return hr;
+}
+
+
+// --- 保存と読み込みのベンチマーク ---
+// 保存、読み込み (マップ)、読み込んだファイルへの上書き保存を計測し、上書き後の内容が一致するか確かめる
+
+// ストロークの点数を z順に並べる (内容の比較用)
+static void CollectPointCounts(const CDocument& document, std::vector<size_t>& out) {
+    std::vector<ObjectId> ids;
+    document.GetObjectIds(ids);
+    out.clear();
+    for (ObjectId id : ids) {
+        auto stroke = ObjectCast<CFreehandStroke>(document.FindObject(id));
+        out.push_back(stroke ? stroke->GetPointCount() : 0);
+    }
+}
+
+static HRESULT RunDocumentFileBenchmark(const BenchOptions& options) {
+    wchar_t tempDirectory[MAX_PATH + 1];
+    DWORD length = GetTempPath(MAX_PATH + 1, tempDirectory);
+    if (length == 0 || length > MAX_PATH) return E_FAIL;
+    std::wstring path = std::wstring(tempDirectory, length) + L"AIPaintBench.aipd";
+
+    if (options.csv) {
+        printf("file,objects,save_ms,load_ms,resave_ms,bytes_per_point\n");
+    }
+    else {
+        printf("\n[file] save / mapped load / save over the loaded file (ms)\n");
+        printf("%-8s %10s %10s %10s %12s\n", "objects", "save", "load", "resave", "bytes/point");
+    }
+
+    HRESULT hr = S_OK;
+    for (size_t n = 0; SUCCEEDED(hr) && n < options.objectCounts.size(); ++n) {
+        size_t objectCount = options.objectCounts[n];
+        CDocument document;
+        BuildRenderDocument(document, objectCount, nullptr);
+
+        CStopwatch watch;
+        hr = SaveDocumentFile(document, path.c_str());
+        double saveMs = watch.GetElapsedMs();
+
+        // 読み込んだストロークはファイルをマップしたまま参照する
+        CDocument loaded;
+        double loadMs = 0.0;
+        if (SUCCEEDED(hr)) {
+            watch.Restart();
+            hr = LoadDocumentFile(loaded, path.c_str());
+            loadMs = watch.GetElapsedMs();
+        }
+
+        // 編集してから同じファイルへ上書きする (マップしたファイルを置き換えられること)
+        double resaveMs = 0.0;
+        if (SUCCEEDED(hr)) {
+            D2D1_COLOR_F color = D2D1::ColorF(0.0f, 0.0f, 0.0f, 1.0f);
+            loaded.AddObject(std::make_shared<CLineSegment>(D2D1::Point2F(0.0f, 0.0f), D2D1::Point2F(100.0f, 100.0f), color, 3.0f));
+            watch.Restart();
+            hr = SaveDocumentFile(loaded, path.c_str());
+            resaveMs = watch.GetElapsedMs();
+            if (FAILED(hr)) fprintf(stderr, "saving over the loaded file failed (hr=0x%08lx)\n", (unsigned long)hr);
+        }
+
+        // 上書きしたファイルを読み直し、上書きする前のドキュメントと比べる
+        if (SUCCEEDED(hr)) {
+            CDocument reloaded;
+            hr = LoadDocumentFile(reloaded, path.c_str());
+            std::vector<size_t> expected, actual;
+            CollectPointCounts(loaded, expected);
+            CollectPointCounts(reloaded, actual);
+            if (SUCCEEDED(hr) && expected != actual) {
+                fprintf(stderr, "the file saved over the loaded file does not match the document\n");
+                hr = E_FAIL;
+            }
+        }
+
+        // 点ブロブ以外も含めたファイル全体を、フリーハンドの点数で割る
+        double bytesPerPoint = 0.0;
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        std::vector<size_t> pointCounts;
+        CollectPointCounts(document, pointCounts);
+        size_t totalPoints = 0;
+        for (size_t count : pointCounts) totalPoints += count;
+        if (totalPoints > 0 && GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attributes)) {
+            uint64_t fileSize = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+            bytesPerPoint = (double)fileSize / (double)totalPoints;
+        }
+
+        if (SUCCEEDED(hr)) {
+            if (options.csv) {
+                printf("file,%zu,%.6f,%.6f,%.6f,%.3f\n", objectCount, saveMs, loadMs, resaveMs, bytesPerPoint);
+            }
+            else {
+                printf("%-8zu %10.3f %10.3f %10.3f %12.3f\n", objectCount, saveMs, loadMs, resaveMs, bytesPerPoint);
+            }
+        }
+    }
+    DeleteFile(path.c_str());
+    return hr;
+}
+
+
+// --- エントリーポイント ---
+
+static bool ParseOptions(int argc, wchar_t* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::wstring arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == L"--iterations" && hasValue) {
+            int value = _wtoi(argv[++i]);
+            options.iterations = max(1, value);
+        }
+        else if (arg == L"--frames" && hasValue) {
+            int value = _wtoi(argv[++i]);
+            options.frames = max(1, value);
+        }
+        else if (arg == L"--objects" && hasValue) {
+            // カンマ区切りのオブジェクト数
+            options.objectCounts.clear();
+            const wchar_t* p = argv[++i];
+            while (*p) {
+                wchar_t* end = nullptr;
+                unsigned long value = wcstoul(p, &end, 10);
+                if (end == p) return false;
+                options.objectCounts.push_back(value);
+                p = (*end == L',') ? end + 1 : end;
+            }
+        }
+        else if (arg == L"--csv") {
+            options.csv = true;
+        }
+        else if (arg.size() > 2 && arg.compare(0, 2, L"--") == 0) {
+            return false;
+        }
+        else {
+            options.documents.push_back(arg);
+        }
+    }
+    return true;
+}
+
+int wmain(int argc, wchar_t* argv[]) {
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        fwprintf(stderr, L"usage: AIPaintBench [--iterations N] [--frames N] [--objects N,N,...] [--csv] [document.aipd ...]\n");
+        return 2;
+    }
+
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr)) return 1;
+
+    std::vector<StrokeCorpus> corpora;
+    BuildSyntheticCorpora(corpora);
+    for (const std::wstring& path : options.documents) {
+        if (!LoadRecordedCorpus(path, corpora)) {
+            fwprintf(stderr, L"failed to load strokes from %ls\n", path.c_str());
+        }
+    }
+
+    RunRecognitionBenchmark(corpora, options);
+    hr = RunDocumentFileBenchmark(options);
+    if (FAILED(hr)) {
+        fprintf(stderr, "file benchmark failed (hr=0x%08lx)\n", (unsigned long)hr);
+    }
+    if (SUCCEEDED(hr)) hr = RunRenderBenchmark(options);
+    if (FAILED(hr)) {
+        fprintf(stderr, "render benchmark failed (hr=0x%08lx)\n", (unsigned long)hr);
+    }
+
+    CoUninitialize();
+    return SUCCEEDED(hr) ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+﻿#include "BezierFit.h"
+#include <cmath>
+
+// --- 2次元ベクトルのヘルパー ---
+struct BezierVector {
+    double x, y;
+};
+
+static BezierVector ToVector(D2D1_POINT_2F p) { return BezierVector{ p.x, p.y }; }
+static BezierVector Sub(BezierVector a, BezierVector b) { return BezierVector{ a.x - b.x, a.y - b.y }; }
+static BezierVector Add(BezierVector a, BezierVector b) { return BezierVector{ a.x + b.x, a.y + b.y }; }
+static BezierVector Scale(BezierVector a, double s) { return BezierVector{ a.x * s, a.y * s }; }
+static double Dot(BezierVector a, BezierVector b) { return a.x * b.x + a.y * b.y; }
+static double Length(BezierVector a) { return std::sqrt(a.x * a.x + a.y * a.y); }
+
+static BezierVector Normalize(BezierVector a) {
+    double length = Length(a);
+    return length > 0.0 ? Scale(a, 1.0 / length) : a;
+}
+
+static BezierVector Evaluate(const BezierVector c[4], double t) {
+    double s = 1.0 - t;
+    double b0 = s * s * s, b1 = 3.0 * s * s * t, b2 = 3.0 * s * t * t, b3 = t * t * t;
+    return BezierVector{
+        b0 * c[0].x + b1 * c[1].x + b2 * c[2].x + b3 * c[3].x,
+        b0 * c[0].y + b1 * c[1].y + b2 * c[2].y + b3 * c[3].y,
+    };
+}
+
+// 当てはめの状態 (再帰の間で共有する)
+struct BezierFitState {
+    const std::vector<D2D1_POINT_2F>& points;
+    double tolerance;
+    double tangentWindow; // 接線を求める際に見る距離
+    size_t maxSegments;
+    std::vector<D2D1_POINT_2F>& out;
+    std::vector<double> params; // 作業用 (区間ごとに作り直す)
+};
+
+// index から step 方向 (+1 / -1) へ、距離が window 以上離れた点までの向きを求める
+// 隣り合う点だけで求めると、密に入力されたストロークでは手ぶれで接線が大きく振れる
+static BezierVector EstimateDirection(const std::vector<D2D1_POINT_2F>& points, size_t index, size_t limit, int step, double window) {
+    BezierVector origin = ToVector(points[index]);
+    size_t i = index;
+    while (i != limit) {
+        i += step;
+        if (Length(Sub(ToVector(points[i]), origin)) >= window) break;
+    }
+    return Normalize(Sub(ToVector(points[i]), origin));
+}
+
+// 弦長によるパラメータの初期値 [0, 1]
+static void ChordLengthParameterize(const std::vector<D2D1_POINT_2F>& points, size_t first, size_t last, std::vector<double>& params) {
+    params.assign(last - first + 1, 0.0);
+    for (size_t i = first + 1; i <= last; ++i) {
+        params[i - first] = params[i - first - 1] + Length(Sub(ToVector(points[i]), ToVector(points[i - 1])));
+    }
+    double total = params.back();
+    for (double& u : params) {
+        u = total > 0.0 ? u / total : 0.0;
+    }
+}
+
+// 端点と接線方向を固定し、接線方向の長さ (alpha1, alpha2) を最小二乗法で求める
+static void GenerateBezier(const BezierFitState& state, size_t first, size_t last,
+    BezierVector tangent1, BezierVector tangent2, BezierVector out[4]) {
+    BezierVector p0 = ToVector(state.points[first]);
+    BezierVector p3 = ToVector(state.points[last]);
+
+    double c00 = 0.0, c01 = 0.0, c11 = 0.0, x0 = 0.0, x1 = 0.0;
+    for (size_t i = first; i <= last; ++i) {
+        double t = state.params[i - first];
+        double s = 1.0 - t;
+        double b0 = s * s * s, b1 = 3.0 * s * s * t, b2 = 3.0 * s * t * t, b3 = t * t * t;
+        BezierVector a1 = Scale(tangent1, b1);
+        BezierVector a2 = Scale(tangent2, b2);
+        c00 += Dot(a1, a1);
+        c01 += Dot(a1, a2);
+        c11 += Dot(a2, a2);
+
+        BezierVector rest = Sub(ToVector(state.points[i]), Add(Scale(p0, b0 + b1), Scale(p3, b2 + b3)));
+        x0 += Dot(a1, rest);
+        x1 += Dot(a2, rest);
+    }
+
+    double det = c00 * c11 - c01 * c01;
+    double alpha1 = 0.0, alpha2 = 0.0;
+    if (std::abs(det) > 1e-12) {
+        alpha1 = (x0 * c11 - x1 * c01) / det;
+        alpha2 = (c00 * x1 - c01 * x0) / det;
+    }
+
+    // 解が不安定な場合 (点が少ない、ほぼ直線など) は端点間の距離の 1/3 を使う
+    double segmentLength = Length(Sub(p3, p0));
+    double epsilon = 1e-6 * segmentLength;
+    if (alpha1 < epsilon || alpha2 < epsilon) {
+        alpha1 = alpha2 = segmentLength / 3.0;
+    }
+
+    out[0] = p0;
+    out[1] = Add(p0, Scale(tangent1, alpha1));
+    out[2] = Add(p3, Scale(tangent2, alpha2));
+    out[3] = p3;
+}
+
+// 最大誤差 (距離) とその位置を求める
+static double ComputeMaxError(const BezierFitState& state, size_t first, size_t last, const BezierVector c[4], size_t& splitPoint) {
+    double maxDistance = 0.0;
+    splitPoint = (first + last) / 2;
+    for (size_t i = first + 1; i < last; ++i) {
+        double distance = Length(Sub(Evaluate(c, state.params[i - first]), ToVector(state.points[i])));
+        if (distance > maxDistance) {
+            maxDistance = distance;
+            splitPoint = i;
+        }
+    }
+    return maxDistance;
+}
+
+// ニュートン法で各点に最も近い曲線上のパラメータへ補正する
+static void Reparameterize(BezierFitState& state, size_t first, const BezierVector c[4]) {
+    BezierVector d1[3] = { Scale(Sub(c[1], c[0]), 3.0), Scale(Sub(c[2], c[1]), 3.0), Scale(Sub(c[3], c[2]), 3.0) };
+    BezierVector d2[2] = { Scale(Sub(d1[1], d1[0]), 2.0), Scale(Sub(d1[2], d1[1]), 2.0) };
+
+    for (size_t k = 0; k < state.params.size(); ++k) {
+        double t = state.params[k];
+        double s = 1.0 - t;
+        BezierVector q = Evaluate(c, t);
+        BezierVector q1 = Add(Add(Scale(d1[0], s * s), Scale(d1[1], 2.0 * s * t)), Scale(d1[2], t * t));
+        BezierVector q2 = Add(Scale(d2[0], s), Scale(d2[1], t));
+
+        BezierVector diff = Sub(q, ToVector(state.points[first + k]));
+        double numerator = Dot(diff, q1);
+        double denominator = Dot(q1, q1) + Dot(diff, q2);
+        if (std::abs(denominator) > 1e-12) {
+            t -= numerator / denominator;
+            state.params[k] = min(1.0, max(0.0, t));
+        }
+    }
+}
+
+static void AppendSegment(BezierFitState& state, const BezierVector c[4]) {
+    // 始点は直前の区間の終点と同じなので、最初の区間でのみ追加する
+    if (state.out.empty()) {
+        state.out.push_back(D2D1::Point2F((float)c[0].x, (float)c[0].y));
+    }
+    for (int i = 1; i < 4; ++i) {
+        state.out.push_back(D2D1::Point2F((float)c[i].x, (float)c[i].y));
+    }
+}
+
+static size_t SegmentCount(const BezierFitState& state) {
+    return state.out.empty() ? 0 : (state.out.size() - 1) / 3;
+}
+
+// [first, last] の点を当てはめる (区間数の上限を超えた場合は false)
+// reserved はこの範囲より後ろでまだ当てはめていない範囲の数 (それぞれ少なくとも1区間になる)
+// 出力済みの区間、この範囲の1区間、reserved の合計が上限を超える時点で打ち切るため、
+// 区間数が上限を超えることはなく、分割の再帰も区間数の上限に比例する深さで止まる
+static bool FitSegment(BezierFitState& state, size_t first, size_t last, BezierVector tangent1, BezierVector tangent2, size_t reserved) {
+    const int MaxIterations = 4;
+    if (SegmentCount(state) + 1 + reserved > state.maxSegments) return false;
+
+    BezierVector c[4];
+    if (last - first == 1) {
+        // 2点だけの場合は端点間の 1/3 に制御点を置く
+        BezierVector p0 = ToVector(state.points[first]);
+        BezierVector p3 = ToVector(state.points[last]);
+        double d = Length(Sub(p3, p0)) / 3.0;
+        c[0] = p0;
+        c[1] = Add(p0, Scale(tangent1, d));
+        c[2] = Add(p3, Scale(tangent2, d));
+        c[3] = p3;
+        AppendSegment(state, c);
+        return true;
+    }
+
+    ChordLengthParameterize(state.points, first, last, state.params);
+    GenerateBezier(state, first, last, tangent1, tangent2, c);
+
+    size_t splitPoint;
+    double maxError = ComputeMaxError(state, first, last, c, splitPoint);
+    if (maxError > state.tolerance && maxError < state.tolerance * 4.0) {
+        // 誤差が小さければ、分割する前にパラメータの補正を試す
+        for (int i = 0; i < MaxIterations && maxError > state.tolerance; ++i) {
+            Reparameterize(state, first, c);
+            GenerateBezier(state, first, last, tangent1, tangent2, c);
+            maxError = ComputeMaxError(state, first, last, c, splitPoint);
+        }
+    }
+    if (maxError <= state.tolerance) {
+        AppendSegment(state, c);
+        return true;
+    }
+
+    // 誤差が最大の点で分割し、分割点の接線は前後の点から求める
+    if (splitPoint <= first) splitPoint = first + 1;
+    if (splitPoint >= last) splitPoint = last - 1;
+    BezierVector center = Sub(EstimateDirection(state.points, splitPoint, first, -1, state.tangentWindow),
+        EstimateDirection(state.points, splitPoint, last, 1, state.tangentWindow));
+    if (Length(center) <= 0.0) {
+        center = EstimateDirection(state.points, splitPoint, first, -1, state.tangentWindow);
+    }
+    center = Normalize(center);
+
+    return FitSegment(state, first, splitPoint, tangent1, center, reserved + 1) &&
+        FitSegment(state, splitPoint, last, Scale(center, -1.0), tangent2, reserved);
+}
+
+bool FitCubicBeziers(const std::vector<D2D1_POINT_2F>& points, float tolerance, size_t maxSegments,
+    std::vector<D2D1_POINT_2F>& outControlPoints) {
+    outControlPoints.clear();
+    if (points.size() < 2 || maxSegments == 0) return false;
+
+    // 重複した点を除く (接線とパラメータが求まらなくなるため)
+    std::vector<D2D1_POINT_2F> unique;
+    unique.reserve(points.size());
+    for (const D2D1_POINT_2F& p : points) {
+        if (unique.empty() || unique.back().x != p.x || unique.back().y != p.y) unique.push_back(p);
+    }
+    if (unique.size() < 2) return false;
+
+    size_t last = unique.size() - 1;
+    double tangentWindow = tolerance * 4.0;
+    BezierVector tangent1 = EstimateDirection(unique, 0, last, 1, tangentWindow);
+    BezierVector tangent2 = EstimateDirection(unique, last, 0, -1, tangentWindow);
+
+    BezierFitState state = { unique, (double)tolerance, tangentWindow, maxSegments, outControlPoints, {} };
+    if (!FitSegment(state, 0, last, tangent1, tangent2, 0)) {
+        outControlPoints.clear();
+        return false;
+    }
+    return true;
+}
+
+D2D1_POINT_2F EvaluateBezier(const D2D1_POINT_2F* controls, float t) {
+    BezierVector c[4] = { ToVector(controls[0]), ToVector(controls[1]), ToVector(controls[2]), ToVector(controls[3]) };
+    BezierVector p = Evaluate(c, t);
+    return D2D1::Point2F((float)p.x, (float)p.y);
+}
@@ -0,0 +1,17 @@
+﻿#pragma once
+
+#include <d2d1.h>
+#include <vector>
+
+// --- 3次ベジェ曲線による点列の近似 (Schneider の方法) ---
+// 弦長でパラメータを割り当てて端点の接線方向を固定した最小二乗法で当てはめ、
+// 誤差が大きい場合はニュートン法でパラメータを補正し、それでも収まらなければ
+// 誤差が最大の点で分割して再帰的に当てはめる
+//
+// 結果は連続した区間の制御点 (区間数 k に対して 3k + 1 個。区間の終点は次の区間の始点を兼ねる)
+// 点列から曲線までの距離が tolerance を超えず、区間数が maxSegments 以下で近似できた場合のみ true
+bool FitCubicBeziers(const std::vector<D2D1_POINT_2F>& points, float tolerance, size_t maxSegments,
+    std::vector<D2D1_POINT_2F>& outControlPoints);
+
+// 3次ベジェ曲線の区間 [p0, p1, p2, p3] 上の t の位置
+D2D1_POINT_2F EvaluateBezier(const D2D1_POINT_2F* controls, float t);
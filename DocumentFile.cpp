@@ -0,0 +1,550 @@
+﻿#include "DocumentFile.h"
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+
+// --- 書き込み用のバッファ付きファイル ---
+// 小さなレコードはバッファにまとめ、点ブロブのような大きな配列は直接書き込む
+// ファイルの代わりにメモリ上の配列へも書き出せる
+class CDocumentFileWriter {
+private:
+    static const size_t BufferSize = 64 * 1024;
+
+    HANDLE m_hFile;
+    std::vector<char>* m_pMemory; // nullptr でなければファイルの代わりに末尾へ追加する
+    std::vector<char> m_buffer;
+    size_t m_used;
+    uint64_t m_position;
+    HRESULT m_hr; // 最初に発生したエラー (以降の書き込みは無視する)
+
+    void WriteDirect(const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        if (m_pMemory) {
+            m_pMemory->insert(m_pMemory->end(), p, p + size);
+            return;
+        }
+        while (size > 0 && SUCCEEDED(m_hr)) {
+            DWORD chunk = (DWORD)min(size, (size_t)0x40000000);
+            DWORD written = 0;
+            if (!WriteFile(m_hFile, p, chunk, &written, NULL) || written != chunk) {
+                m_hr = HRESULT_FROM_WIN32(GetLastError());
+                if (SUCCEEDED(m_hr)) m_hr = E_FAIL;
+                return;
+            }
+            p += chunk;
+            size -= chunk;
+        }
+    }
+
+public:
+    explicit CDocumentFileWriter(HANDLE hFile)
+        : m_hFile(hFile), m_pMemory(nullptr), m_buffer(BufferSize), m_used(0), m_position(0), m_hr(S_OK) {}
+    explicit CDocumentFileWriter(std::vector<char>& memory)
+        : m_hFile(INVALID_HANDLE_VALUE), m_pMemory(&memory), m_buffer(BufferSize), m_used(0), m_position(0), m_hr(S_OK) {}
+
+    void Write(const void* data, size_t size) {
+        m_position += size;
+        if (m_used + size > BufferSize) {
+            Flush();
+            if (size >= BufferSize) {
+                WriteDirect(data, size);
+                return;
+            }
+        }
+        std::memcpy(m_buffer.data() + m_used, data, size);
+        m_used += size;
+    }
+
+    void Flush() {
+        if (m_used > 0) WriteDirect(m_buffer.data(), m_used);
+        m_used = 0;
+    }
+
+    uint64_t GetPosition() const { return m_position; }
+    HRESULT GetResult() const { return m_hr; }
+};
+
+// --- 読み込み用にマップしたファイル ---
+// 読み込んだストロークの点列が共有して保持し、最後のストロークが破棄されたときに解放する
+// マップしている間はファイルを削除も置き換えもできないため、上書き保存の前に
+// DetachStrokes で点列を複製させ、ストロークからの参照を無くす
+class CMappedDocumentFile {
+private:
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+    const void* m_pView;
+    size_t m_size;
+    BY_HANDLE_FILE_INFORMATION m_info; // 同じファイルか判定するためのボリュームとファイルの番号
+    std::vector<std::weak_ptr<CFreehandStroke>> m_strokes; // このファイルを参照するストローク
+
+public:
+    CMappedDocumentFile() : m_hFile(INVALID_HANDLE_VALUE), m_hMapping(NULL), m_pView(nullptr), m_size(0), m_info() {}
+    ~CMappedDocumentFile() {
+        if (m_pView) UnmapViewOfFile(m_pView);
+        if (m_hMapping) CloseHandle(m_hMapping);
+        if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+    }
+    CMappedDocumentFile(const CMappedDocumentFile&) = delete;
+    CMappedDocumentFile& operator=(const CMappedDocumentFile&) = delete;
+
+    HRESULT Open(const wchar_t* path) {
+        m_hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (m_hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+        if (!GetFileInformationByHandle(m_hFile, &m_info)) return HRESULT_FROM_WIN32(GetLastError());
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_hFile, &size)) return HRESULT_FROM_WIN32(GetLastError());
+        if (size.QuadPart < (LONGLONG)sizeof(DocumentFileHeader) || (ULONGLONG)size.QuadPart > (ULONGLONG)SIZE_MAX) {
+            return HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+        }
+        m_size = (size_t)size.QuadPart;
+
+        m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!m_hMapping) return HRESULT_FROM_WIN32(GetLastError());
+        m_pView = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (!m_pView) return HRESULT_FROM_WIN32(GetLastError());
+        return S_OK;
+    }
+
+    const char* GetData() const { return static_cast<const char*>(m_pView); }
+    size_t GetSize() const { return m_size; }
+
+    bool IsSameFile(const BY_HANDLE_FILE_INFORMATION& info) const {
+        return m_info.dwVolumeSerialNumber == info.dwVolumeSerialNumber &&
+            m_info.nFileIndexHigh == info.nFileIndexHigh && m_info.nFileIndexLow == info.nFileIndexLow;
+    }
+
+    void AddStroke(const std::shared_ptr<CFreehandStroke>& stroke) { m_strokes.push_back(stroke); }
+
+    // 参照しているストロークの点列を複製させる (すべて手放されたときにマップを解放する)
+    void DetachStrokes() {
+        std::vector<std::weak_ptr<CFreehandStroke>> strokes;
+        strokes.swap(m_strokes);
+        for (const auto& weak : strokes) {
+            if (auto stroke = weak.lock()) stroke->DetachExternalPoints();
+        }
+    }
+};
+
+// 読み込み中のファイルの一覧 (上書き保存するファイルをマップしているか調べるため)
+static std::mutex s_mappedFilesMutex;
+static std::vector<std::weak_ptr<CMappedDocumentFile>> s_mappedFiles;
+
+// 読み込んだストロークの点列を複製する処理と、他のスレッド (自動保存) での書き出しを排他する
+static std::shared_mutex s_externalPointsLock;
+
+static void RegisterMappedDocumentFile(const std::shared_ptr<CMappedDocumentFile>& file) {
+    std::lock_guard<std::mutex> lock(s_mappedFilesMutex);
+    s_mappedFiles.erase(std::remove_if(s_mappedFiles.begin(), s_mappedFiles.end(),
+        [](const std::weak_ptr<CMappedDocumentFile>& weak) { return weak.expired(); }), s_mappedFiles.end());
+    s_mappedFiles.push_back(file);
+}
+
+// path のファイルを読み込んだストロークの点列を複製し、マップを解放する (置き換えられるように)
+static void ReleaseMappedDocumentFile(const wchar_t* path) {
+    HANDLE hFile = CreateFile(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return; // まだ無いファイル
+    BY_HANDLE_FILE_INFORMATION info;
+    BOOL hasInfo = GetFileInformationByHandle(hFile, &info);
+    CloseHandle(hFile);
+    if (!hasInfo) return;
+
+    std::vector<std::shared_ptr<CMappedDocumentFile>> files;
+    {
+        std::lock_guard<std::mutex> lock(s_mappedFilesMutex);
+        for (const auto& weak : s_mappedFiles) {
+            auto file = weak.lock();
+            if (file && file->IsSameFile(info)) files.push_back(file);
+        }
+    }
+    if (files.empty()) return;
+
+    std::unique_lock<std::shared_mutex> lock(s_externalPointsLock);
+    for (const auto& file : files) {
+        file->DetachStrokes();
+    }
+    // files が最後の参照になり、ここでマップとファイルのハンドルが閉じられる
+}
+
+// [offset, offset + count * elementSize) がファイル内に収まるか
+static bool IsRangeValid(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize) {
+    if (offset > fileSize) return false;
+    if (elementSize != 0 && count > (fileSize - offset) / elementSize) return false;
+    return true;
+}
+
+
+// --- 保存 ---
+
+// objects をヘッダーから点ブロブまで書き出し、ヘッダーに記録したファイルサイズを返す
+static uint64_t WriteDocumentImage(const std::vector<std::shared_ptr<IDrawableObject>>& objects, CDocumentFileWriter& writer) {
+    // 書き出している間にストロークの点列が複製されて参照先が解放されないようにする
+    std::shared_lock<std::shared_mutex> lock(s_externalPointsLock);
+
+    // 書き出す順序とストロークの番号を先に決め、各セクションの位置を計算する
+    // 符号化済みの点列はそのまま書き出す。符号化されていない点列 (入力中や
+    // バージョン 1 のファイルから読み込んだもの) だけをここで符号化する
+    // 折れ線の頂点列とベジェ曲線の制御点列も同じテーブルに Float で格納する (stroke, points は nullptr)
+    struct StrokeEntry {
+        const CFreehandStroke* stroke;
+        const CEncodedPoints* points;
+        const std::vector<D2D1_POINT_2F>* vertices;
+    };
+    std::vector<StrokeEntry> strokes;
+    std::deque<CEncodedPoints> encodedHere;
+    uint64_t blobSize = 0;
+    for (const auto& object : objects) {
+        if (auto stroke = ObjectCast<CFreehandStroke>(object.get())) {
+            const CEncodedPoints* points = &stroke->GetEncodedPoints();
+            if (!stroke->GetPoints().Empty()) {
+                encodedHere.emplace_back();
+                encodedHere.back().Encode(stroke->GetPoints());
+                points = &encodedHere.back();
+            }
+            strokes.push_back(StrokeEntry{ stroke, points, nullptr });
+            blobSize += points->GetByteCount();
+        }
+        else if (auto polyline = ObjectCast<CPolylineSegment>(object.get())) {
+            strokes.push_back(StrokeEntry{ nullptr, nullptr, &polyline->GetVertices() });
+            blobSize += polyline->GetVertices().size() * 2 * sizeof(float);
+        }
+        else if (auto bezier = ObjectCast<CBezierSegment>(object.get())) {
+            strokes.push_back(StrokeEntry{ nullptr, nullptr, &bezier->GetControlPoints() });
+            blobSize += bezier->GetControlPoints().size() * 2 * sizeof(float);
+        }
+    }
+
+    DocumentFileHeader header = {};
+    header.magic = DocumentFileMagic;
+    header.version = DocumentFileVersion;
+    header.headerSize = sizeof(DocumentFileHeader);
+    header.objectCount = (uint32_t)objects.size();
+    header.objectRecordSize = sizeof(DocumentObjectRecord);
+    header.objectTableOffset = sizeof(DocumentFileHeader);
+    header.strokeTableOffset = header.objectTableOffset + (uint64_t)objects.size() * sizeof(DocumentObjectRecord);
+    header.strokeCount = (uint32_t)strokes.size();
+    header.strokeRecordSize = sizeof(DocumentStrokeRecord);
+    header.pointBlobOffset = header.strokeTableOffset + (uint64_t)strokes.size() * sizeof(DocumentStrokeRecord);
+    header.pointBlobSize = blobSize;
+    header.fileSize = header.pointBlobOffset + header.pointBlobSize;
+    writer.Write(&header, sizeof(header));
+
+    // オブジェクトテーブル
+    uint32_t strokeIndex = 0;
+    for (const auto& object : objects) {
+        DocumentObjectRecord record = {};
+        if (auto line = ObjectCast<CLineSegment>(object.get())) {
+            record.type = DocumentObjectType::Line;
+            record.color = line->GetColor();
+            record.strokeWidth = line->GetStrokeWidth();
+            record.shape[0] = line->GetStart().x;
+            record.shape[1] = line->GetStart().y;
+            record.shape[2] = line->GetEnd().x;
+            record.shape[3] = line->GetEnd().y;
+        }
+        else if (auto ellipse = ObjectCast<CEllipseSegment>(object.get())) {
+            record.type = DocumentObjectType::Ellipse;
+            record.color = ellipse->GetColor();
+            record.strokeWidth = ellipse->GetStrokeWidth();
+            record.shape[0] = ellipse->GetEllipse().point.x;
+            record.shape[1] = ellipse->GetEllipse().point.y;
+            record.shape[2] = ellipse->GetEllipse().radiusX;
+            record.shape[3] = ellipse->GetEllipse().radiusY;
+            record.shape[4] = ellipse->GetRotation();
+        }
+        else if (auto stroke = ObjectCast<CFreehandStroke>(object.get())) {
+            record.type = DocumentObjectType::Freehand;
+            record.strokeIndex = strokeIndex++;
+            record.color = stroke->GetColor();
+            record.strokeWidth = stroke->GetStrokeWidth();
+        }
+        else if (auto polyline = ObjectCast<CPolylineSegment>(object.get())) {
+            record.type = DocumentObjectType::Polyline;
+            record.strokeIndex = strokeIndex++;
+            record.color = polyline->GetColor();
+            record.strokeWidth = polyline->GetStrokeWidth();
+            record.shape[0] = polyline->IsClosed() ? 1.0f : 0.0f;
+        }
+        else if (auto bezier = ObjectCast<CBezierSegment>(object.get())) {
+            record.type = DocumentObjectType::Bezier;
+            record.strokeIndex = strokeIndex++;
+            record.color = bezier->GetColor();
+            record.strokeWidth = bezier->GetStrokeWidth();
+        }
+        writer.Write(&record, sizeof(record));
+    }
+
+    // ストロークテーブル
+    uint64_t dataOffset = 0;
+    for (const StrokeEntry& entry : strokes) {
+        DocumentStrokeRecord record = {};
+        record.dataOffset = dataOffset;
+        if (entry.vertices) {
+            record.pointCount = entry.vertices->size();
+            record.dataSize = record.pointCount * 2 * sizeof(float);
+            record.encoding = DocumentPointEncoding::Float;
+        }
+        else {
+            record.dataSize = entry.points->GetByteCount();
+            record.pointCount = entry.points->Size();
+            record.encoding = DocumentPointEncoding::Delta;
+            record.pointScale = entry.points->GetScale();
+            entry.stroke->GetMoments().GetState(record.moments);
+        }
+        writer.Write(&record, sizeof(record));
+        dataOffset += record.dataSize;
+    }
+
+    // 点ブロブ (符号化済みのデータをそのまま書き出し、中間のコピーを作らない)
+    for (const StrokeEntry& entry : strokes) {
+        if (entry.vertices) {
+            for (const D2D1_POINT_2F& v : *entry.vertices) writer.Write(&v.x, sizeof(float));
+            for (const D2D1_POINT_2F& v : *entry.vertices) writer.Write(&v.y, sizeof(float));
+        }
+        else {
+            writer.Write(entry.points->GetData(), entry.points->GetByteCount());
+        }
+    }
+    return header.fileSize;
+}
+
+HRESULT SaveDocumentFile(const CDocument& document, const wchar_t* path) {
+    std::vector<ObjectId> ids;
+    document.GetObjectIds(ids);
+    std::vector<std::shared_ptr<IDrawableObject>> objects;
+    objects.reserve(ids.size());
+    for (ObjectId id : ids) {
+        objects.push_back(document.FindObject(id));
+    }
+
+    // このファイルを読み込んだストローク (履歴にだけ残っているものを含む) があればマップを解放する
+    ReleaseMappedDocumentFile(path);
+    return SaveDocumentFile(objects, path);
+}
+
+HRESULT SaveDocumentFile(const std::vector<std::shared_ptr<IDrawableObject>>& objects, const wchar_t* path) {
+    std::wstring tempPath = std::wstring(path) + L".tmp";
+    HANDLE hFile = CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+
+    CDocumentFileWriter writer(hFile);
+    uint64_t fileSize = WriteDocumentImage(objects, writer);
+    writer.Flush();
+    HRESULT hr = writer.GetResult();
+    if (SUCCEEDED(hr) && writer.GetPosition() != fileSize) hr = E_FAIL;
+    if (SUCCEEDED(hr) && !FlushFileBuffers(hFile)) hr = HRESULT_FROM_WIN32(GetLastError());
+    CloseHandle(hFile);
+
+    if (SUCCEEDED(hr) && !MoveFileEx(tempPath.c_str(), path, MOVEFILE_REPLACE_EXISTING)) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    if (FAILED(hr)) DeleteFile(tempPath.c_str());
+    return hr;
+}
+
+void SerializeDocumentObjects(const std::vector<std::shared_ptr<IDrawableObject>>& objects, std::vector<char>& out) {
+    CDocumentFileWriter writer(out);
+    WriteDocumentImage(objects, writer);
+    writer.Flush();
+}
+
+
+// --- 読み込み ---
+
+// ストロークテーブルの要素を読み、点データがブロブ内に収まるか検証する
+// (バージョン 1 の要素は現在の形式に変換する)
+static bool ReadStrokeRecord(const char* data, const DocumentFileHeader& header, uint32_t index, bool isVersion1, DocumentStrokeRecord& out) {
+    if (index >= header.strokeCount) return false;
+    const char* pRecord = data + header.strokeTableOffset + (uint64_t)index * header.strokeRecordSize;
+
+    if (isVersion1) {
+        DocumentStrokeRecordV1 old;
+        std::memcpy(&old, pRecord, sizeof(old));
+        if (old.pointCount > header.pointBlobSize / (2 * sizeof(float))) return false;
+        out.dataOffset = old.firstPoint * sizeof(float);
+        out.dataSize = old.pointCount * 2 * sizeof(float);
+        out.pointCount = old.pointCount;
+        out.encoding = DocumentPointEncoding::Float;
+        out.moments = old.moments;
+    }
+    else {
+        std::memcpy(&out, pRecord, sizeof(out));
+    }
+    return out.dataOffset <= header.pointBlobSize && out.dataSize <= header.pointBlobSize - out.dataOffset;
+}
+
+// 統計量がストロークの点列と対応しているか (別のストロークの統計量と組み合わされていないか)
+// 統計量は単純化する前の入力点から累積するため点数は一致しないが、点列より少なくはならず、
+// 単純化で残る始点と終点は統計量の最初と最後の点と (符号化の丸めを除いて) 一致する
+static bool IsMomentsConsistent(const CFreehandStroke& stroke, const CStrokeMoments::State& moments) {
+    const float tolerance = 1.0f; // 符号化の丸めより十分大きい
+    size_t count = stroke.GetPointCount();
+    if (moments.count < count || (count == 0) != (moments.count == 0)) return false;
+    if (count == 0) return true;
+
+    D2D1_POINT_2F first = stroke.GetFirstPoint();
+    D2D1_POINT_2F last = stroke.GetLastPoint();
+    return std::abs(first.x - moments.origin.x) <= tolerance && std::abs(first.y - moments.origin.y) <= tolerance &&
+        std::abs(last.x - moments.last.x) <= tolerance && std::abs(last.y - moments.last.y) <= tolerance;
+}
+
+// 折れ線の頂点列やベジェ曲線の制御点列を読む (少数なので複製する)
+static bool ReadVertices(const char* data, const DocumentFileHeader& header, uint32_t index, bool isVersion1, std::vector<D2D1_POINT_2F>& out) {
+    DocumentStrokeRecord stroke;
+    if (!ReadStrokeRecord(data, header, index, isVersion1, stroke)) return false;
+    if (stroke.encoding != DocumentPointEncoding::Float ||
+        stroke.pointCount > header.pointBlobSize / (2 * sizeof(float)) ||
+        stroke.dataSize != stroke.pointCount * 2 * sizeof(float)) {
+        return false;
+    }
+
+    const char* pData = data + header.pointBlobOffset + stroke.dataOffset;
+    out.resize((size_t)stroke.pointCount);
+    for (size_t k = 0; k < out.size(); ++k) {
+        std::memcpy(&out[k].x, pData + k * sizeof(float), sizeof(float));
+        std::memcpy(&out[k].y, pData + (out.size() + k) * sizeof(float), sizeof(float));
+    }
+    return true;
+}
+
+// data からファイルと同じ形式の内容を読んで objects に格納する (失敗した場合の objects の内容は不定)
+// ストロークの点列は data を直接参照するため、owner が data を保持していること
+static HRESULT ReadDocumentImage(const char* data, uint64_t fileSize, const std::shared_ptr<const void>& owner,
+    std::vector<std::shared_ptr<IDrawableObject>>& objects) {
+    const HRESULT badFormat = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    if (fileSize < sizeof(DocumentFileHeader)) return badFormat;
+
+    // ヘッダーとセクション範囲の検証
+    DocumentFileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != DocumentFileMagic) return badFormat;
+    if (header.version == 0) return badFormat;
+    if (header.version > DocumentFileVersion) return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    const bool isVersion1 = header.version == 1;
+    const size_t strokeRecordSize = isVersion1 ? sizeof(DocumentStrokeRecordV1) : sizeof(DocumentStrokeRecord);
+    if (header.headerSize < sizeof(DocumentFileHeader) || header.fileSize != fileSize ||
+        header.objectRecordSize < sizeof(DocumentObjectRecord) ||
+        header.strokeRecordSize < strokeRecordSize ||
+        !IsRangeValid(header.objectTableOffset, header.objectCount, header.objectRecordSize, fileSize) ||
+        !IsRangeValid(header.strokeTableOffset, header.strokeCount, header.strokeRecordSize, fileSize) ||
+        !IsRangeValid(header.pointBlobOffset, header.pointBlobSize, 1, fileSize)) {
+        return badFormat;
+    }
+
+    const char* blob = data + header.pointBlobOffset;
+    objects.clear();
+    objects.reserve(header.objectCount);
+    for (uint32_t i = 0; i < header.objectCount; ++i) {
+        DocumentObjectRecord record;
+        std::memcpy(&record, data + header.objectTableOffset + (uint64_t)i * header.objectRecordSize, sizeof(record));
+
+        switch (record.type) {
+        case DocumentObjectType::Line:
+            objects.push_back(std::make_shared<CLineSegment>(
+                D2D1::Point2F(record.shape[0], record.shape[1]),
+                D2D1::Point2F(record.shape[2], record.shape[3]),
+                record.color, record.strokeWidth));
+            break;
+
+        case DocumentObjectType::Ellipse:
+            objects.push_back(std::make_shared<CEllipseSegment>(
+                D2D1::Ellipse(D2D1::Point2F(record.shape[0], record.shape[1]), record.shape[2], record.shape[3]),
+                record.color, record.strokeWidth, record.shape[4]));
+            break;
+
+        case DocumentObjectType::Freehand:
+        {
+            DocumentStrokeRecord stroke;
+            if (!ReadStrokeRecord(data, header, record.strokeIndex, isVersion1, stroke)) return badFormat;
+
+            // 点列はマップしたブロブを直接参照する
+            auto object = std::make_shared<CFreehandStroke>(record.color, record.strokeWidth);
+            const char* pData = blob + stroke.dataOffset;
+            if (stroke.encoding == DocumentPointEncoding::Float) {
+                if (stroke.pointCount > header.pointBlobSize / (2 * sizeof(float)) ||
+                    stroke.dataSize != stroke.pointCount * 2 * sizeof(float) ||
+                    reinterpret_cast<uintptr_t>(pData) % sizeof(float) != 0) {
+                    return badFormat;
+                }
+                const float* xs = reinterpret_cast<const float*>(pData);
+                object->Restore(CStrokePoints::FromExternal(xs, xs + stroke.pointCount, (size_t)stroke.pointCount, owner), stroke.moments);
+            }
+            else if (stroke.encoding == DocumentPointEncoding::Delta) {
+                CEncodedPoints points;
+                uint32_t scale = header.version >= 5 ? stroke.pointScale : CEncodedPoints::LegacyScale;
+                // 末尾の点は統計量の最後の点 (単純化でも残る終点) と同じ
+                if (!points.AssignExternal(reinterpret_cast<const uint8_t*>(pData), (size_t)stroke.dataSize, (size_t)stroke.pointCount,
+                        scale, stroke.moments.last, owner)) {
+                    return badFormat;
+                }
+                object->Restore(std::move(points), stroke.moments);
+            }
+            else {
+                return badFormat;
+            }
+            if (!IsMomentsConsistent(*object, stroke.moments)) return badFormat;
+            objects.push_back(object);
+            break;
+        }
+
+        case DocumentObjectType::Polyline:
+        {
+            std::vector<D2D1_POINT_2F> vertices;
+            if (!ReadVertices(data, header, record.strokeIndex, isVersion1, vertices) || vertices.size() < 2) return badFormat;
+            objects.push_back(std::make_shared<CPolylineSegment>(std::move(vertices), record.shape[0] != 0.0f,
+                record.color, record.strokeWidth));
+            break;
+        }
+
+        case DocumentObjectType::Bezier:
+        {
+            std::vector<D2D1_POINT_2F> controlPoints;
+            if (!ReadVertices(data, header, record.strokeIndex, isVersion1, controlPoints) ||
+                controlPoints.size() < 4 || (controlPoints.size() - 1) % 3 != 0) {
+                return badFormat;
+            }
+            objects.push_back(std::make_shared<CBezierSegment>(std::move(controlPoints), record.color, record.strokeWidth));
+            break;
+        }
+
+        default:
+            return badFormat;
+        }
+    }
+    return S_OK;
+}
+
+HRESULT LoadDocumentFile(CDocument& document, const wchar_t* path) {
+    auto file = std::make_shared<CMappedDocumentFile>();
+    HRESULT hr = file->Open(path);
+    if (FAILED(hr)) return hr;
+
+    // すべて検証してから置き換える (途中で失敗してもドキュメントは変更しない)
+    std::vector<std::shared_ptr<IDrawableObject>> objects;
+    hr = ReadDocumentImage(file->GetData(), file->GetSize(), file, objects);
+    if (FAILED(hr)) return hr;
+
+    for (const auto& object : objects) {
+        if (auto stroke = ObjectCast<CFreehandStroke>(object)) file->AddStroke(stroke);
+    }
+    RegisterMappedDocumentFile(file);
+
+    document.Clear();
+    for (const auto& object : objects) {
+        document.AddObject(object, false);
+    }
+    return S_OK;
+}
+
+HRESULT DeserializeDocumentObjects(const char* data, size_t size, const std::shared_ptr<const void>& owner,
+    std::vector<std::shared_ptr<IDrawableObject>>& outObjects) {
+    std::vector<std::shared_ptr<IDrawableObject>> objects;
+    HRESULT hr = ReadDocumentImage(data, size, owner, objects);
+    if (SUCCEEDED(hr)) outObjects = std::move(objects);
+    return hr;
+}
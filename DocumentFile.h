@@ -0,0 +1,100 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <cstdint>
+#include "DrawingObject.h"
+
+// --- ドキュメントのファイル形式 ---
+// [ヘッダー][オブジェクトテーブル][ストロークテーブル][点ブロブ] の順に並べる (リトルエンディアン)
+// 点ブロブにはストロークごとの点列を連続して格納する
+// 読み込み時はファイルをメモリにマップし、点列は複製せずにブロブを直接参照する
+//
+// バージョン 1: 点列は x の配列、y の配列 (float) を続けて格納する
+// バージョン 2: ストロークごとに点列の符号化方式を持つ (保存時は常に差分符号化)
+// バージョン 3: 折れ線 (Polyline) を追加。頂点列はストロークテーブルの要素として格納する
+// バージョン 4: ベジェ曲線 (Bezier) を追加。制御点列は折れ線の頂点列と同じく格納する
+// バージョン 5: 差分符号化の格子の細かさをストロークごとに持つ (それ以前は 1/4)
+
+const uint32_t DocumentFileMagic = 0x44504941; // "AIPD"
+const uint16_t DocumentFileVersion = 5;
+
+enum class DocumentObjectType : uint32_t {
+    Line = 1,
+    Ellipse = 2,
+    Freehand = 3,
+    Polyline = 4,
+    Bezier = 5,
+};
+
+struct DocumentFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t objectCount;
+    uint32_t objectRecordSize;
+    uint64_t objectTableOffset;
+    uint64_t strokeTableOffset;
+    uint32_t strokeCount;
+    uint32_t strokeRecordSize;
+    uint64_t pointBlobOffset;
+    uint64_t pointBlobSize; // バイト数
+    uint64_t fileSize;      // 書き込みが途中で終わったファイルの検出用
+};
+
+// オブジェクトテーブルの要素 (z順に背面から並べる)
+struct DocumentObjectRecord {
+    DocumentObjectType type;
+    uint32_t strokeIndex; // Freehand, Polyline, Bezier の場合のストロークテーブルの番号
+    D2D1_COLOR_F color;
+    float strokeWidth;
+    float shape[5]; // Line: 始点 x, y, 終点 x, y / Ellipse: 中心 x, y, 半径 x, y, 回転角 (度) / Polyline: 閉じているか (0 または 1)
+};
+
+// 点列の符号化方式
+enum class DocumentPointEncoding : uint32_t {
+    Float = 0, // x の配列、y の配列 (float) の順 (4 バイト境界に置く)
+    Delta = 1, // CEncodedPoints の差分符号化
+};
+
+// ストロークテーブルの要素
+// Polyline の頂点列と Bezier の制御点列は Float で格納し、統計量は使わない (境界は揃えないため、読み込み時に複製する)
+struct DocumentStrokeRecord {
+    uint64_t dataOffset; // 点ブロブ先頭からのバイト位置
+    uint64_t dataSize;   // バイト数
+    uint64_t pointCount;
+    DocumentPointEncoding encoding;
+    uint32_t pointScale; // Delta の格子の細かさ (CEncodedPoints::GetScale。バージョン 4 以前は 0)
+    CStrokeMoments::State moments; // 読み込み時に点列を走査せずに済むように保存する
+};
+
+// バージョン 1 のストロークテーブルの要素 (点列は常に Float)
+struct DocumentStrokeRecordV1 {
+    uint64_t firstPoint; // 点ブロブ先頭からの float 単位の位置 (x の配列の先頭)
+    uint64_t pointCount; // y の配列は firstPoint + pointCount から始まる
+    CStrokeMoments::State moments;
+};
+
+static_assert(sizeof(DocumentFileHeader) == 64, "DocumentFileHeader layout");
+static_assert(sizeof(DocumentObjectRecord) == 48, "DocumentObjectRecord layout");
+static_assert(sizeof(DocumentStrokeRecord) == 192, "DocumentStrokeRecord layout");
+static_assert(sizeof(DocumentStrokeRecordV1) == 176, "DocumentStrokeRecordV1 layout");
+
+// z順にファイルへ書き出す。一時ファイルに書いてから置き換えるため、失敗しても元のファイルは残る
+// path を読み込んだストロークがあれば、置き換える前に点列を複製してファイルのマップを解放する
+// (UI スレッドから呼び出す。点列を書き換えるため、他のスレッドでの書き出しとは内部で排他する)
+HRESULT SaveDocumentFile(const CDocument& document, const wchar_t* path);
+
+// z順 (背面から) に並べたオブジェクトを書き出す
+// オブジェクトは作成後に変化しないため、集めておけばドキュメントを変更するスレッドとは別のスレッドから呼び出せる
+HRESULT SaveDocumentFile(const std::vector<std::shared_ptr<IDrawableObject>>& objects, const wchar_t* path);
+
+// ファイルと同じ形式でメモリ上に書き出す / 読み込む (自動保存の記録に使う)
+// 読み込んだストロークの点列は data を直接参照するため、owner が data を保持していること
+// 読み込みに失敗した場合は outObjects を変更しない
+void SerializeDocumentObjects(const std::vector<std::shared_ptr<IDrawableObject>>& objects, std::vector<char>& out);
+HRESULT DeserializeDocumentObjects(const char* data, size_t size, const std::shared_ptr<const void>& owner,
+    std::vector<std::shared_ptr<IDrawableObject>>& outObjects);
+
+// ファイルを読み込んでドキュメントの内容 (履歴を含む) を置き換える
+// 読み込みに失敗した場合はドキュメントを変更しない
+HRESULT LoadDocumentFile(CDocument& document, const wchar_t* path);
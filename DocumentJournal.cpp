@@ -0,0 +1,572 @@
+﻿#include "DocumentJournal.h"
+#include "DocumentFile.h"
+#include <shlobj.h>
+#include <cstring>
+#include <unordered_map>
+
+#pragma comment(lib, "shell32.lib")
+#pragma comment(lib, "ole32.lib")
+
+// 直前の Win32 エラーを HRESULT にする (エラーが設定されていなければ E_FAIL)
+static HRESULT LastErrorResult() {
+    HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+    return SUCCEEDED(hr) ? E_FAIL : hr;
+}
+
+// FNV-1a (hash に前の範囲の値を渡すと続けて計算できる)
+static uint32_t ComputeChecksum(const void* data, size_t size, uint32_t hash = 2166136261u) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static HRESULT ReadWholeFile(const std::wstring& path, std::vector<char>& out) {
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return LastErrorResult();
+
+    HRESULT hr = S_OK;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size)) {
+        hr = LastErrorResult();
+    }
+    else if ((ULONGLONG)size.QuadPart > (ULONGLONG)SIZE_MAX) {
+        hr = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    }
+    else {
+        out.resize((size_t)size.QuadPart);
+        size_t done = 0;
+        while (done < out.size()) {
+            DWORD chunk = (DWORD)min(out.size() - done, (size_t)0x40000000);
+            DWORD read = 0;
+            if (!ReadFile(hFile, out.data() + done, chunk, &read, NULL)) {
+                hr = LastErrorResult();
+                break;
+            }
+            if (read == 0) {
+                out.resize(done); // 開いた後に短くなった
+                break;
+            }
+            done += read;
+        }
+    }
+    CloseHandle(hFile);
+    return hr;
+}
+
+// 記録した操作を1つ適用する (記録と合わない場合は false)
+static bool ApplyJournalEntry(CDocument& document, DocumentJournalEntryType type, const std::vector<uint32_t>& positions,
+    const std::vector<std::shared_ptr<IDrawableObject>>& objects) {
+    switch (type) {
+    case DocumentJournalEntryType::Add:
+        if (objects.size() != 1) return false;
+        document.AddObject(objects[0]);
+        return true;
+
+    case DocumentJournalEntryType::Complement:
+    {
+        if (positions.empty() || positions.size() != objects.size()) return false;
+        std::vector<ObjectId> ids;
+        document.GetObjectIds(ids);
+        for (uint32_t position : positions) {
+            if (position >= ids.size()) return false;
+        }
+
+        // 記録時と同じく1つの Undo 単位にする
+        document.BeginTransaction();
+        for (size_t i = 0; i < positions.size(); ++i) {
+            ObjectId id = ids[positions[i]];
+            document.ExecuteCommand(std::make_unique<CComplementCommand>(&document, id, document.FindObject(id), objects[i]));
+        }
+        document.CommitTransaction();
+        return true;
+    }
+
+    case DocumentJournalEntryType::Undo:
+        document.Undo();
+        return true;
+
+    case DocumentJournalEntryType::Redo:
+        document.Redo();
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// --- CDocumentJournal 実装 ---
+
+CDocumentJournal::CDocumentJournal()
+    : m_hLockFile(INVALID_HANDLE_VALUE), m_recoverySnapshot(0), m_hasRecoveryData(false),
+      m_undoDepth(0), m_redoDepth(0),
+      m_hThread(NULL), m_hWakeEvent(NULL), m_hStopEvent(NULL),
+      m_snapshotQueued(false), m_journalBytes(0), m_snapshotBytes(0), m_hr(S_OK),
+      m_hFile(INVALID_HANDLE_VALUE), m_hWriteEvent(NULL), m_overlapped(), m_isWriting(false),
+      m_fileSize(0), m_snapshotNumber(0) {
+}
+
+std::wstring CDocumentJournal::GetDefaultDirectory() {
+    std::wstring directory;
+    PWSTR pPath = nullptr;
+    if (SUCCEEDED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, NULL, &pPath))) {
+        directory = pPath;
+        directory += L"\\AIPaint";
+    }
+    CoTaskMemFree(pPath);
+
+    if (directory.empty()) {
+        wchar_t temp[MAX_PATH + 1];
+        DWORD length = GetTempPath(MAX_PATH + 1, temp);
+        if (length > 0 && length <= MAX_PATH) {
+            directory.assign(temp, length);
+            directory += L"AIPaint";
+        }
+    }
+    return directory;
+}
+
+std::wstring CDocumentJournal::GetSnapshotPath(uint64_t number) const {
+    return m_directory + L"snapshot-" + std::to_wstring(number) + L".aipd";
+}
+
+void CDocumentJournal::DeleteSnapshots(uint64_t keepNumber) const {
+    std::wstring keepName = keepNumber != 0 ? L"snapshot-" + std::to_wstring(keepNumber) + L".aipd" : L"";
+
+    WIN32_FIND_DATA data;
+    HANDLE hFind = FindFirstFile((m_directory + L"snapshot-*.aipd").c_str(), &data);
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do {
+        // 復元したドキュメントのストロークが参照している間は、そのスナップショットをマップしたままのため削除できない
+        // 削除できなかったものは、次に Open したときに改めて削除する
+        if (keepName != data.cFileName) {
+            DeleteFile((m_directory + data.cFileName).c_str());
+        }
+    } while (FindNextFile(hFind, &data));
+    FindClose(hFind);
+}
+
+HRESULT CDocumentJournal::Open(const std::wstring& directory) {
+    if (m_hLockFile != INVALID_HANDLE_VALUE) return S_OK;
+
+    m_directory = directory;
+    if (m_directory.empty() || m_directory.back() != L'\\') m_directory += L'\\';
+    if (!CreateDirectory(m_directory.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        return LastErrorResult();
+    }
+
+    // 共有せずに開き、閉じたときに削除されるロックファイルで他のプロセスとの競合を防ぐ
+    m_hLockFile = CreateFile((m_directory + L"autosave.lock").c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (m_hLockFile == INVALID_HANDLE_VALUE) return LastErrorResult();
+
+    // 前回の記録のヘッダーだけを読み、復元できる内容があるか調べる
+    m_recoverySnapshot = 0;
+    m_hasRecoveryData = false;
+    HANDLE hFile = CreateFile(GetJournalPath().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile != INVALID_HANDLE_VALUE) {
+        DocumentJournalHeader header;
+        DWORD read = 0;
+        LARGE_INTEGER size;
+        if (ReadFile(hFile, &header, sizeof(header), &read, NULL) && read == sizeof(header) &&
+            header.magic == DocumentJournalMagic && header.version <= DocumentJournalVersion &&
+            header.headerSize >= sizeof(header) && GetFileSizeEx(hFile, &size)) {
+            m_recoverySnapshot = header.snapshotNumber;
+            m_hasRecoveryData = header.snapshotNumber != 0 || (uint64_t)size.QuadPart > header.headerSize;
+        }
+        CloseHandle(hFile);
+    }
+    m_snapshotNumber = m_recoverySnapshot;
+
+    // 前回のプロセスが復元後にマップしていて削除できなかったスナップショットを削除する
+    DeleteSnapshots(m_hasRecoveryData ? m_recoverySnapshot : 0);
+    return S_OK;
+}
+
+HRESULT CDocumentJournal::Recover(CDocument& document) {
+    if (!m_hasRecoveryData) return S_FALSE;
+
+    // 記録はスナップショットに比べて小さいため読み込み、復元したストロークの点列から直接参照する
+    auto buffer = std::make_shared<std::vector<char>>();
+    HRESULT hr = ReadWholeFile(GetJournalPath(), *buffer);
+    if (FAILED(hr)) return hr;
+
+    const HRESULT badFormat = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    const char* data = buffer->data();
+    const size_t size = buffer->size();
+    DocumentJournalHeader header;
+    if (size < sizeof(header)) return badFormat;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != DocumentJournalMagic || header.version > DocumentJournalVersion ||
+        header.headerSize < sizeof(header) || header.headerSize > size) {
+        return badFormat;
+    }
+
+    // スナップショットはマップして読み込む (点列は複製しない)
+    if (header.snapshotNumber != 0) {
+        hr = LoadDocumentFile(document, GetSnapshotPath(header.snapshotNumber).c_str());
+        if (FAILED(hr)) return hr;
+    }
+    else {
+        document.Clear();
+    }
+
+    // 続きの操作を適用する。書き込みが途中で終わったエントリ以降は捨てる
+    std::shared_ptr<const void> owner = buffer;
+    std::vector<uint32_t> positions;
+    std::vector<std::shared_ptr<IDrawableObject>> objects;
+    size_t offset = header.headerSize;
+    while (size - offset >= sizeof(DocumentJournalEntry)) {
+        DocumentJournalEntry entry;
+        std::memcpy(&entry, data + offset, sizeof(entry));
+        const char* pBody = data + offset + sizeof(entry);
+        uint64_t positionBytes = (uint64_t)entry.positionCount * sizeof(uint32_t);
+        if (positionBytes + entry.payloadSize > size - offset - sizeof(entry)) break;
+        size_t bodySize = (size_t)(positionBytes + entry.payloadSize);
+
+        uint32_t checksum = entry.checksum;
+        entry.checksum = 0;
+        if (ComputeChecksum(pBody, bodySize, ComputeChecksum(&entry, sizeof(entry))) != checksum) break;
+
+        positions.resize(entry.positionCount);
+        if (positionBytes > 0) std::memcpy(positions.data(), pBody, (size_t)positionBytes);
+        objects.clear();
+        if (entry.payloadSize > 0 &&
+            FAILED(DeserializeDocumentObjects(pBody + positionBytes, entry.payloadSize, owner, objects))) {
+            break;
+        }
+        if (!ApplyJournalEntry(document, entry.type, positions, objects)) break;
+        offset += sizeof(entry) + bodySize;
+    }
+    return S_OK;
+}
+
+HRESULT CDocumentJournal::Start(const CDocument& document) {
+    if (m_hLockFile == INVALID_HANDLE_VALUE) return E_UNEXPECTED;
+    if (m_hThread) return S_OK;
+
+    m_hr = S_OK;
+    m_undoDepth = 0;
+    m_redoDepth = 0;
+    m_hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    m_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_hWriteEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (m_hWakeEvent && m_hStopEvent && m_hWriteEvent) {
+        m_hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+    }
+    if (!m_hThread) {
+        HRESULT hr = LastErrorResult();
+        Close(false);
+        return hr;
+    }
+
+    // 最初のスナップショットが書き出された時点で前回の記録は不要になる
+    RecordSnapshot(document);
+    m_hasRecoveryData = false;
+    return S_OK;
+}
+
+void CDocumentJournal::Close(bool discard) {
+    if (m_hThread) {
+        // 停止までに受け取った要求は書き出してから終了する
+        SetEvent(m_hStopEvent);
+        WaitForSingleObject(m_hThread, INFINITE);
+        CloseHandle(m_hThread);
+        m_hThread = NULL;
+    }
+    HANDLE* events[] = { &m_hWakeEvent, &m_hStopEvent, &m_hWriteEvent };
+    for (HANDLE* pEvent : events) {
+        if (*pEvent) {
+            CloseHandle(*pEvent);
+            *pEvent = NULL;
+        }
+    }
+    m_requests.clear();
+
+    if (m_hLockFile != INVALID_HANDLE_VALUE) {
+        if (discard) {
+            DeleteFile(GetJournalPath().c_str());
+            DeleteSnapshots(0);
+        }
+        CloseHandle(m_hLockFile);
+        m_hLockFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+void CDocumentJournal::Push(Request request) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_requests.push_back(std::move(request));
+    }
+    SetEvent(m_hWakeEvent);
+}
+
+void CDocumentJournal::CompactIfNeeded(const CDocument& document) {
+    if (m_snapshotQueued) return;
+
+    // 復元時に適用する記録がスナップショットの読み込みより重くならないようにまとめる
+    uint64_t threshold = m_snapshotBytes / 2;
+    if (threshold < MinCompactBytes) threshold = MinCompactBytes;
+    if (m_journalBytes > threshold) {
+        RecordSnapshot(document);
+    }
+}
+
+void CDocumentJournal::RecordAdd(const CDocument& document, std::shared_ptr<IDrawableObject> object) {
+    if (!m_hThread || FAILED(m_hr)) return;
+
+    ++m_undoDepth;
+    m_redoDepth = 0;
+    Push(Request{ false, DocumentJournalEntryType::Add, {}, { std::move(object) } });
+    CompactIfNeeded(document);
+}
+
+void CDocumentJournal::RecordComplement(const CDocument& document, const std::vector<ObjectId>& ids,
+    const std::vector<std::shared_ptr<IDrawableObject>>& newObjects) {
+    if (!m_hThread || FAILED(m_hr) || ids.empty()) return;
+
+    // 置き換えても z順は変わらないため、現在の位置が操作したときの位置になる
+    std::unordered_map<uint32_t, size_t> targets;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        targets[ids[i].slot] = i;
+    }
+    Request request = { false, DocumentJournalEntryType::Complement, std::vector<uint32_t>(ids.size(), UINT32_MAX), newObjects };
+    std::vector<ObjectId> all;
+    document.GetObjectIds(all);
+    for (size_t position = 0; position < all.size(); ++position) {
+        auto it = targets.find(all[position].slot);
+        if (it != targets.end() && ids[it->second] == all[position]) {
+            request.positions[it->second] = (uint32_t)position;
+        }
+    }
+    for (uint32_t position : request.positions) {
+        if (position == UINT32_MAX) {
+            // ドキュメントに無いIDが含まれる場合は操作として記録できないため、内容ごと書き出す
+            RecordSnapshot(document);
+            return;
+        }
+    }
+
+    ++m_undoDepth;
+    m_redoDepth = 0;
+    Push(std::move(request));
+    CompactIfNeeded(document);
+}
+
+void CDocumentJournal::RecordUndo(const CDocument& document) {
+    if (!m_hThread || FAILED(m_hr)) return;
+
+    // スナップショットより前の操作の取り消しは、復元したドキュメントの履歴では再現できない
+    if (m_undoDepth == 0) {
+        RecordSnapshot(document);
+        return;
+    }
+    --m_undoDepth;
+    ++m_redoDepth;
+    Push(Request{ false, DocumentJournalEntryType::Undo, {}, {} });
+    CompactIfNeeded(document);
+}
+
+void CDocumentJournal::RecordRedo(const CDocument& document) {
+    if (!m_hThread || FAILED(m_hr)) return;
+
+    if (m_redoDepth == 0) {
+        RecordSnapshot(document);
+        return;
+    }
+    --m_redoDepth;
+    ++m_undoDepth;
+    Push(Request{ false, DocumentJournalEntryType::Redo, {}, {} });
+    CompactIfNeeded(document);
+}
+
+void CDocumentJournal::RecordSnapshot(const CDocument& document) {
+    if (!m_hThread || FAILED(m_hr)) return;
+
+    // UI スレッドではオブジェクトの参照を集めるだけにし、書き出しは I/O スレッドで行う
+    Request request = { true, DocumentJournalEntryType::Add, {}, {} };
+    std::vector<ObjectId> ids;
+    document.GetObjectIds(ids);
+    request.objects.reserve(ids.size());
+    for (ObjectId id : ids) {
+        request.objects.push_back(document.FindObject(id));
+    }
+
+    m_undoDepth = 0;
+    m_redoDepth = 0;
+    m_snapshotQueued = true;
+    Push(std::move(request));
+}
+
+DWORD WINAPI CDocumentJournal::ThreadProc(LPVOID param) {
+    static_cast<CDocumentJournal*>(param)->Run();
+    return 0;
+}
+
+void CDocumentJournal::Run() {
+    HANDLE handles[] = { m_hStopEvent, m_hWakeEvent };
+    for (;;) {
+        DWORD result = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+        ProcessRequests(); // 停止の要求より前に受け取ったものも書き出す
+        if (result != WAIT_OBJECT_0 + 1) break;
+    }
+
+    HRESULT hr = CompleteWrite();
+    if (FAILED(hr)) Fail(hr);
+    if (m_hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+void CDocumentJournal::ProcessRequests() {
+    std::vector<Request> requests;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        requests.swap(m_requests);
+    }
+
+    // 続けて受け取ったエントリは1回の書き込みにまとめる
+    for (const Request& request : requests) {
+        if (FAILED(m_hr)) return;
+        if (!request.isSnapshot) {
+            AppendEntry(request);
+            continue;
+        }
+
+        // スナップショットより前のエントリを今の記録へ書き出してから置き換える
+        HRESULT hr = BeginWrite();
+        if (SUCCEEDED(hr)) hr = CompleteWrite();
+        if (SUCCEEDED(hr)) hr = WriteSnapshot(request.objects);
+        m_snapshotQueued = false;
+        if (FAILED(hr)) Fail(hr);
+    }
+
+    HRESULT hr = BeginWrite();
+    if (FAILED(hr)) Fail(hr);
+}
+
+void CDocumentJournal::AppendEntry(const Request& request) {
+    size_t start = m_pendingBuffer.size();
+    size_t positionBytes = request.positions.size() * sizeof(uint32_t);
+    m_pendingBuffer.resize(start + sizeof(DocumentJournalEntry) + positionBytes);
+    if (positionBytes > 0) {
+        std::memcpy(m_pendingBuffer.data() + start + sizeof(DocumentJournalEntry), request.positions.data(), positionBytes);
+    }
+    if (!request.objects.empty()) {
+        SerializeDocumentObjects(request.objects, m_pendingBuffer);
+    }
+
+    DocumentJournalEntry entry = {};
+    entry.type = request.type;
+    entry.positionCount = (uint32_t)request.positions.size();
+    entry.payloadSize = (uint32_t)(m_pendingBuffer.size() - start - sizeof(DocumentJournalEntry) - positionBytes);
+    std::memcpy(m_pendingBuffer.data() + start, &entry, sizeof(entry));
+    entry.checksum = ComputeChecksum(m_pendingBuffer.data() + start, m_pendingBuffer.size() - start);
+    std::memcpy(m_pendingBuffer.data() + start, &entry, sizeof(entry));
+}
+
+HRESULT CDocumentJournal::BeginWrite() {
+    if (m_pendingBuffer.empty()) return S_OK;
+
+    // 前の書き込みが終わるまではバッファを入れ替えられない
+    HRESULT hr = CompleteWrite();
+    if (FAILED(hr)) return hr;
+    m_writingBuffer.swap(m_pendingBuffer);
+    m_pendingBuffer.clear();
+
+    // 完了を待たずに次の要求を受け付ける (完了したかは次の書き込みの前に確かめる)
+    // 異常終了ではキャッシュ済みのデータは失われないため、書き込みのたびにはディスクへ書き出さない
+    m_overlapped = OVERLAPPED();
+    m_overlapped.Offset = (DWORD)m_fileSize;
+    m_overlapped.OffsetHigh = (DWORD)(m_fileSize >> 32);
+    m_overlapped.hEvent = m_hWriteEvent;
+    if (!WriteFile(m_hFile, m_writingBuffer.data(), (DWORD)m_writingBuffer.size(), NULL, &m_overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        return LastErrorResult();
+    }
+    m_isWriting = true;
+    m_fileSize += m_writingBuffer.size();
+    m_journalBytes = m_fileSize;
+    return S_OK;
+}
+
+HRESULT CDocumentJournal::CompleteWrite() {
+    if (!m_isWriting) return S_OK;
+
+    m_isWriting = false;
+    DWORD written = 0;
+    if (!GetOverlappedResult(m_hFile, &m_overlapped, &written, TRUE)) return LastErrorResult();
+    return written == m_writingBuffer.size() ? S_OK : E_FAIL;
+}
+
+HRESULT CDocumentJournal::WriteSnapshot(const std::vector<std::shared_ptr<IDrawableObject>>& objects) {
+    // 記録が参照しているスナップショットは置き換えない (書き出しの途中で終了しても前回の組が残る)
+    uint64_t number = objects.empty() ? 0 : m_snapshotNumber + 1;
+    if (number != 0) {
+        HRESULT hr = SaveDocumentFile(objects, GetSnapshotPath(number).c_str());
+        if (FAILED(hr)) return hr;
+    }
+
+    if (m_hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+    HRESULT hr = CreateJournalFile(number);
+    if (FAILED(hr)) return hr;
+    m_snapshotNumber = number;
+    DeleteSnapshots(number);
+
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (number != 0 && GetFileAttributesEx(GetSnapshotPath(number).c_str(), GetFileExInfoStandard, &attributes)) {
+        m_snapshotBytes = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    }
+    else {
+        m_snapshotBytes = 0;
+    }
+    return S_OK;
+}
+
+HRESULT CDocumentJournal::CreateJournalFile(uint64_t snapshotNumber) {
+    // 一時ファイルにヘッダーを書いてから置き換え、追記用に開き直す
+    std::wstring path = GetJournalPath();
+    std::wstring tempPath = path + L".tmp";
+    HANDLE hFile = CreateFile(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return LastErrorResult();
+
+    DocumentJournalHeader header = {};
+    header.magic = DocumentJournalMagic;
+    header.version = DocumentJournalVersion;
+    header.headerSize = sizeof(DocumentJournalHeader);
+    header.snapshotNumber = snapshotNumber;
+
+    HRESULT hr = S_OK;
+    DWORD written = 0;
+    if (!WriteFile(hFile, &header, sizeof(header), &written, NULL) || written != sizeof(header)) hr = LastErrorResult();
+    // スナップショットより先に新しい記録がディスクに残らないように、置き換える前に書き出す
+    if (SUCCEEDED(hr) && !FlushFileBuffers(hFile)) hr = LastErrorResult();
+    CloseHandle(hFile);
+    if (SUCCEEDED(hr) && !MoveFileEx(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        hr = LastErrorResult();
+    }
+    if (FAILED(hr)) {
+        DeleteFile(tempPath.c_str());
+        return hr;
+    }
+
+    m_hFile = CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+    if (m_hFile == INVALID_HANDLE_VALUE) return LastErrorResult();
+    m_fileSize = sizeof(header);
+    m_journalBytes = m_fileSize;
+    return S_OK;
+}
+
+void CDocumentJournal::Fail(HRESULT hr) {
+    // 最初のエラーだけを残し、以降の記録を止める (記録済みの内容は前回のスナップショットと組で有効なまま)
+    HRESULT expected = S_OK;
+    m_hr.compare_exchange_strong(expected, hr);
+    m_pendingBuffer.clear();
+}
@@ -0,0 +1,144 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "DrawingObject.h"
+
+// --- 自動保存の記録ファイル形式 ---
+// [ヘッダー][エントリ]... の順に追記する (リトルエンディアン)
+// エントリは [DocumentJournalEntry][z順の位置 (uint32_t) × positionCount][オブジェクト (payloadSize バイト)] の可変長
+// オブジェクトはドキュメントファイルと同じ形式でメモリ上に書き出したもの
+// ヘッダーが示すスナップショット (ドキュメントファイル) を読み込み、エントリを順に適用すると記録時の内容になる
+
+const uint32_t DocumentJournalMagic = 0x4A504941; // "AIPJ"
+const uint16_t DocumentJournalVersion = 1;
+
+struct DocumentJournalHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint64_t snapshotNumber; // 0 は空のドキュメントから始まることを表す
+};
+
+// 記録する操作
+enum class DocumentJournalEntryType : uint32_t {
+    Add = 1,        // オブジェクト1つを最前面に追加
+    Complement = 2, // 各位置のオブジェクトを置き換える (複数の場合は1つの Undo 単位)
+    Undo = 3,
+    Redo = 4,
+};
+
+struct DocumentJournalEntry {
+    DocumentJournalEntryType type;
+    uint32_t positionCount;
+    uint32_t payloadSize;
+    uint32_t checksum; // このフィールドを 0 としたエントリ全体の FNV-1a (書き込みが途中で終わったエントリの検出用)
+};
+
+static_assert(sizeof(DocumentJournalHeader) == 16, "DocumentJournalHeader layout");
+static_assert(sizeof(DocumentJournalEntry) == 16, "DocumentJournalEntry layout");
+
+// --- 自動保存 (異常終了からの復元用) ---
+// ドキュメントを変更した操作を UI スレッドから受け取り、I/O スレッドがまとめて記録ファイルへ追記する
+// 記録が大きくなったら、その時点のオブジェクトをスナップショットとして書き出して記録を空にする
+// オブジェクトは作成後に変化しないため、書き出しは参照を受け取った I/O スレッドで行い、UI スレッドを止めない
+//
+// 復元後のドキュメントの履歴はスナップショット以降の操作だけを持つ。スナップショットより前の操作を
+// Undo した場合は記録で再現できないため、その時点の内容をスナップショットとして書き出し直す
+class CDocumentJournal {
+private:
+    struct Request {
+        bool isSnapshot;
+        DocumentJournalEntryType type; // isSnapshot の場合は使わない
+        std::vector<uint32_t> positions;
+        std::vector<std::shared_ptr<IDrawableObject>> objects; // スナップショットの場合は z順のすべてのオブジェクト
+    };
+
+    static const uint64_t MinCompactBytes = 4 * 1024 * 1024; // これより小さい記録はスナップショットにまとめない
+
+    std::wstring m_directory; // 末尾は '\'
+    HANDLE m_hLockFile;       // 同じフォルダを複数のプロセスが使わないように開いておく
+    uint64_t m_recoverySnapshot; // Open の時点で記録が参照していたスナップショット
+    bool m_hasRecoveryData;
+
+    // UI スレッドのみが使う
+    size_t m_undoDepth; // 記録から復元したドキュメントで Undo できる数
+    size_t m_redoDepth;
+
+    // スレッド間で共有する
+    HANDLE m_hThread;
+    HANDLE m_hWakeEvent; // 要求の追加 (自動リセット)
+    HANDLE m_hStopEvent;
+    std::mutex m_mutex;
+    std::vector<Request> m_requests;
+    std::atomic<bool> m_snapshotQueued;
+    std::atomic<uint64_t> m_journalBytes;  // 現在の記録ファイルの大きさ
+    std::atomic<uint64_t> m_snapshotBytes; // 最後に書き出したスナップショットの大きさ
+    std::atomic<HRESULT> m_hr; // I/O スレッドで最初に発生したエラー (以降は記録しない)
+
+    // I/O スレッドのみが使う
+    HANDLE m_hFile; // FILE_FLAG_OVERLAPPED で開いた記録ファイル
+    HANDLE m_hWriteEvent;
+    OVERLAPPED m_overlapped;
+    bool m_isWriting;
+    std::vector<char> m_writingBuffer; // 書き込み中 (完了まで保持する)
+    std::vector<char> m_pendingBuffer; // 次に書き込むエントリ
+    uint64_t m_fileSize;
+    uint64_t m_snapshotNumber;
+
+    std::wstring GetJournalPath() const { return m_directory + L"journal.aipj"; }
+    std::wstring GetSnapshotPath(uint64_t number) const;
+    void DeleteSnapshots(uint64_t keepNumber) const; // keepNumber 以外のスナップショットを削除する (マップ中のものは残る)
+
+    void Push(Request request);
+    void CompactIfNeeded(const CDocument& document);
+
+    static DWORD WINAPI ThreadProc(LPVOID param);
+    void Run();
+    void ProcessRequests();
+    void AppendEntry(const Request& request);
+    HRESULT BeginWrite();    // 溜まったエントリの書き込みを開始する (完了は待たない)
+    HRESULT CompleteWrite(); // 書き込み中のものがあれば完了を待つ
+    HRESULT WriteSnapshot(const std::vector<std::shared_ptr<IDrawableObject>>& objects);
+    HRESULT CreateJournalFile(uint64_t snapshotNumber);
+    void Fail(HRESULT hr);
+
+public:
+    CDocumentJournal();
+    ~CDocumentJournal() { Close(false); }
+    CDocumentJournal(const CDocumentJournal&) = delete;
+    CDocumentJournal& operator=(const CDocumentJournal&) = delete;
+
+    // %LOCALAPPDATA%\AIPaint (取得できなければ一時フォルダ)
+    static std::wstring GetDefaultDirectory();
+
+    // 記録先のフォルダを開く (他のプロセスが使用中の場合は失敗する)
+    HRESULT Open(const std::wstring& directory);
+
+    // 前回の記録が残っていれば、スナップショットをマップして読み込み、続きの操作を順に適用する
+    // 末尾の書き込みが途中で終わったエントリは捨てる。スナップショットを読めない場合はドキュメントを変更しない
+    bool HasRecoveryData() const { return m_hasRecoveryData; }
+    HRESULT Recover(CDocument& document);
+
+    // 現在の内容をスナップショットとして記録を始める (前回の記録は置き換えられる)
+    HRESULT Start(const CDocument& document);
+
+    // I/O スレッドを止める。discard の場合は記録を削除する (正常に終了する場合)
+    // 復元したストロークがスナップショットをマップしていると削除できないため、先にドキュメントを空にしておく
+    void Close(bool discard);
+    bool IsStarted() const { return m_hThread != NULL; }
+    HRESULT GetResult() const { return m_hr; }
+
+    // ドキュメントを変更した直後に呼び出す (UI スレッドから)
+    void RecordAdd(const CDocument& document, std::shared_ptr<IDrawableObject> object);
+    void RecordComplement(const CDocument& document, const std::vector<ObjectId>& ids,
+        const std::vector<std::shared_ptr<IDrawableObject>>& newObjects); // ids[i] を newObjects[i] で置き換えた
+    void RecordUndo(const CDocument& document); // 実際に取り消した場合のみ
+    void RecordRedo(const CDocument& document);
+    void RecordSnapshot(const CDocument& document); // 読み込みなどで内容全体が変わった場合
+};
@@ -1,132 +1,400 @@
 ﻿#include "DrawingObject.h"
+#include "ShapeRecognizer.h"
+#include "BezierFit.h"
+#include <execution>
 
-// === ヘルパー関数: 楕円フィッティング (簡略版) ===
-bool FitEllipse(const std::vector<D2D1_POINT_2F>& points, float tolerance, D2D1_ELLIPSE& outEllipse) {
-    if (points.size() < 5) return false;
-
-    // 1. バウンディングボックスの計算
-    float minX = points[0].x, minY = points[0].y;
-    float maxX = points[0].x, maxY = points[0].y;
-    for (const auto& p : points) {
-        minX = min(minX, p.x);
-        maxX = max(maxX, p.x);
-        minY = min(minY, p.y);
-        maxY = max(maxY, p.y);
+// === ヘルパー関数: 点と線分の距離 ===
+float DistanceToSegment(D2D1_POINT_2F p, D2D1_POINT_2F a, D2D1_POINT_2F b) {
+    float dx = b.x - a.x;
+    float dy = b.y - a.y;
+    float lenSq = dx * dx + dy * dy;
+    float t = 0.0f;
+    if (lenSq > 0.0f) {
+        t = ((p.x - a.x) * dx + (p.y - a.y) * dy) / lenSq;
+        t = max(0.0f, min(1.0f, t));
     }
+    float ex = p.x - (a.x + t * dx);
+    float ey = p.y - (a.y + t * dy);
+    return std::sqrt(ex * ex + ey * ey);
+}
+
 
-    // 2. 楕円のパラメータを設定 (バウンディングボックスの中心と半径から概算)
-    float centerX = (minX + maxX) / 2.0f;
-    float centerY = (minY + maxY) / 2.0f;
-    float radiusX = (maxX - minX) / 2.0f;
-    float radiusY = (maxY - minY) / 2.0f;
+// --- CRenderContext 実装 ---
+
+bool CRenderContext::ColorLess::operator()(const D2D1_COLOR_F& a, const D2D1_COLOR_F& b) const {
+    if (a.r != b.r) return a.r < b.r;
+    if (a.g != b.g) return a.g < b.g;
+    if (a.b != b.b) return a.b < b.b;
+    return a.a < b.a;
+}
 
-    // 楕円が小さすぎる場合は無視
-    if (radiusX < 10.0f || radiusY < 10.0f) return false;
+ID2D1SolidColorBrush* CRenderContext::GetBrush(const D2D1_COLOR_F& color) {
+    // 不透明度を掛けた色ごとにキャッシュする
+    D2D1_COLOR_F key = color;
+    key.a *= m_opacity;
 
-    outEllipse.point = D2D1::Point2F(centerX, centerY);
-    outEllipse.radiusX = radiusX;
-    outEllipse.radiusY = radiusY;
+    auto it = m_brushes.find(key);
+    if (it != m_brushes.end()) return it->second;
+    if (!m_pRT) return nullptr;
+
+    ID2D1SolidColorBrush* pBrush = nullptr;
+    if (FAILED(m_pRT->CreateSolidColorBrush(key, &pBrush))) return nullptr;
+
+    m_brushes[key] = pBrush;
+    return pBrush;
+}
 
-    // 3. 適合度の判定
-    float maxDeviationSq = 0.0f;
+ID2D1StrokeStyle* CRenderContext::GetRoundStrokeStyle() {
+    if (m_pRoundStrokeStyle || !m_pRT) return m_pRoundStrokeStyle;
 
-    for (const auto& p : points) {
-        // 正規化された座標
-        float nx = (p.x - centerX) / radiusX;
-        float ny = (p.y - centerY) / radiusY;
+    ID2D1Factory* pFactory = nullptr;
+    m_pRT->GetFactory(&pFactory);
+    if (pFactory) {
+        pFactory->CreateStrokeStyle(
+            D2D1::StrokeStyleProperties(
+                D2D1_CAP_STYLE_ROUND,
+                D2D1_CAP_STYLE_ROUND,
+                D2D1_CAP_STYLE_ROUND,
+                D2D1_LINE_JOIN_ROUND
+            ),
+            nullptr, 0,
+            &m_pRoundStrokeStyle
+        );
+        pFactory->Release();
+    }
+    return m_pRoundStrokeStyle;
+}
 
-        // 楕円の式: (x/a)^2 + (y/b)^2 = 1。偏差が0に近いほど適合
-        float deviation = std::abs(nx * nx + ny * ny - 1.0f);
-        maxDeviationSq = max(maxDeviationSq, deviation);
+void CRenderContext::DiscardResources() {
+    for (auto& entry : m_brushes) {
+        if (entry.second) entry.second->Release();
     }
+    m_brushes.clear();
 
-    // 閾値 0.2 は調整可能。ストロークが閉じていなくても判定が通る可能性あり。
-    return maxDeviationSq < 0.2f;
+    if (m_pRoundStrokeStyle) {
+        m_pRoundStrokeStyle->Release();
+        m_pRoundStrokeStyle = nullptr;
+    }
 }
-// ===================================
 
 
 // --- CFreehandStroke 実装 ---
 
+// 線幅の半分未満の移動は間引き、確定時は線幅の 1/4 までのずれを許容する
+CFreehandStroke::SimplifyOptions CFreehandStroke::s_simplifyOptions = { 0.5f, 0.25f };
+const IShapeRecognizer* CFreehandStroke::s_pRecognizer = nullptr;
+
+const IShapeRecognizer& CFreehandStroke::GetRecognizer() {
+    static const CDefaultShapeRecognizer s_defaultRecognizer;
+    return s_pRecognizer ? *s_pRecognizer : s_defaultRecognizer;
+}
+
 CFreehandStroke::CFreehandStroke(D2D1_COLOR_F color, float width)
-    : m_color(color), m_strokeWidth(width), m_isComplemented(false) {
+    : IDrawableObject(Type), m_color(color), m_strokeWidth(width), m_isComplemented(false),
+      m_isFinalized(false), m_simplify(s_simplifyOptions),
+      m_pendingPoint(D2D1::Point2F()), m_hasPendingPoint(false), m_pGeometry(nullptr),
+      m_pLodGeometry(), m_lodUsesFullGeometry(0) {
 }
 
-void CFreehandStroke::AddPoint(D2D1_POINT_2F p) {
-    m_points.push_back(p);
+CFreehandStroke::~CFreehandStroke() {
+    InvalidateGeometry();
 }
 
-void CFreehandStroke::Draw(ID2D1RenderTarget* pRT) const {
-    if (m_points.size() < 2) return;
+bool CFreehandStroke::AddPoint(D2D1_POINT_2F p) {
+    // 直前に採用した点に近すぎる入力は保留する (高レートの入力で点が増えすぎないように)
+    float minDistance = m_strokeWidth * m_simplify.inputDistance;
+    if (!m_points.Empty() && minDistance > 0.0f) {
+        D2D1_POINT_2F last = m_points.Back();
+        float dx = p.x - last.x;
+        float dy = p.y - last.y;
+        if (dx * dx + dy * dy < minDistance * minDistance) {
+            m_pendingPoint = p;
+            m_hasPendingPoint = true;
+            return false;
+        }
+    }
 
-    ID2D1SolidColorBrush* pBrush = nullptr;
-    pRT->CreateSolidColorBrush(m_color, &pBrush);
+    m_points.Add(p);
+    m_moments.Add(p);
+    m_hasPendingPoint = false;
+    InvalidateGeometry();
+    return true;
+}
 
-    for (size_t i = 0; i < m_points.size() - 1; ++i) {
-        pRT->DrawLine(m_points[i], m_points[i + 1], pBrush, m_strokeWidth);
+D2D1_RECT_F CFreehandStroke::GetBounds() const {
+    return InflateBounds(m_moments.GetBounds(), m_strokeWidth * 0.5f);
+}
+
+bool CFreehandStroke::HitTest(D2D1_POINT_2F pt, float tolerance) const {
+    size_t count = GetPointCount();
+    if (count == 0) return false;
+
+    float reach = tolerance + m_strokeWidth * 0.5f;
+    D2D1_RECT_F probe = D2D1::RectF(pt.x, pt.y, pt.x, pt.y);
+    if (!BoundsIntersect(InflateBounds(m_moments.GetBounds(), reach), InflateBounds(probe, 0.5f))) return false;
+
+    if (count == 1) {
+        D2D1_POINT_2F p = GetFirstPoint();
+        return DistanceToSegment(pt, p, p) <= reach;
     }
 
-    if (pBrush) pBrush->Release();
+    // 該当する線分が見つかった時点で走査を打ち切る
+    bool hasPrev = false;
+    D2D1_POINT_2F prev = D2D1::Point2F();
+    return !VisitPoints([&](D2D1_POINT_2F p) {
+        if (hasPrev && DistanceToSegment(pt, prev, p) <= reach) return false;
+        prev = p;
+        hasPrev = true;
+        return true;
+    });
 }
 
-std::shared_ptr<IDrawableObject> CFreehandStroke::Clone() const {
-    auto clone = std::make_shared<CFreehandStroke>(m_color, m_strokeWidth);
-    clone->m_points = m_points;
-    clone->m_isComplemented = m_isComplemented;
-    clone->m_detectedShape = m_detectedShape;
-    clone->m_complementEllipse = m_complementEllipse;
-    return clone;
+D2D1_RECT_F CFreehandStroke::GetLastSegmentBounds() const {
+    if (m_points.Empty()) return D2D1::RectF();
+    if (m_points.Size() == 1) return SegmentBounds(m_points.Back(), m_points.Back(), m_strokeWidth);
+    return SegmentBounds(m_points[m_points.Size() - 2], m_points.Back(), m_strokeWidth);
 }
 
-void CFreehandStroke::Complement() {
-    if (m_points.size() < 2) return;
+void CFreehandStroke::Finalize(ID2D1Factory* pFactory) {
+    m_isFinalized = true;
 
-    m_isComplemented = false;
-    m_detectedShape = ShapeType::None;
+    // 間引かれていた最後の入力点を終点として残す
+    if (m_hasPendingPoint) {
+        m_points.Add(m_pendingPoint);
+        m_moments.Add(m_pendingPoint);
+        m_hasPendingPoint = false;
+    }
+
+    // 描画用の点列を単純化する
+    // (形状判定は間引き後の入力点から累積したモーメントで行うため、ここでは更新しない)
+    float tolerance = m_strokeWidth * m_simplify.finalTolerance;
+    if (tolerance > 0.0f && m_points.Simplify(max(tolerance, 0.5f)) > 0) {
+        InvalidateGeometry();
+    }
 
-    // --- 1. 直線判定 ---
-    D2D1_POINT_2F start = m_points.front();
-    D2D1_POINT_2F end = m_points.back();
-    float dx = end.x - start.x;
-    float dy = end.y - start.y;
-    float L_sq = dx * dx + dy * dy;
-    float L = std::sqrt(L_sq);
-    const float LINE_TOLERANCE = m_strokeWidth * 2.0f;
-    float maxLineDeviation = 0.0f;
+    // 確定後の点列は差分符号化して保持する (描画はジオメトリのキャッシュ、それ以外は順次復号で行う)
+    m_encodedPoints.Encode(m_points);
+    m_points.Clear();
 
-    for (const auto& p : m_points) {
-        float A = end.y - start.y;
-        float B = start.x - end.x;
-        float C = end.x * start.y - end.y * start.x;
-        float distance = std::abs(A * p.x + B * p.y + C) / (L > 0.0f ? L : 1.0f);
-        maxLineDeviation = max(maxLineDeviation, distance);
+    // 未集計の点を集計しておく (ワーカースレッドからは読み取りのみになるように)
+    m_moments.ReleaseBuffer();
+    if (!m_pGeometry && pFactory) {
+        BuildGeometry(pFactory);
     }
+}
 
-    // --- 2. 円/楕円判定 ---
-    D2D1_ELLIPSE potentialEllipse = { 0 };
-    const float ELLIPSE_FIT_TOLERANCE = 10.0f;
-    bool isEllipse = FitEllipse(m_points, ELLIPSE_FIT_TOLERANCE, potentialEllipse);
+void CFreehandStroke::Restore(CStrokePoints&& points, const CStrokeMoments::State& moments) {
+    InvalidateGeometry();
+    m_points = std::move(points);
+    m_encodedPoints.Clear();
+    m_moments.SetState(moments);
+    m_hasPendingPoint = false;
+    m_isFinalized = true;
+}
 
-    // --- 3. 判定結果の適用 ---
+void CFreehandStroke::Restore(CEncodedPoints&& points, const CStrokeMoments::State& moments) {
+    InvalidateGeometry();
+    m_points.Clear();
+    m_encodedPoints = std::move(points);
+    m_moments.SetState(moments);
+    m_hasPendingPoint = false;
+    m_isFinalized = true;
+}
 
-    if (isEllipse && maxLineDeviation > 5.0f * LINE_TOLERANCE) {
-        // 楕円として適合し、直線として適合しない場合
-        m_isComplemented = true;
-        m_detectedShape = ShapeType::Ellipse;
-        m_complementEllipse = potentialEllipse;
+void CFreehandStroke::DetachExternalPoints() {
+    // 点の値は変わらないため、ジオメトリのキャッシュはそのまま使える
+    m_points.DetachExternal();
+    m_encodedPoints.DetachExternal();
+}
 
+void CFreehandStroke::InvalidateGeometry() {
+    if (m_pGeometry) {
+        m_pGeometry->Release();
+        m_pGeometry = nullptr;
+    }
+    for (ID2D1PathGeometry*& pLod : m_pLodGeometry) {
+        if (pLod) {
+            pLod->Release();
+            pLod = nullptr;
+        }
     }
-    else if (maxLineDeviation < LINE_TOLERANCE) {
-        // 直線として適合する場合 (最も単純なので優先)
-        m_isComplemented = true;
-        m_detectedShape = ShapeType::Line;
+    m_lodUsesFullGeometry = 0;
+}
+
+bool CFreehandStroke::BuildGeometry(ID2D1Factory* pFactory) const {
+    if (GetPointCount() < 2) return false;
 
+    ID2D1PathGeometry* pGeometry = nullptr;
+    if (FAILED(pFactory->CreatePathGeometry(&pGeometry))) return false;
+
+    ID2D1GeometrySink* pSink = nullptr;
+    HRESULT hr = pGeometry->Open(&pSink);
+    if (SUCCEEDED(hr)) {
+        // 点列を一定数ずつ AoS のバッファに並べて追加 (符号化済みの点列はここで復号する)
+        D2D1_POINT_2F buffer[CPointChunk::Capacity];
+        size_t count = 0;
+        bool isFirst = true;
+        VisitPoints([&](D2D1_POINT_2F p) {
+            if (isFirst) {
+                pSink->BeginFigure(p, D2D1_FIGURE_BEGIN_HOLLOW);
+                isFirst = false;
+                return true;
+            }
+            buffer[count++] = p;
+            if (count == CPointChunk::Capacity) {
+                pSink->AddLines(buffer, static_cast<UINT32>(count));
+                count = 0;
+            }
+            return true;
+        });
+        if (count > 0) {
+            pSink->AddLines(buffer, static_cast<UINT32>(count));
+        }
+        pSink->EndFigure(D2D1_FIGURE_END_OPEN);
+        hr = pSink->Close();
+        pSink->Release();
     }
-    else if (m_points.size() > 10) {
-        // その他、複雑な曲線として認識 (ここではCubic Bézierに補完可能と見なす)
-        m_isComplemented = true;
-        m_detectedShape = ShapeType::Curve;
+
+    if (FAILED(hr)) {
+        pGeometry->Release();
+        return false;
     }
+
+    m_pGeometry = pGeometry;
+    return true;
+}
+
+ID2D1PathGeometry* CFreehandStroke::GetLodGeometry(ID2D1Factory* pFactory, int level) const {
+    if (m_pLodGeometry[level] || (m_lodUsesFullGeometry & (1 << level))) return m_pLodGeometry[level];
+
+    CStrokePoints simplified;
+    VisitPoints([&](D2D1_POINT_2F p) {
+        simplified.Add(p);
+        return true;
+    });
+    if (simplified.Simplify((float)(1 << level)) == 0 || simplified.Size() < 2) {
+        m_lodUsesFullGeometry |= (uint8_t)(1 << level);
+        return nullptr;
+    }
+
+    std::vector<D2D1_POINT_2F> points(simplified.Size());
+    simplified.CopyTo(0, points.size(), points.data());
+
+    ID2D1PathGeometry* pGeometry = nullptr;
+    if (FAILED(pFactory->CreatePathGeometry(&pGeometry))) return nullptr;
+
+    ID2D1GeometrySink* pSink = nullptr;
+    HRESULT hr = pGeometry->Open(&pSink);
+    if (SUCCEEDED(hr)) {
+        pSink->BeginFigure(points[0], D2D1_FIGURE_BEGIN_HOLLOW);
+        pSink->AddLines(points.data() + 1, static_cast<UINT32>(points.size() - 1));
+        pSink->EndFigure(D2D1_FIGURE_END_OPEN);
+        hr = pSink->Close();
+        pSink->Release();
+    }
+
+    if (FAILED(hr)) {
+        pGeometry->Release();
+        return nullptr;
+    }
+
+    m_pLodGeometry[level] = pGeometry;
+    return pGeometry;
+}
+
+int CFreehandStroke::SelectLodLevel(float scale) const {
+    // 縮小表示では点の間隔が画素より細かくなるため、単純化したジオメトリで描画する
+    if (!m_isFinalized || scale >= 0.5f) return -1;
+
+    // 1 画素に満たないストロークは始点と終点を結ぶ線で代用する
+    D2D1_RECT_F bounds = m_moments.GetBounds();
+    if (max(bounds.right - bounds.left, bounds.bottom - bounds.top) * scale < 1.0f) return LodSubPixel;
+
+    // 許容誤差が半画素 (0.5 / scale) を超えない最も粗い段階を使う
+    return min(LodLevelCount - 1, (int)std::floor(std::log2(0.5f / scale)));
+}
+
+void CFreehandStroke::PrepareGeometry(ID2D1Factory* pFactory, float scale) const {
+    if (GetPointCount() < 2 || !m_isFinalized) return;
+
+    int level = SelectLodLevel(scale);
+    if (level == LodSubPixel) return;
+    if (level >= 0 && GetLodGeometry(pFactory, level)) return;
+    if (!m_pGeometry) BuildGeometry(pFactory);
+}
+
+void CFreehandStroke::Draw(CRenderContext& ctx) const {
+    if (GetPointCount() < 2) return;
+
+    ID2D1SolidColorBrush* pBrush = ctx.GetBrush(m_color);
+    if (!pBrush) return;
+
+    ID2D1RenderTarget* pRT = ctx.GetTarget();
+    ID2D1StrokeStyle* pStyle = ctx.GetRoundStrokeStyle();
+
+    int level = SelectLodLevel(ctx.GetScale());
+    if (level == LodSubPixel) {
+        pRT->DrawLine(GetFirstPoint(), GetLastPoint(), pBrush, m_strokeWidth, pStyle);
+        return;
+    }
+    if (level >= 0) {
+        ID2D1Factory* pFactory = nullptr;
+        pRT->GetFactory(&pFactory);
+        if (pFactory) {
+            ID2D1PathGeometry* pLod = GetLodGeometry(pFactory, level);
+            pFactory->Release();
+            if (pLod) {
+                pRT->DrawGeometry(pLod, pBrush, m_strokeWidth, pStyle);
+                return;
+            }
+        }
+    }
+
+    // 確定済みのストロークはキャッシュしたジオメトリを1回の呼び出しで描画
+    if (m_isFinalized && !m_pGeometry) {
+        ID2D1Factory* pFactory = nullptr;
+        pRT->GetFactory(&pFactory);
+        if (pFactory) {
+            BuildGeometry(pFactory);
+            pFactory->Release();
+        }
+    }
+    if (m_pGeometry) {
+        pRT->DrawGeometry(m_pGeometry, pBrush, m_strokeWidth, pStyle);
+        return;
+    }
+
+    // 入力中のストローク (およびジオメトリを作成できなかった場合) は線分ごとに描画
+    bool hasPrev = false;
+    D2D1_POINT_2F prev = D2D1::Point2F();
+    VisitPoints([&](D2D1_POINT_2F p) {
+        if (hasPrev) pRT->DrawLine(prev, p, pBrush, m_strokeWidth, pStyle);
+        prev = p;
+        hasPrev = true;
+        return true;
+    });
+}
+
+size_t CFreehandStroke::GetMemoryUsage() const {
+    return sizeof(*this) + m_points.GetMemoryUsage() + m_encodedPoints.GetMemoryUsage();
+}
+
+CFreehandStroke::ComplementResult CFreehandStroke::Recognize() const {
+    std::vector<ShapeCandidate> candidates;
+    GetRecognizer().Recognize(*this, candidates);
+    return IShapeRecognizer::SelectBest(candidates);
+}
+
+void CFreehandStroke::Complement() {
+    if (GetPointCount() < 2) return;
+
+    // 楕円は AddPoint で累積済みの統計量だけで O(1) で判定できる
+    // 直線は統計量で候補を絞ってから点列で確かめ、それ以外は点列を復号して矩形・折れ線・曲線を判定するため、点の数に比例する
+    ComplementResult result = Recognize();
+    m_isComplemented = (result.shape != ShapeType::None);
+    m_detectedShape = result.shape;
+    m_complementEllipse = result.ellipse;
+    m_complementRotation = result.rotation;
 }
 
 bool CFreehandStroke::IsComplementable() const {
@@ -137,126 +405,825 @@ bool CFreehandStroke::IsComplementable() const {
 // --- CLineSegment 実装 ---
 
 CLineSegment::CLineSegment(D2D1_POINT_2F start, D2D1_POINT_2F end, D2D1_COLOR_F color, float width)
-    : m_start(start), m_end(end), m_color(color), m_strokeWidth(width) {
+    : IDrawableObject(Type), m_start(start), m_end(end), m_color(color), m_strokeWidth(width) {
 }
 
-void CLineSegment::Draw(ID2D1RenderTarget* pRT) const {
-    ID2D1SolidColorBrush* pBrush = nullptr;
-    pRT->CreateSolidColorBrush(m_color, &pBrush);
+void CLineSegment::Draw(CRenderContext& ctx) const {
+    ID2D1SolidColorBrush* pBrush = ctx.GetBrush(m_color);
+    if (!pBrush) return;
 
-    pRT->DrawLine(m_start, m_end, pBrush, m_strokeWidth);
+    ctx.GetTarget()->DrawLine(m_start, m_end, pBrush, m_strokeWidth);
+}
 
-    if (pBrush) pBrush->Release();
+D2D1_RECT_F CLineSegment::GetBounds() const {
+    return SegmentBounds(m_start, m_end, m_strokeWidth);
 }
 
-std::shared_ptr<IDrawableObject> CLineSegment::Clone() const {
-    return std::make_shared<CLineSegment>(m_start, m_end, m_color, m_strokeWidth);
+bool CLineSegment::HitTest(D2D1_POINT_2F pt, float tolerance) const {
+    return DistanceToSegment(pt, m_start, m_end) <= tolerance + m_strokeWidth * 0.5f;
 }
 
 // --- CEllipseSegment 実装 ---
 
-CEllipseSegment::CEllipseSegment(D2D1_ELLIPSE ellipse, D2D1_COLOR_F color, float width)
-    : m_ellipse(ellipse), m_color(color), m_strokeWidth(width) {
+CEllipseSegment::CEllipseSegment(D2D1_ELLIPSE ellipse, D2D1_COLOR_F color, float width, float rotation)
+    : IDrawableObject(Type), m_ellipse(ellipse), m_color(color), m_strokeWidth(width), m_rotation(rotation) {
 }
 
-void CEllipseSegment::Draw(ID2D1RenderTarget* pRT) const {
-    ID2D1SolidColorBrush* pBrush = nullptr;
-    pRT->CreateSolidColorBrush(m_color, &pBrush);
+// 中心まわりに回転させて描画し、変換を baseTransform (描画前の変換) に戻す
+static void DrawRotatedEllipse(ID2D1RenderTarget* pRT, const D2D1_ELLIPSE& ellipse, float rotation,
+    ID2D1SolidColorBrush* pBrush, float strokeWidth, const D2D1_MATRIX_3X2_F& baseTransform) {
+    pRT->SetTransform(D2D1::Matrix3x2F::Rotation(rotation, ellipse.point) * *D2D1::Matrix3x2F::ReinterpretBaseType(&baseTransform));
+    pRT->DrawEllipse(ellipse, pBrush, strokeWidth);
+    pRT->SetTransform(baseTransform);
+}
+
+void CEllipseSegment::Draw(CRenderContext& ctx) const {
+    ID2D1SolidColorBrush* pBrush = ctx.GetBrush(m_color);
+    if (!pBrush) return;
+
+    ID2D1RenderTarget* pRT = ctx.GetTarget();
+    if (m_rotation == 0.0f) {
+        pRT->DrawEllipse(m_ellipse, pBrush, m_strokeWidth);
+        return;
+    }
+
+    D2D1_MATRIX_3X2_F oldTransform;
+    pRT->GetTransform(&oldTransform);
+    DrawRotatedEllipse(pRT, m_ellipse, m_rotation, pBrush, m_strokeWidth, oldTransform);
+}
+
+D2D1_RECT_F CEllipseSegment::GetBounds() const {
+    // 回転した楕円の外接矩形の半幅: sqrt((a cosθ)^2 + (b sinθ)^2)
+    const float PI = 3.14159265f;
+    float c = std::cos(m_rotation * PI / 180.0f);
+    float s = std::sin(m_rotation * PI / 180.0f);
+    float a = m_ellipse.radiusX, b = m_ellipse.radiusY;
+    float halfWidth = std::sqrt(a * a * c * c + b * b * s * s);
+    float halfHeight = std::sqrt(a * a * s * s + b * b * c * c);
+
+    D2D1_RECT_F r = D2D1::RectF(
+        m_ellipse.point.x - halfWidth, m_ellipse.point.y - halfHeight,
+        m_ellipse.point.x + halfWidth, m_ellipse.point.y + halfHeight
+    );
+    return InflateBounds(r, m_strokeWidth * 0.5f);
+}
+
+bool CEllipseSegment::HitTest(D2D1_POINT_2F pt, float tolerance) const {
+    if (m_ellipse.radiusX <= 0.0f || m_ellipse.radiusY <= 0.0f) return false;
+
+    // 楕円の座標系へ逆回転
+    const float PI = 3.14159265f;
+    float c = std::cos(-m_rotation * PI / 180.0f);
+    float s = std::sin(-m_rotation * PI / 180.0f);
+    float px = pt.x - m_ellipse.point.x;
+    float py = pt.y - m_ellipse.point.y;
+    float lx = px * c - py * s;
+    float ly = px * s + py * c;
+
+    // 正規化した半径のずれを短軸の長さで近似的に距離へ換算
+    float nx = lx / m_ellipse.radiusX;
+    float ny = ly / m_ellipse.radiusY;
+    float deviation = std::abs(std::sqrt(nx * nx + ny * ny) - 1.0f);
+    return deviation * min(m_ellipse.radiusX, m_ellipse.radiusY) <= tolerance + m_strokeWidth * 0.5f;
+}
+
+// --- CPolylineSegment 実装 ---
+
+CPolylineSegment::CPolylineSegment(std::vector<D2D1_POINT_2F> vertices, bool isClosed, D2D1_COLOR_F color, float width)
+    : IDrawableObject(Type), m_vertices(std::move(vertices)), m_isClosed(isClosed), m_color(color), m_strokeWidth(width), m_pGeometry(nullptr) {
+}
+
+CPolylineSegment::~CPolylineSegment() {
+    if (m_pGeometry) m_pGeometry->Release();
+}
+
+bool CPolylineSegment::BuildGeometry(ID2D1Factory* pFactory) const {
+    if (m_vertices.size() < 2) return false;
+
+    ID2D1PathGeometry* pGeometry = nullptr;
+    if (FAILED(pFactory->CreatePathGeometry(&pGeometry))) return false;
+
+    ID2D1GeometrySink* pSink = nullptr;
+    HRESULT hr = pGeometry->Open(&pSink);
+    if (SUCCEEDED(hr)) {
+        pSink->BeginFigure(m_vertices[0], D2D1_FIGURE_BEGIN_HOLLOW);
+        pSink->AddLines(m_vertices.data() + 1, static_cast<UINT32>(m_vertices.size() - 1));
+        pSink->EndFigure(m_isClosed ? D2D1_FIGURE_END_CLOSED : D2D1_FIGURE_END_OPEN);
+        hr = pSink->Close();
+        pSink->Release();
+    }
+
+    if (FAILED(hr)) {
+        pGeometry->Release();
+        return false;
+    }
+
+    m_pGeometry = pGeometry;
+    return true;
+}
+
+void CPolylineSegment::PrepareGeometry(ID2D1Factory* pFactory, float scale) const {
+    if (!m_pGeometry) BuildGeometry(pFactory);
+}
+
+void CPolylineSegment::Draw(CRenderContext& ctx) const {
+    ID2D1SolidColorBrush* pBrush = ctx.GetBrush(m_color);
+    if (!pBrush) return;
+
+    ID2D1RenderTarget* pRT = ctx.GetTarget();
+    if (!m_pGeometry) {
+        ID2D1Factory* pFactory = nullptr;
+        pRT->GetFactory(&pFactory);
+        if (pFactory) {
+            BuildGeometry(pFactory);
+            pFactory->Release();
+        }
+    }
+    if (m_pGeometry) {
+        // 他の補完結果や手書きのストロークと同じく、角と端点は丸める
+        pRT->DrawGeometry(m_pGeometry, pBrush, m_strokeWidth, ctx.GetRoundStrokeStyle());
+    }
+}
+
+D2D1_RECT_F CPolylineSegment::GetBounds() const {
+    if (m_vertices.empty()) return D2D1::RectF();
+
+    D2D1_RECT_F r = D2D1::RectF(m_vertices[0].x, m_vertices[0].y, m_vertices[0].x, m_vertices[0].y);
+    for (const D2D1_POINT_2F& p : m_vertices) {
+        r = UnionBounds(r, D2D1::RectF(p.x, p.y, p.x, p.y));
+    }
+    // 丸い結合で描くため、角でも線幅の半分より外へは出ない
+    return InflateBounds(r, m_strokeWidth * 0.5f);
+}
+
+bool CPolylineSegment::HitTest(D2D1_POINT_2F pt, float tolerance) const {
+    float reach = tolerance + m_strokeWidth * 0.5f;
+    size_t count = m_vertices.size();
+    if (count == 1) return DistanceToSegment(pt, m_vertices[0], m_vertices[0]) <= reach;
+
+    size_t segmentCount = m_isClosed ? count : count - 1;
+    for (size_t i = 0; i < segmentCount && count > 1; ++i) {
+        if (DistanceToSegment(pt, m_vertices[i], m_vertices[(i + 1) % count]) <= reach) return true;
+    }
+    return false;
+}
+
+// --- CBezierSegment 実装 ---
+
+CBezierSegment::CBezierSegment(std::vector<D2D1_POINT_2F> controlPoints, D2D1_COLOR_F color, float width)
+    : IDrawableObject(Type), m_controlPoints(std::move(controlPoints)), m_color(color), m_strokeWidth(width), m_pGeometry(nullptr) {
+}
+
+CBezierSegment::~CBezierSegment() {
+    if (m_pGeometry) m_pGeometry->Release();
+}
+
+bool CBezierSegment::BuildGeometry(ID2D1Factory* pFactory) const {
+    size_t segmentCount = GetSegmentCount();
+    if (segmentCount == 0) return false;
+
+    ID2D1PathGeometry* pGeometry = nullptr;
+    if (FAILED(pFactory->CreatePathGeometry(&pGeometry))) return false;
+
+    ID2D1GeometrySink* pSink = nullptr;
+    HRESULT hr = pGeometry->Open(&pSink);
+    if (SUCCEEDED(hr)) {
+        std::vector<D2D1_BEZIER_SEGMENT> segments(segmentCount);
+        for (size_t k = 0; k < segmentCount; ++k) {
+            segments[k] = D2D1::BezierSegment(m_controlPoints[k * 3 + 1], m_controlPoints[k * 3 + 2], m_controlPoints[k * 3 + 3]);
+        }
+        pSink->BeginFigure(m_controlPoints[0], D2D1_FIGURE_BEGIN_HOLLOW);
+        pSink->AddBeziers(segments.data(), static_cast<UINT32>(segmentCount));
+        pSink->EndFigure(D2D1_FIGURE_END_OPEN);
+        hr = pSink->Close();
+        pSink->Release();
+    }
+
+    if (FAILED(hr)) {
+        pGeometry->Release();
+        return false;
+    }
+
+    m_pGeometry = pGeometry;
+    return true;
+}
+
+void CBezierSegment::PrepareGeometry(ID2D1Factory* pFactory, float scale) const {
+    if (!m_pGeometry) BuildGeometry(pFactory);
+}
+
+void CBezierSegment::Draw(CRenderContext& ctx) const {
+    ID2D1SolidColorBrush* pBrush = ctx.GetBrush(m_color);
+    if (!pBrush) return;
+
+    ID2D1RenderTarget* pRT = ctx.GetTarget();
+    if (!m_pGeometry) {
+        ID2D1Factory* pFactory = nullptr;
+        pRT->GetFactory(&pFactory);
+        if (pFactory) {
+            BuildGeometry(pFactory);
+            pFactory->Release();
+        }
+    }
+    if (m_pGeometry) {
+        pRT->DrawGeometry(m_pGeometry, pBrush, m_strokeWidth, ctx.GetRoundStrokeStyle());
+    }
+}
 
-    pRT->DrawEllipse(m_ellipse, pBrush, m_strokeWidth);
+D2D1_RECT_F CBezierSegment::GetBounds() const {
+    if (m_controlPoints.empty()) return D2D1::RectF();
 
-    if (pBrush) pBrush->Release();
+    // 曲線は制御点の凸包に含まれる
+    D2D1_RECT_F r = D2D1::RectF(m_controlPoints[0].x, m_controlPoints[0].y, m_controlPoints[0].x, m_controlPoints[0].y);
+    for (const D2D1_POINT_2F& p : m_controlPoints) {
+        r = UnionBounds(r, D2D1::RectF(p.x, p.y, p.x, p.y));
+    }
+    return InflateBounds(r, m_strokeWidth * 0.5f);
 }
 
-std::shared_ptr<IDrawableObject> CEllipseSegment::Clone() const {
-    return std::make_shared<CEllipseSegment>(m_ellipse, m_color, m_strokeWidth);
+bool CBezierSegment::HitTest(D2D1_POINT_2F pt, float tolerance) const {
+    float reach = tolerance + m_strokeWidth * 0.5f;
+    D2D1_RECT_F probe = D2D1::RectF(pt.x, pt.y, pt.x, pt.y);
+    if (!BoundsIntersect(InflateBounds(GetBounds(), tolerance), InflateBounds(probe, 0.5f))) return false;
+
+    // 区間ごとに折れ線へ分割して判定する
+    const int Subdivisions = 16;
+    for (size_t k = 0; k < GetSegmentCount(); ++k) {
+        const D2D1_POINT_2F* controls = &m_controlPoints[k * 3];
+        D2D1_POINT_2F prev = controls[0];
+        for (int i = 1; i <= Subdivisions; ++i) {
+            D2D1_POINT_2F p = EvaluateBezier(controls, (float)i / Subdivisions);
+            if (DistanceToSegment(pt, prev, p) <= reach) return true;
+            prev = p;
+        }
+    }
+    return false;
 }
 
 
 // --- CAddObjectCommand 実装 ---
 
-CAddObjectCommand::CAddObjectCommand(CDocument* pDoc, std::shared_ptr<IDrawableObject> object)
-    : m_pDoc(pDoc), m_object(object), m_index(0) {
+CAddObjectCommand::CAddObjectCommand(CDocument* pDoc, ObjectId id, std::shared_ptr<IDrawableObject> object)
+    : m_pDoc(pDoc), m_ids(1, id), m_objects(1, object), m_isUndone(false) {
+}
+
+CAddObjectCommand::~CAddObjectCommand() {
+    if (m_isUndone) {
+        for (ObjectId id : m_ids) {
+            m_pDoc->ReleaseObjectId(id);
+        }
+    }
 }
 
 void CAddObjectCommand::Execute() {
-    m_index = m_pDoc->GetLastObjectIndex();
+    for (size_t i = 0; i < m_ids.size(); ++i) {
+        m_pDoc->AttachObject(m_ids[i], m_objects[i]);
+    }
+    m_isUndone = false;
 }
 
 void CAddObjectCommand::Undo() {
-    m_pDoc->RemoveObjectAt(m_index);
+    for (auto it = m_ids.rbegin(); it != m_ids.rend(); ++it) {
+        m_pDoc->DetachObject(*it);
+    }
+    m_isUndone = true;
+}
+
+size_t CAddObjectCommand::GetMemoryUsage() const {
+    size_t bytes = sizeof(*this) + m_objects.capacity() * sizeof(m_objects[0]) + m_ids.capacity() * sizeof(m_ids[0]);
+    // 取り消されている間はオブジェクトを履歴だけが保持している
+    if (m_isUndone) {
+        for (const auto& object : m_objects) {
+            bytes += object->GetMemoryUsage();
+        }
+    }
+    return bytes;
+}
+
+bool CAddObjectCommand::TryMerge(CAddObjectCommand& other) {
+    if (m_isUndone || other.m_isUndone || other.m_pDoc != m_pDoc) return false;
+
+    m_ids.insert(m_ids.end(), other.m_ids.begin(), other.m_ids.end());
+    m_objects.insert(m_objects.end(), other.m_objects.begin(), other.m_objects.end());
+    other.m_ids.clear();
+    other.m_objects.clear();
+    return true;
 }
 
 // --- CComplementCommand 実装 ---
 
-CComplementCommand::CComplementCommand(CDocument* pDoc, size_t index, std::shared_ptr<IDrawableObject> original, std::shared_ptr<IDrawableObject> newItem)
-    : m_pDoc(pDoc), m_index(index), m_originalObject(original), m_newObject(newItem) {
+CComplementCommand::CComplementCommand(CDocument* pDoc, ObjectId id, std::shared_ptr<IDrawableObject> original, std::shared_ptr<IDrawableObject> newItem)
+    : m_pDoc(pDoc), m_originalObject(original), m_newObject(newItem), m_id(id), m_isUndone(false) {
 }
 
 void CComplementCommand::Execute() {
-    m_pDoc->ReplaceObject(m_index, m_newObject);
+    m_pDoc->ReplaceObject(m_id, m_newObject);
+    m_isUndone = false;
 }
 
 void CComplementCommand::Undo() {
-    m_pDoc->ReplaceObject(m_index, m_originalObject);
+    m_pDoc->ReplaceObject(m_id, m_originalObject);
+    m_isUndone = true;
+}
+
+size_t CComplementCommand::GetMemoryUsage() const {
+    // ドキュメントに無い側のオブジェクトのみを数える
+    const auto& retained = m_isUndone ? m_newObject : m_originalObject;
+    return sizeof(*this) + retained->GetMemoryUsage();
+}
+
+// --- CCompositeCommand 実装 ---
+
+void CCompositeCommand::Add(std::unique_ptr<ICommand> command) {
+    if (!m_commands.empty()) {
+        CAddObjectCommand* pLast = m_commands.back()->AsAddObjectCommand();
+        CAddObjectCommand* pNext = command->AsAddObjectCommand();
+        if (pLast && pNext && pLast->TryMerge(*pNext)) return;
+    }
+    m_commands.push_back(std::move(command));
+}
+
+void CCompositeCommand::Execute() {
+    for (auto& command : m_commands) {
+        command->Execute();
+    }
+}
+
+void CCompositeCommand::Undo() {
+    for (auto it = m_commands.rbegin(); it != m_commands.rend(); ++it) {
+        (*it)->Undo();
+    }
+}
+
+size_t CCompositeCommand::GetMemoryUsage() const {
+    size_t bytes = sizeof(*this);
+    for (const auto& command : m_commands) {
+        bytes += command->GetMemoryUsage();
+    }
+    return bytes;
 }
 
 // --- CDocument 実装 ---
 
-void CDocument::AddObject(std::shared_ptr<IDrawableObject> object, bool recordCommand) {
-    m_objects.push_back(object);
+CDocument::~CDocument() {
+    // コマンドの破棄時に予約中のIDが解放されるため、スロットより先に履歴を破棄する
+    m_pTransaction.reset();
+    m_redoStack.clear();
+    m_undoStack.clear();
+}
+
+CDocument::Slot* CDocument::Resolve(ObjectId id, SlotState state) {
+    if (!id.IsValid() || id.slot >= m_slots.size()) return nullptr;
+    Slot& slot = m_slots[id.slot];
+    return (slot.generation == id.generation && slot.state == state) ? &slot : nullptr;
+}
+
+const CDocument::Slot* CDocument::Resolve(ObjectId id, SlotState state) const {
+    return const_cast<CDocument*>(this)->Resolve(id, state);
+}
+
+void CDocument::LinkZOrder(uint32_t index) {
+    Slot& slot = m_slots[index];
+
+    // 取り外す前に背面にあったオブジェクトを手掛かりに挿入位置を探す
+    // (Undo/Redo は逆順に行われるため、通常は手掛かりの直後がそのまま正しい位置になる)
+    uint32_t after = NoSlot;
+    uint32_t hint = slot.prev;
+    if (hint != NoSlot && m_slots[hint].state == SlotState::Live && m_slots[hint].zKey < slot.zKey) {
+        after = hint;
+        while (m_slots[after].next != NoSlot && m_slots[m_slots[after].next].zKey < slot.zKey) {
+            after = m_slots[after].next;
+        }
+    }
+    else {
+        // 手掛かりが無い場合は前面側から探す (新しいオブジェクトは最前面に入る)
+        after = m_zTail;
+        while (after != NoSlot && m_slots[after].zKey > slot.zKey) {
+            after = m_slots[after].prev;
+        }
+    }
+
+    slot.prev = after;
+    slot.next = (after == NoSlot) ? m_zHead : m_slots[after].next;
+    if (slot.prev != NoSlot) m_slots[slot.prev].next = index; else m_zHead = index;
+    if (slot.next != NoSlot) m_slots[slot.next].prev = index; else m_zTail = index;
+}
+
+void CDocument::UnlinkZOrder(uint32_t index) {
+    Slot& slot = m_slots[index];
+    if (slot.prev != NoSlot) m_slots[slot.prev].next = slot.next; else m_zHead = slot.next;
+    if (slot.next != NoSlot) m_slots[slot.next].prev = slot.prev; else m_zTail = slot.prev;
+    // prev は戻すときの手掛かりとして残す
+    slot.next = NoSlot;
+}
+
+void CDocument::AddDrawRecord(uint32_t index) {
+    Slot& slot = m_slots[index];
+    const IDrawableObject* pObject = slot.object.get();
+    slot.type = pObject->GetType();
+    slot.record = NoSlot;
+
+    if (const CLineSegment* pLine = ObjectCast<CLineSegment>(pObject)) {
+        slot.record = (uint32_t)m_lineRecords.size();
+        m_lineRecords.push_back(LineRecord{ pLine->GetStart(), pLine->GetEnd(), pLine->GetColor(), pLine->GetStrokeWidth(), index });
+    }
+    else if (const CEllipseSegment* pEllipse = ObjectCast<CEllipseSegment>(pObject)) {
+        slot.record = (uint32_t)m_ellipseRecords.size();
+        m_ellipseRecords.push_back(EllipseRecord{ pEllipse->GetEllipse(), pEllipse->GetColor(), pEllipse->GetStrokeWidth(), pEllipse->GetRotation(), index });
+    }
+}
+
+void CDocument::RemoveDrawRecord(uint32_t index) {
+    Slot& slot = m_slots[index];
+    if (slot.record == NoSlot) return;
+
+    if (slot.type == ObjectType::Line) EraseDrawRecord(m_lineRecords, slot.record);
+    else if (slot.type == ObjectType::Ellipse) EraseDrawRecord(m_ellipseRecords, slot.record);
+    slot.record = NoSlot;
+}
+
+template <class Record>
+void CDocument::EraseDrawRecord(std::vector<Record>& records, uint32_t position) {
+    // 末尾のレコードで埋めて配列を詰めたまま保つ (描画順はスロットの z順で決まるため、配列の順序は問わない)
+    if (position + 1 != records.size()) {
+        records[position] = records.back();
+        m_slots[records[position].slot].record = position;
+    }
+    records.pop_back();
+}
+
+ObjectId CDocument::AddObject(std::shared_ptr<IDrawableObject> object, bool recordCommand) {
+    // 空きスロットを再利用し、無ければ末尾に作る
+    uint32_t index;
+    if (m_freeHead != NoSlot) {
+        index = m_freeHead;
+        m_freeHead = m_slots[index].next;
+    }
+    else {
+        index = (uint32_t)m_slots.size();
+        Slot empty = { nullptr, 1, SlotState::Free, 0, NoSlot, NoSlot, ObjectType::Line, NoSlot };
+        m_slots.push_back(empty);
+    }
+
+    Slot& slot = m_slots[index];
+    slot.object = object;
+    slot.state = SlotState::Live;
+    slot.zKey = m_nextZKey++;
+    slot.prev = NoSlot;
+    LinkZOrder(index);
+    AddDrawRecord(index);
+    m_spatialIndex.Insert(index, object->GetBounds());
+    ++m_liveCount;
+    ++m_version;
+    RecordChange(object->GetBounds());
+
+    ObjectId id = { index, slot.generation };
     if (recordCommand) {
-        m_redoStack = {};
-        RecordCommand(std::make_unique<CAddObjectCommand>(this, object));
+        RecordCommand(std::make_unique<CAddObjectCommand>(this, id, object));
     }
+    return id;
+}
+
+void CDocument::ReplaceObject(ObjectId id, std::shared_ptr<IDrawableObject> newObject) {
+    Slot* pSlot = Resolve(id, SlotState::Live);
+    if (!pSlot) return;
+
+    D2D1_RECT_F oldBounds = pSlot->object->GetBounds();
+    m_spatialIndex.Remove(id.slot, oldBounds);
+    RemoveDrawRecord(id.slot);
+    pSlot->object = newObject;
+    AddDrawRecord(id.slot);
+    m_spatialIndex.Insert(id.slot, newObject->GetBounds());
+    ++m_version;
+    RecordChange(oldBounds);
+    RecordChange(newObject->GetBounds());
 }
 
-void CDocument::ReplaceObject(size_t index, std::shared_ptr<IDrawableObject> newObject) {
-    if (index < m_objects.size()) {
-        m_objects[index] = newObject;
+void CDocument::RemoveObject(ObjectId id) {
+    DetachObject(id);
+    ReleaseObjectId(id);
+}
+
+void CDocument::Clear() {
+    // 予約中のIDを解放させるため、オブジェクトより先に履歴を破棄する
+    m_pTransaction.reset();
+    m_transactionDepth = 0;
+    m_redoStack.clear();
+    m_undoStack.clear();
+    m_historyBytes = 0;
+
+    // スロットは世代を進めて空きリストへ戻す (古いIDが新しいオブジェクトを指さないように)
+    std::vector<ObjectId> ids;
+    GetObjectIds(ids);
+    for (ObjectId id : ids) {
+        RemoveObject(id);
     }
+    m_spatialIndex.Clear();
+    ++m_version;
+
+    // 全体が変化したため、これまでの範囲の記録は不要
+    m_changeLog.clear();
+    m_changeLogStart = m_version;
 }
 
-void CDocument::RemoveObjectAt(size_t index) {
-    if (index < m_objects.size()) {
-        m_objects.erase(m_objects.begin() + index);
+void CDocument::DetachObject(ObjectId id) {
+    Slot* pSlot = Resolve(id, SlotState::Live);
+    if (!pSlot) return;
+
+    D2D1_RECT_F bounds = pSlot->object->GetBounds();
+    m_spatialIndex.Remove(id.slot, bounds);
+    UnlinkZOrder(id.slot);
+    RemoveDrawRecord(id.slot);
+    pSlot->object = nullptr;
+    pSlot->state = SlotState::Detached;
+    --m_liveCount;
+    ++m_version;
+    RecordChange(bounds);
+}
+
+void CDocument::AttachObject(ObjectId id, std::shared_ptr<IDrawableObject> object) {
+    Slot* pSlot = Resolve(id, SlotState::Detached);
+    if (!pSlot) return;
+
+    pSlot->object = object;
+    pSlot->state = SlotState::Live;
+    LinkZOrder(id.slot);
+    AddDrawRecord(id.slot);
+    m_spatialIndex.Insert(id.slot, object->GetBounds());
+    ++m_liveCount;
+    ++m_version;
+    RecordChange(object->GetBounds());
+}
+
+void CDocument::ReleaseObjectId(ObjectId id) {
+    Slot* pSlot = Resolve(id, SlotState::Detached);
+    if (!pSlot) return;
+
+    // 世代を進めて古いIDを無効にし、空きリストへ戻す
+    pSlot->state = SlotState::Free;
+    if (++pSlot->generation == 0) pSlot->generation = 1;
+    pSlot->prev = NoSlot;
+    pSlot->next = m_freeHead;
+    m_freeHead = id.slot;
+}
+
+std::shared_ptr<IDrawableObject> CDocument::FindObject(ObjectId id) const {
+    const Slot* pSlot = Resolve(id, SlotState::Live);
+    return pSlot ? pSlot->object : nullptr;
+}
+
+void CDocument::GetObjectIds(std::vector<ObjectId>& outIds) const {
+    outIds.clear();
+    outIds.reserve(m_liveCount);
+    for (uint32_t i = m_zHead; i != NoSlot; i = m_slots[i].next) {
+        ObjectId id = { i, m_slots[i].generation };
+        outIds.push_back(id);
+    }
+}
+
+CDocument::DrawBatch::DrawBatch(CRenderContext& context)
+    : ctx(context), pRT(context.GetTarget()), pBrush(nullptr), color(), hasBaseTransform(false), baseTransform() {
+}
+
+ID2D1SolidColorBrush* CDocument::DrawBatch::GetBrush(const D2D1_COLOR_F& c) {
+    // 描画中は不透明度が変わらないため、直前と同じ色ならコンテキストのキャッシュを引き直さない
+    if (pBrush && c.r == color.r && c.g == color.g && c.b == color.b && c.a == color.a) return pBrush;
+    pBrush = ctx.GetBrush(c);
+    color = c;
+    return pBrush;
+}
+
+void CDocument::DrawSlot(DrawBatch& batch, size_t index) const {
+    const Slot& slot = m_slots[index];
+    switch (slot.type) {
+    case ObjectType::Line: {
+        const LineRecord& line = m_lineRecords[slot.record];
+        ID2D1SolidColorBrush* pBrush = batch.GetBrush(line.color);
+        if (pBrush) batch.pRT->DrawLine(line.start, line.end, pBrush, line.strokeWidth);
+        break;
+    }
+    case ObjectType::Ellipse: {
+        const EllipseRecord& ellipse = m_ellipseRecords[slot.record];
+        ID2D1SolidColorBrush* pBrush = batch.GetBrush(ellipse.color);
+        if (!pBrush) break;
+        if (ellipse.rotation == 0.0f) {
+            batch.pRT->DrawEllipse(ellipse.ellipse, pBrush, ellipse.strokeWidth);
+            break;
+        }
+        // 描画前の変換は1回の描画につき一度だけ取得する
+        if (!batch.hasBaseTransform) {
+            batch.pRT->GetTransform(&batch.baseTransform);
+            batch.hasBaseTransform = true;
+        }
+        DrawRotatedEllipse(batch.pRT, ellipse.ellipse, ellipse.rotation, pBrush, ellipse.strokeWidth, batch.baseTransform);
+        break;
+    }
+    default:
+        slot.object->Draw(batch.ctx);
+        break;
+    }
+}
+
+void CDocument::DrawAll(CRenderContext& ctx, const D2D1_RECT_F* pClip) const {
+    DrawBatch batch(ctx);
+    if (!pClip) {
+        for (uint32_t i = m_zHead; i != NoSlot; i = m_slots[i].next) {
+            DrawSlot(batch, i);
+        }
+        return;
+    }
+
+    // 描画範囲と重なるオブジェクトのみを z 順に描画
+    QuerySlots(*pClip);
+    for (size_t index : m_queryBuffer) {
+        DrawSlot(batch, index);
+    }
+}
+
+void CDocument::PrepareGeometry(ID2D1Factory* pFactory, float scale, const D2D1_RECT_F& area) const {
+    // 描画レコードを持つもの (直線と楕円) はジオメトリを使わない
+    std::vector<size_t> slots;
+    QuerySlots(area, slots);
+    auto end = std::remove_if(slots.begin(), slots.end(), [&](size_t index) {
+        return m_slots[index].record != NoSlot;
+    });
+    slots.erase(end, slots.end());
+
+    // オブジェクトごとに独立しているため並列に作成する (ファクトリはマルチスレッド用であること)
+    std::for_each(std::execution::par, slots.begin(), slots.end(), [&](size_t index) {
+        m_slots[index].object->PrepareGeometry(pFactory, scale);
+    });
+}
+
+void CDocument::DrawAll(CRenderContext& ctx, const D2D1_RECT_F& clip, std::vector<size_t>& queryBuffer) const {
+    DrawBatch batch(ctx);
+    QuerySlots(clip, queryBuffer);
+    for (size_t index : queryBuffer) {
+        DrawSlot(batch, index);
+    }
+}
+
+void CDocument::RecordChange(const D2D1_RECT_F& bounds) {
+    if (m_changeLog.size() >= MaxChangeLogEntries) {
+        // 古い半分を捨て、捨てた中で最も新しいバージョンまでは記録が無いものとする
+        size_t dropCount = m_changeLog.size() / 2;
+        m_changeLogStart = m_changeLog[dropCount - 1].version;
+        m_changeLog.erase(m_changeLog.begin(), m_changeLog.begin() + dropCount);
+    }
+    m_changeLog.push_back(Change{ m_version, bounds });
+}
+
+bool CDocument::GetChangedBounds(unsigned int sinceVersion, std::vector<D2D1_RECT_F>& outBounds) const {
+    outBounds.clear();
+    if (sinceVersion < m_changeLogStart) return false;
+
+    // 記録はバージョン順のため、末尾から sinceVersion の位置まで遡る
+    auto first = m_changeLog.end();
+    while (first != m_changeLog.begin() && (first - 1)->version > sinceVersion) {
+        --first;
     }
+    for (auto it = first; it != m_changeLog.end(); ++it) {
+        outBounds.push_back(it->bounds);
+    }
+    return true;
 }
 
-void CDocument::DrawAll(ID2D1RenderTarget* pRT) const {
-    for (const auto& obj : m_objects) {
-        obj->Draw(pRT);
+void CDocument::QuerySlots(const D2D1_RECT_F& area, std::vector<size_t>& outSlots) const {
+    m_spatialIndex.Query(area, outSlots);
+
+    // セル単位の候補から実際に重なるものだけを残し、z順に並べる
+    auto end = std::remove_if(outSlots.begin(), outSlots.end(), [&](size_t index) {
+        return !BoundsIntersect(m_slots[index].object->GetBounds(), area);
+    });
+    outSlots.erase(end, outSlots.end());
+    std::sort(outSlots.begin(), outSlots.end(), [&](size_t a, size_t b) {
+        return m_slots[a].zKey < m_slots[b].zKey;
+    });
+}
+
+void CDocument::QueryObjects(const D2D1_RECT_F& area, std::vector<ObjectId>& outIds) const {
+    QuerySlots(area);
+    outIds.clear();
+    for (size_t index : m_queryBuffer) {
+        ObjectId id = { (uint32_t)index, m_slots[index].generation };
+        outIds.push_back(id);
     }
 }
 
+ObjectId CDocument::HitTest(D2D1_POINT_2F pt, float tolerance) const {
+    D2D1_RECT_F probe = D2D1::RectF(pt.x - tolerance, pt.y - tolerance, pt.x + tolerance, pt.y + tolerance);
+    QuerySlots(probe);
+
+    // 前面から判定
+    for (auto it = m_queryBuffer.rbegin(); it != m_queryBuffer.rend(); ++it) {
+        if (m_slots[*it].object->HitTest(pt, tolerance)) {
+            ObjectId id = { (uint32_t)*it, m_slots[*it].generation };
+            return id;
+        }
+    }
+    return InvalidObjectId;
+}
+
 std::shared_ptr<IDrawableObject> CDocument::GetLastObject() const {
-    return m_objects.empty() ? nullptr : m_objects.back();
+    return (m_zTail == NoSlot) ? nullptr : m_slots[m_zTail].object;
 }
 
-size_t CDocument::GetLastObjectIndex() const {
-    return m_objects.empty() ? 0 : m_objects.size() - 1;
+ObjectId CDocument::GetLastObjectId() const {
+    if (m_zTail == NoSlot) return InvalidObjectId;
+    ObjectId id = { m_zTail, m_slots[m_zTail].generation };
+    return id;
 }
 
-void CDocument::RecordCommand(std::unique_ptr<ICommand> command) {
-    m_undoStack.push(std::move(command));
+void CDocument::ExecuteCommand(std::unique_ptr<ICommand> command) {
+    command->Execute();
+    RecordCommand(std::move(command));
 }
 
+void CDocument::RecordCommand(std::unique_ptr<ICommand> command) {
+    // トランザクション中は完了時にまとめて記録する
+    if (m_pTransaction) {
+        m_pTransaction->Add(std::move(command));
+        return;
+    }
+
+    // 新しい操作を記録したら、やり直しの履歴は意味を失う
+    ClearRedo();
+
+    m_historyBytes += command->GetMemoryUsage();
+    m_undoStack.push_back(std::move(command));
+    TrimHistory();
+}
 void CDocument::Undo() {
     if (!CanUndo()) return;
 
-    std::unique_ptr<ICommand> command = std::move(m_undoStack.top());
-    m_undoStack.pop();
+    std::unique_ptr<ICommand> command = std::move(m_undoStack.back());
+    m_undoStack.pop_back();
 
+    m_historyBytes -= command->GetMemoryUsage();
     command->Undo();
-    m_redoStack.push(std::move(command));
+    m_historyBytes += command->GetMemoryUsage();
+    m_redoStack.push_back(std::move(command));
+    TrimHistory();
 }
 
 void CDocument::Redo() {
     if (!CanRedo()) return;
 
-    std::unique_ptr<ICommand> command = std::move(m_redoStack.top());
-    m_redoStack.pop();
+    std::unique_ptr<ICommand> command = std::move(m_redoStack.back());
+    m_redoStack.pop_back();
 
+    m_historyBytes -= command->GetMemoryUsage();
     command->Execute();
-    m_undoStack.push(std::move(command));
+    m_historyBytes += command->GetMemoryUsage();
+    m_undoStack.push_back(std::move(command));
+    TrimHistory();
+}
+
+void CDocument::BeginTransaction() {
+    if (m_transactionDepth++ == 0) {
+        m_pTransaction = std::make_unique<CCompositeCommand>();
+    }
+}
+
+void CDocument::CommitTransaction() {
+    if (m_transactionDepth == 0) return;
+    if (--m_transactionDepth > 0) return;
+
+    std::unique_ptr<CCompositeCommand> transaction = std::move(m_pTransaction);
+    if (!transaction->IsEmpty()) {
+        RecordCommand(std::move(transaction));
+    }
+}
+
+void CDocument::RollbackTransaction() {
+    if (m_transactionDepth == 0) return;
+
+    std::unique_ptr<CCompositeCommand> transaction = std::move(m_pTransaction);
+    m_transactionDepth = 0;
+    transaction->Undo();
+}
+
+void CDocument::SetHistoryLimits(size_t maxCommands, size_t maxBytes) {
+    m_maxHistoryCommands = maxCommands;
+    m_maxHistoryBytes = maxBytes;
+    TrimHistory();
+}
+
+void CDocument::ClearRedo() {
+    for (const auto& command : m_redoStack) {
+        m_historyBytes -= command->GetMemoryUsage();
+    }
+    m_redoStack.clear();
+}
+
+void CDocument::TrimHistory() {
+    // 上限を超えている間、最も古い取り消し履歴から捨てる
+    // (取り消し履歴が無くなったら、最も遠いやり直し履歴から捨てる)
+    while (m_undoStack.size() + m_redoStack.size() > m_maxHistoryCommands || m_historyBytes > m_maxHistoryBytes) {
+        std::deque<std::unique_ptr<ICommand>>& history = m_undoStack.empty() ? m_redoStack : m_undoStack;
+        if (history.empty()) break;
+
+        m_historyBytes -= history.front()->GetMemoryUsage();
+        history.pop_front();
+    }
 }
\ No newline at end of file
@@ -3,23 +3,145 @@
 #include <d2d1.h>
 #include <vector>
 #include <memory>
-#include <stack>
+#include <deque>
+#include <map>
 #include <algorithm> // std::max, std::min gp邽߂ɕKv
 #include <cmath>     // std::abs, std::sqrt gp邽߂ɕKv
+#include <cstdint>
+#include "SpatialIndex.h"
+#include "StrokeMoments.h"
+#include "StrokePoints.h"
 
 // O錾
 class CDocument;
+class CAddObjectCommand;
+class IShapeRecognizer;
+
+// --- hLg̃IuWFNgID ---
+// XbgԍƐ̑gBXbgėp邽тɐi߂邽߁A
+// 폜ς݂̃IuWFNgwÂID͖Ɣł
+struct ObjectId {
+    uint32_t slot;
+    uint32_t generation; // 0 ͖ID
+
+    bool IsValid() const { return generation != 0; }
+    bool operator==(const ObjectId& other) const { return slot == other.slot && generation == other.generation; }
+    bool operator!=(const ObjectId& other) const { return !(*this == other); }
+};
+
+const ObjectId InvalidObjectId = { 0, 0 };
+
+// --- E`wp[ ---
+inline D2D1_RECT_F InflateBounds(const D2D1_RECT_F& r, float amount) {
+    return D2D1::RectF(r.left - amount, r.top - amount, r.right + amount, r.bottom + amount);
+}
+
+inline D2D1_RECT_F UnionBounds(const D2D1_RECT_F& a, const D2D1_RECT_F& b) {
+    return D2D1::RectF(min(a.left, b.left), min(a.top, b.top), max(a.right, b.right), max(a.bottom, b.bottom));
+}
+
+inline bool BoundsIntersect(const D2D1_RECT_F& a, const D2D1_RECT_F& b) {
+    return a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom;
+}
+
+// 2_͂ދ`̔L
+inline D2D1_RECT_F SegmentBounds(D2D1_POINT_2F a, D2D1_POINT_2F b, float strokeWidth) {
+    D2D1_RECT_F r = D2D1::RectF(min(a.x, b.x), min(a.y, b.y), max(a.x, b.x), max(a.y, b.y));
+    return InflateBounds(r, strokeWidth * 0.5f);
+}
+
+// _Ɛ̋
+float DistanceToSegment(D2D1_POINT_2F p, D2D1_POINT_2F a, D2D1_POINT_2F b);
+
+// --- `ReLXgifoCXˑ\[X̃LbVj ---
+// uV͐FƂɈx쐬A_[^[Qbg̍č쐬ɔj
+class CRenderContext {
+private:
+    struct ColorLess {
+        bool operator()(const D2D1_COLOR_F& a, const D2D1_COLOR_F& b) const;
+    };
+
+    ID2D1RenderTarget* m_pRT;
+    std::map<D2D1_COLOR_F, ID2D1SolidColorBrush*, ColorLess> m_brushes;
+    ID2D1StrokeStyle* m_pRoundStrokeStyle;
+    float m_opacity; // GetBrush ŕԂuVɊ|sx
+    float m_scale;   // `֕ϊƂ̃hLgW 1  DIP 
+
+public:
+    CRenderContext() : m_pRT(nullptr), m_pRoundStrokeStyle(nullptr), m_opacity(1.0f), m_scale(1.0f) {}
+    ~CRenderContext() { DiscardResources(); }
+    CRenderContext(const CRenderContext&) = delete;
+    CRenderContext& operator=(const CRenderContext&) = delete;
+
+    // `̐ݒ (LbVς݃\[X͓\[XhC̃^[Qbgł̂ݗL)
+    void SetTarget(ID2D1RenderTarget* pRT) { m_pRT = pRT; }
+    ID2D1RenderTarget* GetTarget() const { return m_pRT; }
+
+    // FɑΉuV擾 (쐬Ȃ쐬ăLbV)
+    ID2D1SolidColorBrush* GetBrush(const D2D1_COLOR_F& color);
+
+    // ȍ~Ɏ擾uV̕sx (C[g킸ɔŕ`悷ꍇɎgp)
+    // ȌȂP̐}`ł΁AsxtC[ƓʂɂȂ
+    void SetOpacity(float opacity) { m_opacity = opacity; }
+    float GetOpacity() const { return m_opacity; }
+
+    // `̕ϊ̔{ (k\ŃIuWFNgڍדx邽߂Ɏg)
+    // SetTransform Ƃ͕ʂɁAϊݒ肵킹Đݒ肷
+    void SetScale(float scale) { m_scale = scale; }
+    float GetScale() const { return m_scale; }
+
+    // ۂ[_ẼXg[NX^C (t[nh`p)
+    ID2D1StrokeStyle* GetRoundStrokeStyle();
+
+    // D2DERR_RECREATE_TARGET ȂǂɃLbVj
+    void DiscardResources();
+};
+
+// --- `IuWFNg̎ ---
+// RTTI g킸ɔhNX𔻕ʂ邽߂̃^O (t@C`̎ނƂ͕ʂ̂)
+enum class ObjectType : uint8_t {
+    Line,
+    Ellipse,
+    Polyline,
+    Bezier,
+    Freehand,
+};
 
 // --- `IuWFNg̒ۊNX ---
 class IDrawableObject {
+private:
+    ObjectType m_type;
+
+protected:
+    explicit IDrawableObject(ObjectType type) : m_type(type) {}
+
 public:
     virtual ~IDrawableObject() = default;
-    virtual void Draw(ID2D1RenderTarget* pRT) const = 0;
-    virtual std::shared_ptr<IDrawableObject> Clone() const = 0;
+    ObjectType GetType() const { return m_type; } // z֐oRɎQƂł
+    virtual void Draw(CRenderContext& ctx) const = 0;
+    virtual D2D1_RECT_F GetBounds() const = 0; // ܂ޕ`͈
+    virtual bool HitTest(D2D1_POINT_2F pt, float tolerance) const = 0; // ̓_
     virtual void Complement() = 0; // AI⊮WbNKp
     virtual bool IsComplementable() const = 0; // ⊮\
+    virtual size_t GetMemoryUsage() const = 0; // ێĂ郁ʂ̊TZ (oCg)
+
+    // { scale ŕ`悷Ƃ̃WIg̃LbV쐬Ă
+    // ̃Xbh瓯IuWFNg`悷ꍇɁADraw LbVȂ悤ɂ
+    virtual void PrepareGeometry(ID2D1Factory* pFactory, float scale) const {}
 };
 
+// ^^OmFĔhNX֕ϊ (ႤނȂ nullptr)
+// T ͐ÓIo[ Type Ŏg̎ނ
+template <class T>
+const T* ObjectCast(const IDrawableObject* pObject) {
+    return (pObject && pObject->GetType() == T::Type) ? static_cast<const T*>(pObject) : nullptr;
+}
+
+template <class T>
+std::shared_ptr<T> ObjectCast(const std::shared_ptr<IDrawableObject>& object) {
+    return (object && object->GetType() == T::Type) ? std::static_pointer_cast<T>(object) : nullptr;
+}
+
 // --- ZOgi⊮ʂƂĎgpj ---
 class CLineSegment : public IDrawableObject {
 private:
@@ -29,13 +151,22 @@ private:
     float m_strokeWidth;
 
 public:
+    static const ObjectType Type = ObjectType::Line;
+
     CLineSegment(D2D1_POINT_2F start, D2D1_POINT_2F end, D2D1_COLOR_F color, float width);
 
+    D2D1_POINT_2F GetStart() const { return m_start; }
+    D2D1_POINT_2F GetEnd() const { return m_end; }
+    D2D1_COLOR_F GetColor() const { return m_color; }
+    float GetStrokeWidth() const { return m_strokeWidth; }
+
     // IDrawableObjectI[o[Ch
-    void Draw(ID2D1RenderTarget* pRT) const override;
-    std::shared_ptr<IDrawableObject> Clone() const override;
+    void Draw(CRenderContext& ctx) const override;
+    D2D1_RECT_F GetBounds() const override;
+    bool HitTest(D2D1_POINT_2F pt, float tolerance) const override;
     void Complement() override {}
     bool IsComplementable() const override { return false; }
+    size_t GetMemoryUsage() const override { return sizeof(*this); }
 };
 
 // --- ȉ~ZOgi⊮ʂƂĎgpj ---
@@ -44,67 +175,284 @@ private:
     D2D1_ELLIPSE m_ellipse;
     D2D1_COLOR_F m_color;
     float m_strokeWidth;
+    float m_rotation; // S܂̉]p (x)
 
 public:
-    CEllipseSegment(D2D1_ELLIPSE ellipse, D2D1_COLOR_F color, float width);
+    static const ObjectType Type = ObjectType::Ellipse;
+
+    CEllipseSegment(D2D1_ELLIPSE ellipse, D2D1_COLOR_F color, float width, float rotation = 0.0f);
+
+    const D2D1_ELLIPSE& GetEllipse() const { return m_ellipse; }
+    D2D1_COLOR_F GetColor() const { return m_color; }
+    float GetStrokeWidth() const { return m_strokeWidth; }
+    float GetRotation() const { return m_rotation; }
 
     // IDrawableObjectI[o[Ch
-    void Draw(ID2D1RenderTarget* pRT) const override;
-    std::shared_ptr<IDrawableObject> Clone() const override;
+    void Draw(CRenderContext& ctx) const override;
+    D2D1_RECT_F GetBounds() const override;
+    bool HitTest(D2D1_POINT_2F pt, float tolerance) const override;
     void Complement() override {}
     bool IsComplementable() const override { return false; }
+    size_t GetMemoryUsage() const override { return sizeof(*this); }
+};
+
+// --- ܂ZOgi⊮ʂƂĎgpB܂͋`Ȃǂ̑p`j ---
+class CPolylineSegment : public IDrawableObject {
+private:
+    std::vector<D2D1_POINT_2F> m_vertices;
+    bool m_isClosed;
+    D2D1_COLOR_F m_color;
+    float m_strokeWidth;
+
+    // `pWIg̃LbV
+    mutable ID2D1PathGeometry* m_pGeometry;
+
+    bool BuildGeometry(ID2D1Factory* pFactory) const;
+
+public:
+    static const ObjectType Type = ObjectType::Polyline;
+
+    CPolylineSegment(std::vector<D2D1_POINT_2F> vertices, bool isClosed, D2D1_COLOR_F color, float width);
+    ~CPolylineSegment();
+    CPolylineSegment(const CPolylineSegment&) = delete;
+    CPolylineSegment& operator=(const CPolylineSegment&) = delete;
+
+    const std::vector<D2D1_POINT_2F>& GetVertices() const { return m_vertices; }
+    bool IsClosed() const { return m_isClosed; }
+    D2D1_COLOR_F GetColor() const { return m_color; }
+    float GetStrokeWidth() const { return m_strokeWidth; }
+
+    // IDrawableObjectI[o[Ch
+    void Draw(CRenderContext& ctx) const override;
+    D2D1_RECT_F GetBounds() const override;
+    bool HitTest(D2D1_POINT_2F pt, float tolerance) const override;
+    void Complement() override {}
+    bool IsComplementable() const override { return false; }
+    size_t GetMemoryUsage() const override { return sizeof(*this) + m_vertices.capacity() * sizeof(D2D1_POINT_2F); }
+    void PrepareGeometry(ID2D1Factory* pFactory, float scale) const override;
+};
+
+// --- 3xWFȐZOgiȐ̕⊮ʂƂĎgpj ---
+// AԂ̐_ێ (Ԑ k ɑ΂ 3k + 1 )
+class CBezierSegment : public IDrawableObject {
+private:
+    std::vector<D2D1_POINT_2F> m_controlPoints;
+    D2D1_COLOR_F m_color;
+    float m_strokeWidth;
+
+    // `pWIg̃LbV
+    mutable ID2D1PathGeometry* m_pGeometry;
+
+    bool BuildGeometry(ID2D1Factory* pFactory) const;
+
+public:
+    static const ObjectType Type = ObjectType::Bezier;
+
+    CBezierSegment(std::vector<D2D1_POINT_2F> controlPoints, D2D1_COLOR_F color, float width);
+    ~CBezierSegment();
+    CBezierSegment(const CBezierSegment&) = delete;
+    CBezierSegment& operator=(const CBezierSegment&) = delete;
+
+    const std::vector<D2D1_POINT_2F>& GetControlPoints() const { return m_controlPoints; }
+    size_t GetSegmentCount() const { return m_controlPoints.size() < 4 ? 0 : (m_controlPoints.size() - 1) / 3; }
+    D2D1_COLOR_F GetColor() const { return m_color; }
+    float GetStrokeWidth() const { return m_strokeWidth; }
+
+    // IDrawableObjectI[o[Ch
+    void Draw(CRenderContext& ctx) const override;
+    D2D1_RECT_F GetBounds() const override;
+    bool HitTest(D2D1_POINT_2F pt, float tolerance) const override;
+    void Complement() override {}
+    bool IsComplementable() const override { return false; }
+    size_t GetMemoryUsage() const override { return sizeof(*this) + m_controlPoints.capacity() * sizeof(D2D1_POINT_2F); }
+    void PrepareGeometry(ID2D1Factory* pFactory, float scale) const override;
 };
 
 
 // --- t[nhXg[N ---
 class CFreehandStroke : public IDrawableObject {
 public:
-    enum class ShapeType { None, Line, Ellipse, Curve };
+    static const ObjectType Type = ObjectType::Freehand;
+
+    // Curve 3xWFȐƂċߎł銊炩ȋȐARectangle ͉]܂ދ`
+    enum class ShapeType { None, Line, Ellipse, Curve, Polyline, Rectangle };
+
+    // _̒P̐ݒ (ɑ΂{A0 Ŗ)
+    struct SimplifyOptions {
+        float inputDistance;  // Oɍ̗p_炱͓̋̓_͊Ԉ
+        float finalTolerance; // m莞 RDP @ŋe邸
+    };
+    static void SetSimplifyOptions(const SimplifyOptions& options) { s_simplifyOptions = options; }
+    static const SimplifyOptions& GetSimplifyOptions() { return s_simplifyOptions; }
+
+    // `󔻒ɎgFGW (nullptr Ŋ̃GWɖ߂)
+    // ̓[J[XbhɌĂ΂邽߁AGW͏ԂȂ
+    static void SetRecognizer(const IShapeRecognizer* pRecognizer) { s_pRecognizer = pRecognizer; }
+    static const IShapeRecognizer& GetRecognizer();
+
 private:
-    std::vector<D2D1_POINT_2F> m_points;
+    static SimplifyOptions s_simplifyOptions;
+    static const IShapeRecognizer* s_pRecognizer;
+
+    CStrokePoints m_points; // ͒̓_ (`NPʂŃv[mۂ SoA `)
+    CEncodedPoints m_encodedPoints; // m̓_ (B_ m_points ͋ɂ)
     D2D1_COLOR_F m_color;
     float m_strokeWidth;
     bool m_isComplemented;
+    bool m_isFinalized; // ͂ (WIgLbV̑Ώ)
+    CStrokeMoments m_moments; // Oڋ`ƌ`󔻒p̓v (AddPointŒXV)
+    SimplifyOptions m_simplify; // 쐬̒Pݒ
+    D2D1_POINT_2F m_pendingPoint; // ԈꂽŐV͓̓_ (m莞ɏI_ƂĒǉ)
+    bool m_hasPendingPoint;
+
+    // `pWIg̃LbV (_񂪕ςƂ̂ݔj)
+    mutable ID2D1PathGeometry* m_pGeometry;
+
+    // k\pɒPWIg (m̂݁BiK k  2^k ̋e덷ŒP)
+    // PĂ_ȂiK m_lodUsesFullGeometry ̃rbg𗧂āAm_pGeometry ŕ`悷
+    static const int LodLevelCount = 6;
+    mutable ID2D1PathGeometry* m_pLodGeometry[LodLevelCount];
+    mutable uint8_t m_lodUsesFullGeometry;
+
+    bool BuildGeometry(ID2D1Factory* pFactory) const;
+    ID2D1PathGeometry* GetLodGeometry(ID2D1Factory* pFactory, int level) const;
+    int SelectLodLevel(float scale) const; // giKBkȂꍇ -1A1 fɖȂꍇ LodSubPixel
+    static const int LodSubPixel = -2;
+    void InvalidateGeometry();
 
 public:
+    // `󔻒̌ (FGWԂ1)
+    struct ComplementResult {
+        ShapeType shape;
+        D2D1_ELLIPSE ellipse;
+        float rotation; // ȉ~̉]p (x)
+        std::vector<D2D1_POINT_2F> points; // Line: n_ƏI_ / Polyline, Rectangle: _ / Curve: _
+        bool isClosed; // Polyline, Rectangle: Ō̒_擪̒_֖߂ӂ܂ނ
+        float score; // KxɌ`󂲂Ƃ̗Dx|l (0`1B傫قǗD悷)
+    };
+
     ShapeType m_detectedShape = ShapeType::None;
     D2D1_ELLIPSE m_complementEllipse = { 0 }; // oꂽȉ~f[^
+    float m_complementRotation = 0.0f;        // oꂽȉ~̉]p (x)
 
 public:
     CFreehandStroke(D2D1_COLOR_F color, float width);
-    void AddPoint(D2D1_POINT_2F p);
+    ~CFreehandStroke();
+    CFreehandStroke(const CFreehandStroke&) = delete;
+    CFreehandStroke& operator=(const CFreehandStroke&) = delete;
+
+    // _ǉ (Ԉꂽꍇ false ԂAĕ`͕sv)
+    bool AddPoint(D2D1_POINT_2F p);
+
+    // ͊ɌĂяoA_PăWIg\z
+    void Finalize(ID2D1Factory* pFactory);
+
+    // ۑς݂̓_Ɠvʂmς݂̃Xg[N𕜌
+    // (_͒Pς݂̂̂ƂĈAđȂBWIg͕`掞ɍ\z)
+    void Restore(CStrokePoints&& points, const CStrokeMoments::State& moments);
+    void Restore(CEncodedPoints&& points, const CStrokeMoments::State& moments);
+
+    // ǂݍ񂾃t@CQƂĂ_𕡐AQƂ (t@Cu悤)
+    // _邽߁ÃXbh̃Xg[NǂłȂԂɌĂяo
+    void DetachExternalPoints();
 
     // IDrawableObjectI[o[Ch
-    void Draw(ID2D1RenderTarget* pRT) const override;
-    std::shared_ptr<IDrawableObject> Clone() const override;
+    void Draw(CRenderContext& ctx) const override;
+    D2D1_RECT_F GetBounds() const override;
+    bool HitTest(D2D1_POINT_2F pt, float tolerance) const override;
     void Complement() override;
     bool IsComplementable() const override;
+    size_t GetMemoryUsage() const override;
+    void PrepareGeometry(ID2D1Factory* pFactory, float scale) const override;
+
+    // ݂̓_ɑ΂`󔻒 (ԂύXȂߓ͒̎b蔻ɂg)
+    // FGW̌̂ł score ̍̂Ԃ
+    ComplementResult Recognize() const;
+
+    // _ւ̃ANZX
+    // GetPoints ͓͒ (ѕɓǂݍ) _AGetEncodedPoints ͊m̓_Ԃ
+    // ʂɈꍇ GetPointCount / GetFirstPoint / GetLastPoint / VisitPoints g
+    const CStrokePoints& GetPoints() const { return m_points; }
+    const CEncodedPoints& GetEncodedPoints() const { return m_encodedPoints; }
+    size_t GetPointCount() const { return m_points.Empty() ? m_encodedPoints.Size() : m_points.Size(); }
+    // ͒̓_̐ (ԈĊm莞ɏI_ƂĒǉ_܂)
+    size_t GetInputPointCount() const { return GetPointCount() + (m_hasPendingPoint ? 1 : 0); }
+    D2D1_POINT_2F GetFirstPoint() const { return m_points.Empty() ? m_encodedPoints.Front() : m_points.Front(); }
+    D2D1_POINT_2F GetLastPoint() const { return m_points.Empty() ? m_encodedPoints.Back() : m_points.Back(); }
 
-    const std::vector<D2D1_POINT_2F>& GetPoints() const { return m_points; }
+    // _擪珇 visitor(D2D1_POINT_2F) ֓n (visitor  false Ԃ璆f false Ԃ)
+    template <class Visitor>
+    bool VisitPoints(Visitor visitor) const;
+
+    D2D1_COLOR_F GetColor() const { return m_color; }
+    float GetStrokeWidth() const { return m_strokeWidth; }
+    const CStrokeMoments& GetMoments() const { return m_moments; }
+
+    // Ōɒǉꂽ̕`͈ (͒̕ĕ`p)
+    D2D1_RECT_F GetLastSegmentBounds() const;
 };
 
 
+template <class Visitor>
+bool CFreehandStroke::VisitPoints(Visitor visitor) const {
+    if (!m_points.Empty()) {
+        for (size_t k = 0; k < m_points.GetChunkCount(); ++k) {
+            const float* xs = m_points.GetChunkX(k);
+            const float* ys = m_points.GetChunkY(k);
+            size_t count = m_points.GetChunkSize(k);
+            for (size_t i = 0; i < count; ++i) {
+                if (!visitor(D2D1::Point2F(xs[i], ys[i]))) return false;
+            }
+        }
+        return true;
+    }
+
+    CEncodedPoints::Reader reader = m_encodedPoints.GetReader();
+    D2D1_POINT_2F p;
+    while (reader.Next(p)) {
+        if (!visitor(p)) return false;
+    }
+    return true;
+}
+
+
 // --- R}hۊNXiUndo/Redopj ---
 class ICommand {
 public:
     virtual ~ICommand() = default;
     virtual void Execute() = 0; // s
     virtual void Undo() = 0;    // ɖ߂
+
+    // ێĂ郁ʂ̊TZ (hLgɂIuWFNg͊܂߂Ȃ)
+    // sς݂ς݂őΏۂς邽߁AExecute/Undo ̑OŒlς
+    virtual size_t GetMemoryUsage() const = 0;
+
+    // ǉR}hłΎgԂ (R}hőċL^ꂽǉ܂Ƃ߂邽)
+    virtual CAddObjectCommand* AsAddObjectCommand() { return nullptr; }
 };
 
 // --- IuWFNgǉR}h ---
+// hLgɒǉς݂̃IuWFNgL^BUndo łID\񂵂܂܎OA
+// Redo œIDz̈ʒuɖ߂߁A㑱̃R}hIDLȂ܂ܕۂ
 class CAddObjectCommand : public ICommand {
 private:
     CDocument* m_pDoc;
-    std::shared_ptr<IDrawableObject> m_object;
-    size_t m_index; // }ʒu (Undo/Redop)
+    std::vector<ObjectId> m_ids;
+    std::vector<std::shared_ptr<IDrawableObject>> m_objects;
+    bool m_isUndone;
 
 public:
-    CAddObjectCommand(CDocument* pDoc, std::shared_ptr<IDrawableObject> object);
+    CAddObjectCommand(CDocument* pDoc, ObjectId id, std::shared_ptr<IDrawableObject> object);
+    ~CAddObjectCommand(); // ɔjꂽꍇ͗\񂵂ĂID
 
     // ICommandI[o[Ch
     void Execute() override;
     void Undo() override;
+    size_t GetMemoryUsage() const override;
+    CAddObjectCommand* AsAddObjectCommand() override { return this; }
+
+    // other 荞1̃R}hɂ (sςݓm̂)
+    bool TryMerge(CAddObjectCommand& other);
 };
 
 // --- AI⊮R}h (Undo/Redo\ɂ) ---
@@ -113,32 +461,183 @@ private:
     CDocument* m_pDoc;
     std::shared_ptr<IDrawableObject> m_originalObject; // ⊮ÕIuWFNg
     std::shared_ptr<IDrawableObject> m_newObject;      // ⊮̃IuWFNg
-    size_t m_index; // IuWFNgXgɂʒu
+    ObjectId m_id; // uΏۂID
+    bool m_isUndone;
 
 public:
-    CComplementCommand(CDocument* pDoc, size_t index, std::shared_ptr<IDrawableObject> original, std::shared_ptr<IDrawableObject> newItem);
+    CComplementCommand(CDocument* pDoc, ObjectId id, std::shared_ptr<IDrawableObject> original, std::shared_ptr<IDrawableObject> newItem);
 
     // ICommandI[o[Ch
     void Execute() override;
     void Undo() override;
+    size_t GetMemoryUsage() const override;
+};
+
+
+// --- R}h (gUNVŋL^܂Ƃ߂1̗ɂ) ---
+class CCompositeCommand : public ICommand {
+private:
+    std::vector<std::unique_ptr<ICommand>> m_commands; // s
+
+public:
+    // sς݂̃R}hǉ (ċL^ꂽǉR}h1ɂ܂Ƃ߂)
+    void Add(std::unique_ptr<ICommand> command);
+    bool IsEmpty() const { return m_commands.empty(); }
+
+    // ICommandI[o[Ch
+    void Execute() override; // L^ɍĎs
+    void Undo() override;    // tɎ
+    size_t GetMemoryUsage() const override;
 };
 
 
 // --- hLgǗNX ---
+// IuWFNg̓Xbg̔zɊi[AIDŎQƂ (ǉE폜Eu O(1))
+// `揇 (z) ̓XbgԂ̑oXgƂĕʂɊǗ
+// Ƒȉ~͕`ɕKvȒlނƂ̘AzɂA`掞̓IuWFNg{̂QƂȂ
 class CDocument {
 private:
-    std::vector<std::shared_ptr<IDrawableObject>> m_objects;
-    std::stack<std::unique_ptr<ICommand>> m_undoStack;
-    std::stack<std::unique_ptr<ICommand>> m_redoStack;
+    static const uint32_t NoSlot = 0xFFFFFFFF;
+
+    enum class SlotState : uint8_t {
+        Free,     // gp (󂫃Xg)
+        Live,     // hLgɂ
+        Detached, // Undo ȂǂŎO (ID͗\񂳂ꂽ܂)
+    };
+
+    struct Slot {
+        std::shared_ptr<IDrawableObject> object;
+        uint32_t generation;
+        SlotState state;
+        uint64_t zKey;     // 傫قǑOʁBOێA߂Ƃ̈ʒuɎg
+        uint32_t prev;     // z̔wʑ (O͖߂ʒu̎|)
+        uint32_t next;     // z̑Oʑ / 󂫃Xg̎
+        ObjectType type;   // hLgɂԂ̃IuWFNg̎
+        uint32_t record;   // ނƂ̕`惌R[ḧʒu (R[hȂނł NoSlot)
+    };
+
+    // ނƂ̕`惌R[h (IuWFNg͍쐬ɕωȂ߁Al𕡐Ď)
+    // ܂ExWFȐEt[nh̓WIg̃LbVڍדx̑I
+    // IuWFNgg߁AR[h炸 Draw Ăяo
+    struct LineRecord {
+        D2D1_POINT_2F start;
+        D2D1_POINT_2F end;
+        D2D1_COLOR_F color;
+        float strokeWidth;
+        uint32_t slot; // z񂩂폜ƂɁAړR[h̃XbgXV邽
+    };
+    struct EllipseRecord {
+        D2D1_ELLIPSE ellipse;
+        D2D1_COLOR_F color;
+        float strokeWidth;
+        float rotation;
+        uint32_t slot;
+    };
+
+    // 1̕`̊ԂɎg񂷏 (FԂ̓uV擾Ȃ)
+    struct DrawBatch {
+        CRenderContext& ctx;
+        ID2D1RenderTarget* pRT;
+        ID2D1SolidColorBrush* pBrush;
+        D2D1_COLOR_F color;             // pBrush ̐F (pBrush  nullptr ̊Ԃ͖)
+        bool hasBaseTransform;
+        D2D1_MATRIX_3X2_F baseTransform; // ]ȉ~̕`ɖ߂ϊ
+
+        explicit DrawBatch(CRenderContext& context);
+        ID2D1SolidColorBrush* GetBrush(const D2D1_COLOR_F& c);
+    };
+
+    // Xbg͗̃R}hɐ錾AR}h̔jɂLł悤ɂ
+    std::vector<Slot> m_slots;
+    uint32_t m_freeHead = NoSlot;
+    uint32_t m_zHead = NoSlot; // Ŕw
+    uint32_t m_zTail = NoSlot; // őO
+    uint64_t m_nextZKey = 1;
+    size_t m_liveCount = 0;
+
+    // ŐVB𒴂擪 (łÂ) ̂Ă
+    std::deque<std::unique_ptr<ICommand>> m_undoStack;
+    std::deque<std::unique_ptr<ICommand>> m_redoStack;
+    size_t m_maxHistoryCommands = 1000;              // Undo/Redo 킹R}h̏
+    size_t m_maxHistoryBytes = 64 * 1024 * 1024;     // ێ郁ʂ̏
+    size_t m_historyBytes = 0;
+
+    // s̃gUNV (L^R}h͊1̗ɂȂ)
+    std::unique_ptr<CCompositeCommand> m_pTransaction;
+    int m_transactionDepth = 0;
+    unsigned int m_version = 0; // eς邽тɑ (`LbV̖p)
+
+    // ῶ͈̋L^ (`LbV𕔕Iɖ邽)
+    // m_changeLogStart ̃o[W̕ῶׂċL^Ă
+    struct Change {
+        unsigned int version;
+        D2D1_RECT_F bounds;
+    };
+    static const size_t MaxChangeLogEntries = 4096;
+    std::vector<Change> m_changeLog;
+    unsigned int m_changeLogStart = 0;
+
+    std::vector<LineRecord> m_lineRecords;
+    std::vector<EllipseRecord> m_ellipseRecords;
+
+    // Xbgԍo^ԃCfbNX (JOƃqbgeXgp)
+    CSpatialGrid m_spatialIndex;
+    mutable std::vector<size_t> m_queryBuffer;
+
+    Slot* Resolve(ObjectId id, SlotState state);
+    const Slot* Resolve(ObjectId id, SlotState state) const;
+    void LinkZOrder(uint32_t slot);   // zKey ̏ɂȂʒuɑ}
+    void UnlinkZOrder(uint32_t slot);
+    void AddDrawRecord(uint32_t slot);    // hLgɓIuWFNg̕`惌R[h
+    void RemoveDrawRecord(uint32_t slot);
+    template <class Record>
+    void EraseDrawRecord(std::vector<Record>& records, uint32_t position);
+    void DrawSlot(DrawBatch& batch, size_t slot) const;
+    void QuerySlots(const D2D1_RECT_F& area) const { QuerySlots(area, m_queryBuffer); } // ʂ m_queryBuffer  zŊi[
+    void QuerySlots(const D2D1_RECT_F& area, std::vector<size_t>& outSlots) const;
+    void RecordChange(const D2D1_RECT_F& bounds); // ݂̃o[W̕ωƂċL^
+    void ClearRedo();
+    void TrimHistory();
 
 public:
+    CDocument() = default;
+    ~CDocument();
+    CDocument(const CDocument&) = delete;
+    CDocument& operator=(const CDocument&) = delete;
+
     // hLg
-    void AddObject(std::shared_ptr<IDrawableObject> object, bool recordCommand = true);
-    void ReplaceObject(size_t index, std::shared_ptr<IDrawableObject> newObject);
-    void RemoveObjectAt(size_t index);
+    ObjectId AddObject(std::shared_ptr<IDrawableObject> object, bool recordCommand = true); // őOʂɒǉ
+    void ReplaceObject(ObjectId id, std::shared_ptr<IDrawableObject> newObject);
+    void RemoveObject(ObjectId id); // ɋL^ɍ폜AID
+    void Clear(); // ׂẴIuWFNgƗj (sς݂IDׂ͂ĖɂȂ)
+
+    // p̑: ID\񂵂܂܎O / OIDz̈ʒuɖ߂ / \
+    void DetachObject(ObjectId id);
+    void AttachObject(ObjectId id, std::shared_ptr<IDrawableObject> object);
+    void ReleaseObjectId(ObjectId id);
 
-    // `
-    void DrawAll(ID2D1RenderTarget* pRT) const;
+    std::shared_ptr<IDrawableObject> FindObject(ObjectId id) const; // IDȂ nullptr
+    bool Contains(ObjectId id) const { return Resolve(id, SlotState::Live) != nullptr; }
+    size_t GetObjectCount() const { return m_liveCount; }
+    void GetObjectIds(std::vector<ObjectId>& outIds) const; // z (wʂ)
+
+    // ` (pClip w肵ꍇ͔͈͊ÕIuWFNgȗ)
+    void DrawAll(CRenderContext& ctx, const D2D1_RECT_F* pClip = nullptr) const;
+    unsigned int GetVersion() const { return m_version; }
+
+    // ̃Xbh͈͂Ƃɕ`悷ꍇ̏ƕ`
+    // PrepareGeometry  area ƏdȂIuWFNg̃WIg () 쐬Ă΁A
+    // ͈͓̔ DrawAll ͍Ɨ̈Ăяo߁AʁX̃Xbh瓯ɌĂяo
+    void PrepareGeometry(ID2D1Factory* pFactory, float scale, const D2D1_RECT_F& area) const;
+    void DrawAll(CRenderContext& ctx, const D2D1_RECT_F& clip, std::vector<size_t>& queryBuffer) const;
+
+    // sinceVersion ɕῶ͈Ԃ (d܂)
+    // L^cĂȂꍇ (Clear ̌ωꍇ)  false ԂAŜω̂ƂĈ
+    bool GetChangedBounds(unsigned int sinceVersion, std::vector<D2D1_RECT_F>& outBounds) const;
+
+    // Ԍ
+    void QueryObjects(const D2D1_RECT_F& area, std::vector<ObjectId>& outIds) const; // z (wʂ)
+    ObjectId HitTest(D2D1_POINT_2F pt, float tolerance) const; // őOʂ̊YIuWFNgA InvalidObjectId
 
     // Undo/Redo
     void Undo();
@@ -146,10 +645,25 @@ public:
     bool CanUndo() const { return !m_undoStack.empty(); }
     bool CanRedo() const { return !m_redoStack.empty(); }
 
-    // ݂̃IuWFNgANZXi⊮pj
+    // ̏ (͌Â̂̂Ă)
+    void SetHistoryLimits(size_t maxCommands, size_t maxBytes);
+    size_t GetHistoryMemoryUsage() const { return m_historyBytes; }
+
+    // őOʂ̃IuWFNg
     std::shared_ptr<IDrawableObject> GetLastObject() const;
-    size_t GetLastObjectIndex() const;
+    ObjectId GetLastObjectId() const;
+
+    // R}hsċL^
+    void ExecuteCommand(std::unique_ptr<ICommand> command);
 
-    // R}hL^
+    // R}hL^ (sς݂̃R}hnBRedo ̗͔j)
     void RecordCommand(std::unique_ptr<ICommand> command);
+
+    // gUNV: Begin  Commit ܂łɋL^R}h1 Undo Pʂɂ
+    // qɂłAłO Commit ŗɋL^
+    // Rollback ̓gUNVS (q̊O܂) ďI
+    void BeginTransaction();
+    void CommitTransaction();
+    void RollbackTransaction();
+    bool IsInTransaction() const { return m_transactionDepth > 0; }
 };
\ No newline at end of file
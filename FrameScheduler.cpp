@@ -0,0 +1,79 @@
+﻿#include "FrameScheduler.h"
+#include <dwmapi.h>
+
+#pragma comment(lib, "dwmapi.lib")
+
+// --- CFrameScheduler 実装 ---
+
+CFrameScheduler::CFrameScheduler()
+    : m_hWnd(NULL), m_frameMessage(0), m_hThread(NULL),
+      m_hRequestEvent(NULL), m_hStopEvent(NULL), m_framePending(false) {
+}
+
+bool CFrameScheduler::Start(HWND hWnd, UINT frameMessage) {
+    if (m_hThread) return true;
+
+    m_hWnd = hWnd;
+    m_frameMessage = frameMessage;
+    m_framePending = false;
+    m_hRequestEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    m_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (m_hRequestEvent && m_hStopEvent) {
+        m_hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+    }
+
+    if (!m_hThread) {
+        Stop();
+        return false;
+    }
+    return true;
+}
+
+void CFrameScheduler::Stop() {
+    if (m_hThread) {
+        SetEvent(m_hStopEvent);
+        WaitForSingleObject(m_hThread, INFINITE);
+        CloseHandle(m_hThread);
+        m_hThread = NULL;
+    }
+    if (m_hRequestEvent) {
+        CloseHandle(m_hRequestEvent);
+        m_hRequestEvent = NULL;
+    }
+    if (m_hStopEvent) {
+        CloseHandle(m_hStopEvent);
+        m_hStopEvent = NULL;
+    }
+}
+
+void CFrameScheduler::RequestFrame() {
+    if (!m_hThread) return;
+
+    // 未処理のフレームがある間は要求をまとめる
+    if (!m_framePending.exchange(true)) {
+        SetEvent(m_hRequestEvent);
+    }
+}
+
+DWORD WINAPI CFrameScheduler::ThreadProc(LPVOID param) {
+    static_cast<CFrameScheduler*>(param)->Run();
+    return 0;
+}
+
+void CFrameScheduler::Run() {
+    HANDLE handles[] = { m_hStopEvent, m_hRequestEvent };
+    for (;;) {
+        DWORD result = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+        if (result != WAIT_OBJECT_0 + 1) break; // 停止要求またはエラー
+
+        // 次の垂直同期まで待つ (デスクトップ合成が無効な場合はおよそ1フレーム待つ)
+        if (FAILED(DwmFlush())) {
+            Sleep(16);
+        }
+
+        if (WaitForSingleObject(m_hStopEvent, 0) == WAIT_OBJECT_0) break;
+        if (!PostMessage(m_hWnd, m_frameMessage, 0, 0)) {
+            m_framePending = false;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <atomic>
+
+// --- フレームスケジューラ ---
+// 再描画の要求をまとめ、ディスプレイの垂直同期 (DwmFlush) ごとに最大1回だけ
+// ウィンドウへフレームメッセージを送る。入力処理は要求を記録するだけでよい
+class CFrameScheduler {
+private:
+    HWND m_hWnd;
+    UINT m_frameMessage;
+    HANDLE m_hThread;
+    HANDLE m_hRequestEvent; // フレーム要求 (自動リセット)
+    HANDLE m_hStopEvent;
+    std::atomic<bool> m_framePending; // メッセージ送信済みで未処理のフレームがあるか
+
+    static DWORD WINAPI ThreadProc(LPVOID param);
+    void Run();
+
+public:
+    CFrameScheduler();
+    ~CFrameScheduler() { Stop(); }
+    CFrameScheduler(const CFrameScheduler&) = delete;
+    CFrameScheduler& operator=(const CFrameScheduler&) = delete;
+
+    // 垂直同期の後に frameMessage を hWnd へポストするスレッドを開始する
+    bool Start(HWND hWnd, UINT frameMessage);
+    void Stop();
+    bool IsRunning() const { return m_hThread != NULL; }
+
+    // 次の垂直同期でフレームを要求する (何度呼んでも1フレームにまとめられる)
+    void RequestFrame();
+
+    // フレームメッセージの処理開始時に呼び出し、次の要求を受け付ける
+    void BeginFrame() { m_framePending = false; }
+};
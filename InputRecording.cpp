@@ -0,0 +1,120 @@
+﻿#include "InputRecording.h"
+#include <cstring>
+
+// --- CInputRecording 実装 ---
+
+void CInputRecording::Add(InputEventType type, LONG messageTime, const D2D1_POINT_2F* points, size_t pointCount) {
+    if (!m_started) {
+        m_startTime = (DWORD)messageTime;
+        m_started = true;
+    }
+
+    InputEvent event;
+    event.type = type;
+    event.time = (DWORD)messageTime - m_startTime; // ティックの一周にも対応する
+    event.points.assign(points, points + pointCount);
+    m_events.push_back(std::move(event));
+}
+
+void CInputRecording::Clear() {
+    m_events.clear();
+    m_started = false;
+    m_startTime = 0;
+}
+
+HRESULT CInputRecording::Save(const wchar_t* path) const {
+    std::vector<uint8_t> buffer;
+    auto append = [&buffer](const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        buffer.insert(buffer.end(), p, p + size);
+    };
+
+    InputRecordingHeader header = { 0 };
+    header.magic = InputRecordingMagic;
+    header.version = InputRecordingVersion;
+    header.headerSize = sizeof(InputRecordingHeader);
+    header.eventCount = (uint32_t)m_events.size();
+    append(&header, sizeof(header));
+
+    for (const InputEvent& event : m_events) {
+        InputEventRecord record = { event.type, event.time, (uint32_t)event.points.size() };
+        append(&record, sizeof(record));
+        for (const D2D1_POINT_2F& pt : event.points) {
+            float xy[2] = { pt.x, pt.y };
+            append(xy, sizeof(xy));
+        }
+    }
+
+    HANDLE hFile = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+
+    HRESULT hr = S_OK;
+    DWORD written = 0;
+    if (!WriteFile(hFile, buffer.data(), (DWORD)buffer.size(), &written, NULL) || written != buffer.size()) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        if (SUCCEEDED(hr)) hr = E_FAIL;
+    }
+    CloseHandle(hFile);
+    return hr;
+}
+
+HRESULT CInputRecording::Load(const wchar_t* path) {
+    HANDLE hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+
+    HRESULT hr = S_OK;
+    std::vector<uint8_t> buffer;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size)) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (size.QuadPart < (LONGLONG)sizeof(InputRecordingHeader) || size.QuadPart > MAXDWORD) {
+        hr = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    }
+    else {
+        buffer.resize((size_t)size.QuadPart);
+        DWORD read = 0;
+        if (!ReadFile(hFile, buffer.data(), (DWORD)buffer.size(), &read, NULL) || read != buffer.size()) {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            if (SUCCEEDED(hr)) hr = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+        }
+    }
+    CloseHandle(hFile);
+    if (FAILED(hr)) return hr;
+
+    const HRESULT badFormat = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    InputRecordingHeader header;
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (header.magic != InputRecordingMagic || header.headerSize < sizeof(header) || header.headerSize > buffer.size()) return badFormat;
+    if (header.version == 0) return badFormat;
+    if (header.version > InputRecordingVersion) return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+    std::vector<InputEvent> events;
+    size_t offset = header.headerSize;
+    for (uint32_t i = 0; i < header.eventCount; ++i) {
+        InputEventRecord record;
+        if (buffer.size() - offset < sizeof(record)) return badFormat;
+        memcpy(&record, buffer.data() + offset, sizeof(record));
+        offset += sizeof(record);
+
+        if (record.type < InputEventType::ButtonDown || record.type > InputEventType::ComplementAll) return badFormat;
+        if ((buffer.size() - offset) / (sizeof(float) * 2) < record.pointCount) return badFormat;
+
+        InputEvent event;
+        event.type = record.type;
+        event.time = record.time;
+        event.points.resize(record.pointCount);
+        for (D2D1_POINT_2F& pt : event.points) {
+            float xy[2];
+            memcpy(xy, buffer.data() + offset, sizeof(xy));
+            offset += sizeof(xy);
+            pt = D2D1::Point2F(xy[0], xy[1]);
+        }
+        events.push_back(std::move(event));
+    }
+
+    m_events = std::move(events);
+    m_started = false;
+    m_startTime = 0;
+    return S_OK;
+}
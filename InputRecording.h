@@ -0,0 +1,65 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <d2d1.h>
+#include <cstdint>
+#include <vector>
+
+// --- 入力の記録ファイル形式 ---
+// [ヘッダー][イベント]... の順に並べる (リトルエンディアン)
+// イベントは [InputEventRecord][点 (x, y の float) × pointCount] の可変長
+// 再生はキャンバスが空の状態から始めるため、記録も空のドキュメントから行う
+
+const uint32_t InputRecordingMagic = 0x52504941; // "AIPR"
+const uint16_t InputRecordingVersion = 1;
+
+// ドキュメントを変化させる入力の種類
+enum class InputEventType : uint32_t {
+    ButtonDown = 1,       // ストロークの開始 (点は1つ)
+    MouseMove = 2,        // 1回の WM_MOUSEMOVE で取り込んだ点 (統合されたメッセージの途中の点を含む)
+    ButtonUp = 3,         // ストロークの確定 (補完判定を依頼する)
+    AcceptComplement = 4, // Tab (プレビューがあった場合のみ記録)
+    Undo = 5,
+    Redo = 6,
+    ComplementAll = 7,    // Shift+Tab
+};
+
+struct InputRecordingHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t eventCount;
+    uint32_t reserved;
+};
+
+struct InputEventRecord {
+    InputEventType type;
+    uint32_t time; // 記録開始からの経過時間 (ミリ秒)
+    uint32_t pointCount;
+};
+
+struct InputEvent {
+    InputEventType type;
+    uint32_t time;
+    std::vector<D2D1_POINT_2F> points;
+};
+
+// --- 入力の記録 ---
+class CInputRecording {
+private:
+    std::vector<InputEvent> m_events;
+    bool m_started;
+    DWORD m_startTime; // 最初のイベントのメッセージ時刻
+
+public:
+    CInputRecording() : m_started(false), m_startTime(0) {}
+
+    // messageTime は GetMessageTime の値
+    void Add(InputEventType type, LONG messageTime, const D2D1_POINT_2F* points = nullptr, size_t pointCount = 0);
+    void Clear();
+
+    const std::vector<InputEvent>& GetEvents() const { return m_events; }
+
+    HRESULT Save(const wchar_t* path) const;
+    HRESULT Load(const wchar_t* path); // 失敗した場合は変更しない
+};
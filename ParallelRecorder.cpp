@@ -0,0 +1,133 @@
+﻿#include "ParallelRecorder.h"
+#include <algorithm>
+#include <execution>
+#include <numeric>
+#include <thread>
+
+// --- CParallelRecorder 実装 ---
+
+HRESULT CParallelRecorder::Create(ID2D1RenderTarget* pTarget) {
+    ID2D1DeviceContext* pTargetContext = nullptr;
+    if (FAILED(pTarget->QueryInterface(__uuidof(ID2D1DeviceContext), (void**)&pTargetContext))) {
+        return S_FALSE;
+    }
+    ID2D1Device* pDevice = nullptr;
+    pTargetContext->GetDevice(&pDevice);
+    FLOAT dpiX = 96.0f, dpiY = 96.0f;
+    pTargetContext->GetDpi(&dpiX, &dpiY);
+    pTargetContext->Release();
+    if (!pDevice) return S_FALSE;
+
+    if (pDevice == m_pDevice) {
+        pDevice->Release();
+        return S_OK;
+    }
+
+    Discard();
+    size_t workerCount = min((size_t)std::thread::hardware_concurrency(), MaxWorkers);
+    if (workerCount < 2) {
+        pDevice->Release();
+        return S_FALSE;
+    }
+
+    HRESULT hr = S_OK;
+    for (size_t i = 0; i < workerCount && SUCCEEDED(hr); ++i) {
+        ID2D1DeviceContext* pContext = nullptr;
+        hr = pDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, &pContext);
+        if (SUCCEEDED(hr)) {
+            // 記録する内容が描画先と同じになるように DPI を合わせる
+            pContext->SetDpi(dpiX, dpiY);
+            Worker worker = { pContext, std::make_unique<CRenderContext>(), {} };
+            worker.renderContext->SetTarget(pContext);
+            m_workers.push_back(std::move(worker));
+        }
+    }
+    m_pDevice = pDevice;
+    if (FAILED(hr)) Discard();
+    return hr;
+}
+
+HRESULT CParallelRecorder::RecordJob(const CDocument& document, Worker& worker, Job& job) {
+    ID2D1CommandList* pCommandList = nullptr;
+    HRESULT hr = worker.pContext->CreateCommandList(&pCommandList);
+    if (FAILED(hr)) return hr;
+
+    worker.pContext->SetTarget(pCommandList);
+    worker.pContext->BeginDraw();
+    worker.pContext->SetTransform(job.transform);
+    worker.renderContext->SetScale(job.scale);
+    document.DrawAll(*worker.renderContext, job.clip, worker.queryBuffer);
+    hr = worker.pContext->EndDraw();
+    worker.pContext->SetTarget(nullptr);
+
+    if (SUCCEEDED(hr)) {
+        hr = pCommandList->Close();
+    }
+    if (FAILED(hr)) {
+        pCommandList->Release();
+        return hr;
+    }
+    job.pCommandList = pCommandList;
+    return S_OK;
+}
+
+HRESULT CParallelRecorder::Record(const CDocument& document, std::vector<Job>& jobs) {
+    if (m_workers.empty()) return E_UNEXPECTED;
+    for (Job& job : jobs) {
+        job.pCommandList = nullptr;
+    }
+
+    // 1. ジオメトリのキャッシュを先に作成する (記録中のオブジェクトの Draw は読み取りのみになる)
+    ID2D1Factory* pFactory = nullptr;
+    m_pDevice->GetFactory(&pFactory);
+    if (!pFactory) return E_UNEXPECTED;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        // 倍率ごとに1回、すべての範囲を含む矩形について作成する
+        bool isFirst = true;
+        for (size_t k = 0; k < i && isFirst; ++k) {
+            isFirst = (jobs[k].scale != jobs[i].scale);
+        }
+        if (!isFirst) continue;
+
+        D2D1_RECT_F area = jobs[i].clip;
+        for (size_t k = i + 1; k < jobs.size(); ++k) {
+            if (jobs[k].scale == jobs[i].scale) area = UnionBounds(area, jobs[k].clip);
+        }
+        document.PrepareGeometry(pFactory, jobs[i].scale, area);
+    }
+    pFactory->Release();
+
+    // 2. ワーカー w が w, w + n, w + 2n, ... 番目の範囲を記録する
+    std::vector<size_t> workerIndices(min(m_workers.size(), jobs.size()));
+    std::iota(workerIndices.begin(), workerIndices.end(), (size_t)0);
+    std::vector<HRESULT> results(workerIndices.size(), S_OK);
+    std::for_each(std::execution::par, workerIndices.begin(), workerIndices.end(), [&](size_t w) {
+        for (size_t j = w; j < jobs.size() && SUCCEEDED(results[w]); j += workerIndices.size()) {
+            results[w] = RecordJob(document, m_workers[w], jobs[j]);
+        }
+    });
+
+    for (HRESULT hr : results) {
+        if (SUCCEEDED(hr)) continue;
+        for (Job& job : jobs) {
+            if (job.pCommandList) {
+                job.pCommandList->Release();
+                job.pCommandList = nullptr;
+            }
+        }
+        return hr;
+    }
+    return S_OK;
+}
+
+void CParallelRecorder::Discard() {
+    for (Worker& worker : m_workers) {
+        worker.renderContext->DiscardResources();
+        worker.pContext->Release();
+    }
+    m_workers.clear();
+    if (m_pDevice) {
+        m_pDevice->Release();
+        m_pDevice = nullptr;
+    }
+}
@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <d2d1_1.h>
+#include <memory>
+#include <vector>
+#include "DrawingObject.h"
+
+// --- ドキュメントの範囲ごとの並列記録 ---
+// ワーカーごとにデバイスコンテキストを作り、範囲ごとの描画を ID2D1CommandList に記録する
+// 記録したコマンドリストは呼び出し側 (UI スレッド) で描画先へ合成する
+// ファクトリは D2D1_FACTORY_TYPE_MULTI_THREADED で作成されていること
+class CParallelRecorder {
+public:
+    static const size_t MaxWorkers = 8;
+
+    // 記録する範囲 (pCommandList は Record で設定され、呼び出し側が Release する)
+    struct Job {
+        D2D1_MATRIX_3X2_F transform; // ドキュメント座標から描画先への変換
+        float scale;                 // transform の倍率 (CRenderContext::SetScale に渡す)
+        D2D1_RECT_F clip;            // 記録するドキュメント座標の範囲
+        ID2D1CommandList* pCommandList;
+    };
+
+private:
+    // デバイスコンテキストは複数のスレッドから同時に使えないため、ワーカーごとに持つ
+    // ブラシなどのリソースは同じデバイスのコンテキスト間で共有できるが、キャッシュはワーカーごとに持つ
+    struct Worker {
+        ID2D1DeviceContext* pContext;
+        std::unique_ptr<CRenderContext> renderContext;
+        std::vector<size_t> queryBuffer;
+    };
+
+    std::vector<Worker> m_workers;
+    ID2D1Device* m_pDevice; // ワーカーのコンテキストを作成したデバイス
+
+    static HRESULT RecordJob(const CDocument& document, Worker& worker, Job& job);
+
+public:
+    CParallelRecorder() : m_pDevice(nullptr) {}
+    ~CParallelRecorder() { Discard(); }
+    CParallelRecorder(const CParallelRecorder&) = delete;
+    CParallelRecorder& operator=(const CParallelRecorder&) = delete;
+
+    // pTarget と同じデバイスにワーカーのコンテキストを用意する (作成済みなら何もしない)
+    // pTarget がデバイスコンテキストでない場合や、ワーカーが1つしか使えない場合は S_FALSE を返す
+    HRESULT Create(ID2D1RenderTarget* pTarget);
+    size_t GetWorkerCount() const { return m_workers.size(); }
+
+    // jobs をワーカーに分担して記録する (失敗した場合はすべてのコマンドリストを解放する)
+    HRESULT Record(const CDocument& document, std::vector<Job>& jobs);
+
+    void Discard();
+};
@@ -0,0 +1,171 @@
+﻿#include "PerfMonitor.h"
+#include <TraceLoggingProvider.h>
+#include <cstdio>
+
+#pragma comment(lib, "dwrite.lib")
+
+// ETW プロバイダー "AIPaint" {6E2C5A8B-1F4D-4C7E-9B3A-2D8F0E7C4B15}
+TRACELOGGING_DEFINE_PROVIDER(
+    g_hPerfTraceProvider,
+    "AIPaint",
+    (0x6e2c5a8b, 0x1f4d, 0x4c7e, 0x9b, 0x3a, 0x2d, 0x8f, 0x0e, 0x7c, 0x4b, 0x15));
+
+// --- CPerfMonitor 実装 ---
+
+CPerfMonitor::CPerfMonitor() : m_hasPendingInput(false), m_pendingInputTime(0) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    m_frequency = frequency.QuadPart;
+    for (StageSamples& stage : m_stages) {
+        stage.count = 0;
+        stage.next = 0;
+    }
+}
+
+void CPerfMonitor::Register() {
+    TraceLoggingRegister(g_hPerfTraceProvider);
+}
+
+void CPerfMonitor::Unregister() {
+    TraceLoggingUnregister(g_hPerfTraceProvider);
+}
+
+LONGLONG CPerfMonitor::Now() const {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+void CPerfMonitor::Record(PerfStage stage, double ms) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        StageSamples& samples = m_stages[(int)stage];
+        samples.samples[samples.next] = ms;
+        samples.next = (samples.next + 1) % WindowSize;
+        if (samples.count < WindowSize) ++samples.count;
+    }
+
+    // プロバイダーが有効でない場合はほぼコストがかからない
+    TraceLoggingWrite(g_hPerfTraceProvider, "StageTiming",
+        TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+        TraceLoggingString(GetStageName(stage), "Stage"),
+        TraceLoggingFloat64(ms, "DurationMs"));
+}
+
+void CPerfMonitor::MarkInput(LONG messageTime) {
+    if (m_hasPendingInput) return;
+
+    // メッセージの時刻 (ミリ秒単位のティック) からキューで待った時間を求め、
+    // 高分解能タイマーの時刻に換算する (精度はティックの分解能に依存する)
+    DWORD queued = GetTickCount() - (DWORD)messageTime;
+    if (queued > 1000) queued = 0; // 時刻が取得できない、または古すぎる場合
+    m_pendingInputTime = Now() - (LONGLONG)queued * m_frequency / 1000;
+    m_hasPendingInput = true;
+}
+
+void CPerfMonitor::MarkPresented() {
+    if (!m_hasPendingInput) return;
+    m_hasPendingInput = false;
+    Record(PerfStage::InputLatency, ToMilliseconds(Now() - m_pendingInputTime));
+}
+
+bool CPerfMonitor::GetSummary(PerfStage stage, double& average, double& maximum) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const StageSamples& samples = m_stages[(int)stage];
+    if (samples.count == 0) return false;
+
+    double sum = 0.0;
+    maximum = 0.0;
+    for (size_t i = 0; i < samples.count; ++i) {
+        sum += samples.samples[i];
+        maximum = max(maximum, samples.samples[i]);
+    }
+    average = sum / samples.count;
+    return true;
+}
+
+const char* CPerfMonitor::GetStageName(PerfStage stage) {
+    switch (stage) {
+    case PerfStage::Input: return "Input";
+    case PerfStage::Finalize: return "Finalize";
+    case PerfStage::Complement: return "Complement";
+    case PerfStage::DrawCommitted: return "DrawAll";
+    case PerfStage::DrawLive: return "DrawLive";
+    case PerfStage::DrawPreview: return "Preview";
+    case PerfStage::EndDraw: return "EndDraw";
+    case PerfStage::Present: return "Present";
+    case PerfStage::Paint: return "Paint";
+    case PerfStage::InputLatency: return "Input->Present";
+    default: return "Unknown";
+    }
+}
+
+
+// --- CPerfOverlay 実装 ---
+
+static const float PerfOverlayLineHeight = 15.0f;
+static const float PerfOverlayMargin = 8.0f;
+static const float PerfOverlayWidth = 280.0f;
+
+CPerfOverlay::~CPerfOverlay() {
+    if (m_pTextFormat) m_pTextFormat->Release();
+    if (m_pDWriteFactory) m_pDWriteFactory->Release();
+}
+
+HRESULT CPerfOverlay::CreateTextFormat() {
+    if (m_pTextFormat) return S_OK;
+
+    HRESULT hr = S_OK;
+    if (!m_pDWriteFactory) {
+        hr = DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory),
+            reinterpret_cast<IUnknown**>(&m_pDWriteFactory));
+    }
+    if (SUCCEEDED(hr)) {
+        hr = m_pDWriteFactory->CreateTextFormat(L"Consolas", nullptr, DWRITE_FONT_WEIGHT_NORMAL,
+            DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 12.0f, L"", &m_pTextFormat);
+    }
+    if (SUCCEEDED(hr)) {
+        m_pTextFormat->SetWordWrapping(DWRITE_WORD_WRAPPING_NO_WRAP);
+    }
+    return hr;
+}
+
+D2D1_RECT_F CPerfOverlay::GetBounds() const {
+    float height = PerfOverlayLineHeight * ((int)PerfStage::Count + 1) + PerfOverlayMargin * 2.0f;
+    return D2D1::RectF(PerfOverlayMargin, PerfOverlayMargin,
+        PerfOverlayMargin + PerfOverlayWidth, PerfOverlayMargin + height);
+}
+
+void CPerfOverlay::Draw(CRenderContext& ctx, const CPerfMonitor& monitor) {
+    if (!m_visible || FAILED(CreateTextFormat())) return;
+
+    ID2D1SolidColorBrush* pBackground = ctx.GetBrush(D2D1::ColorF(0.0f, 0.0f, 0.0f, 0.7f));
+    ID2D1SolidColorBrush* pText = ctx.GetBrush(D2D1::ColorF(1.0f, 1.0f, 1.0f, 1.0f));
+    if (!pBackground || !pText) return;
+
+    ID2D1RenderTarget* pRT = ctx.GetTarget();
+    D2D1_RECT_F bounds = GetBounds();
+    pRT->FillRectangle(bounds, pBackground);
+
+    // 1行目は見出し、以降は段階ごとの直近の平均と最大
+    D2D1_RECT_F line = D2D1::RectF(bounds.left + PerfOverlayMargin, bounds.top + PerfOverlayMargin,
+        bounds.right - PerfOverlayMargin, bounds.top + PerfOverlayMargin + PerfOverlayLineHeight);
+    wchar_t text[96];
+    int length = swprintf(text, ARRAYSIZE(text), L"%-16s %8s %8s", L"stage (ms)", L"avg", L"max");
+    pRT->DrawText(text, (UINT32)max(length, 0), m_pTextFormat, line, pText);
+
+    for (int i = 0; i < (int)PerfStage::Count; ++i) {
+        line.top += PerfOverlayLineHeight;
+        line.bottom += PerfOverlayLineHeight;
+
+        PerfStage stage = (PerfStage)i;
+        double average = 0.0, maximum = 0.0;
+        if (monitor.GetSummary(stage, average, maximum)) {
+            length = swprintf(text, ARRAYSIZE(text), L"%-16hs %8.3f %8.3f", CPerfMonitor::GetStageName(stage), average, maximum);
+        }
+        else {
+            length = swprintf(text, ARRAYSIZE(text), L"%-16hs %8s %8s", CPerfMonitor::GetStageName(stage), L"-", L"-");
+        }
+        pRT->DrawText(text, (UINT32)max(length, 0), m_pTextFormat, line, pText);
+    }
+}
@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <d2d1.h>
+#include <dwrite.h>
+#include <mutex>
+#include "DrawingObject.h"
+
+// --- 計測する処理段階 ---
+enum class PerfStage : int {
+    Input,          // WM_MOUSEMOVE の点の追加
+    Finalize,       // WM_LBUTTONUP のストローク確定
+    Complement,     // 補完判定 (ワーカースレッド)
+    DrawCommitted,  // 確定済みオブジェクトの描画 (タイルの更新、または DrawAll)
+    DrawLive,       // 入力中のストロークの描画
+    DrawPreview,    // 補完プレビューの描画
+    EndDraw,
+    Present,
+    Paint,          // OnPaint 全体
+    InputLatency,   // 入力メッセージの時刻から Present 完了まで
+    Count
+};
+
+// --- 処理時間の計測 ---
+// 段階ごとに直近の計測値を保持し、同じ値を TraceLogging (ETW) のイベントとしても出力する
+// (WPA や GPUView で "AIPaint" プロバイダーを有効にすると、再ビルドせずに収集できる)
+class CPerfMonitor {
+public:
+    static const size_t WindowSize = 120; // 平均・最大を求める直近の計測数
+
+private:
+    struct StageSamples {
+        double samples[WindowSize];
+        size_t count;
+        size_t next;
+    };
+
+    mutable std::mutex m_mutex; // 補完判定のワーカースレッドからも記録される
+    StageSamples m_stages[(int)PerfStage::Count];
+    LONGLONG m_frequency;
+    bool m_hasPendingInput;
+    LONGLONG m_pendingInputTime; // まだ Present されていない最も古い入力の時刻
+
+public:
+    CPerfMonitor();
+
+    // ETW プロバイダーの登録 (プロセスの開始時と終了時に呼ぶ)
+    void Register();
+    void Unregister();
+
+    LONGLONG Now() const;
+    double ToMilliseconds(LONGLONG ticks) const { return (double)ticks * 1000.0 / (double)m_frequency; }
+
+    void Record(PerfStage stage, double ms);
+
+    // 描画が必要になった入力を記録する (messageTime は GetMessageTime の値)
+    void MarkInput(LONG messageTime);
+    // Present の完了時に呼び、保留中の入力からの遅延を記録する
+    void MarkPresented();
+
+    // 直近の計測値の平均と最大 (計測値が無ければ false)
+    bool GetSummary(PerfStage stage, double& average, double& maximum) const;
+
+    static const char* GetStageName(PerfStage stage);
+};
+
+// --- スコープの処理時間を記録するタイマー ---
+class CScopedPerfTimer {
+private:
+    CPerfMonitor& m_monitor;
+    PerfStage m_stage;
+    LONGLONG m_start;
+
+public:
+    CScopedPerfTimer(CPerfMonitor& monitor, PerfStage stage)
+        : m_monitor(monitor), m_stage(stage), m_start(monitor.Now()) {}
+    ~CScopedPerfTimer() { m_monitor.Record(m_stage, m_monitor.ToMilliseconds(m_monitor.Now() - m_start)); }
+    CScopedPerfTimer(const CScopedPerfTimer&) = delete;
+    CScopedPerfTimer& operator=(const CScopedPerfTimer&) = delete;
+};
+
+// --- 計測値のオーバーレイ表示 ---
+// キャンバスの左上に段階ごとの平均・最大を描画する
+class CPerfOverlay {
+private:
+    IDWriteFactory* m_pDWriteFactory;
+    IDWriteTextFormat* m_pTextFormat;
+    bool m_visible;
+
+    HRESULT CreateTextFormat();
+
+public:
+    CPerfOverlay() : m_pDWriteFactory(nullptr), m_pTextFormat(nullptr), m_visible(false) {}
+    ~CPerfOverlay();
+    CPerfOverlay(const CPerfOverlay&) = delete;
+    CPerfOverlay& operator=(const CPerfOverlay&) = delete;
+
+    void SetVisible(bool visible) { m_visible = visible; }
+    bool IsVisible() const { return m_visible; }
+
+    // 表示範囲 (DIP)。表示中は描画のたびにこの範囲も描き直す
+    D2D1_RECT_F GetBounds() const;
+
+    void Draw(CRenderContext& ctx, const CPerfMonitor& monitor);
+};
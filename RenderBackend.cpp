@@ -0,0 +1,225 @@
+﻿#include "RenderBackend.h"
+
+#pragma comment(lib, "d3d11.lib")
+
+// --- CRenderBackend 実装 ---
+
+CRenderBackend::CRenderBackend()
+    : m_kind(Kind::None), m_hWnd(NULL), m_waitForVBlank(true),
+      m_pD3DDevice(nullptr), m_pD2DDevice(nullptr), m_pDeviceContext(nullptr),
+      m_pSwapChain(nullptr), m_pTargetBitmap(nullptr), m_needsFullPresent(true),
+      m_pHwndTarget(nullptr) {
+}
+
+HRESULT CRenderBackend::Create(HWND hWnd, ID2D1Factory* pFactory, bool preferDeviceContext, bool waitForVBlank) {
+    Discard();
+    m_hWnd = hWnd;
+    m_waitForVBlank = waitForVBlank;
+
+    RECT rc;
+    GetClientRect(hWnd, &rc);
+    UINT width = (UINT)(rc.right - rc.left);
+    UINT height = (UINT)(rc.bottom - rc.top);
+
+    if (preferDeviceContext) {
+        HRESULT hr = CreateDeviceContextBackend(pFactory, width, height);
+        if (SUCCEEDED(hr)) {
+            m_kind = Kind::DeviceContext;
+            return S_OK;
+        }
+        Discard();
+        m_hWnd = hWnd;
+    }
+
+    HRESULT hr = CreateHwndBackend(pFactory, width, height);
+    if (SUCCEEDED(hr)) {
+        m_kind = Kind::HwndRenderTarget;
+    }
+    return hr;
+}
+
+HRESULT CRenderBackend::CreateDeviceContextBackend(ID2D1Factory* pFactory, UINT width, UINT height) {
+    // Direct2D 1.1 のファクトリが必要
+    ID2D1Factory1* pFactory1 = nullptr;
+    HRESULT hr = pFactory->QueryInterface(__uuidof(ID2D1Factory1), (void**)&pFactory1);
+    if (FAILED(hr)) return hr;
+
+    // 1. D3D11 デバイス (ハードウェアが使えない場合は WARP)
+    const D3D_FEATURE_LEVEL levels[] = {
+        D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0,
+        D3D_FEATURE_LEVEL_10_1, D3D_FEATURE_LEVEL_10_0,
+        D3D_FEATURE_LEVEL_9_3, D3D_FEATURE_LEVEL_9_2, D3D_FEATURE_LEVEL_9_1,
+    };
+    const UINT levelCount = sizeof(levels) / sizeof(levels[0]);
+    hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, NULL, D3D11_CREATE_DEVICE_BGRA_SUPPORT,
+        levels, levelCount, D3D11_SDK_VERSION, &m_pD3DDevice, nullptr, nullptr);
+    if (hr == E_INVALIDARG) {
+        // 11_1 を知らないランタイム向けに再試行
+        hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, NULL, D3D11_CREATE_DEVICE_BGRA_SUPPORT,
+            levels + 1, levelCount - 1, D3D11_SDK_VERSION, &m_pD3DDevice, nullptr, nullptr);
+    }
+    if (FAILED(hr)) {
+        hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_WARP, NULL, D3D11_CREATE_DEVICE_BGRA_SUPPORT,
+            levels + 1, levelCount - 1, D3D11_SDK_VERSION, &m_pD3DDevice, nullptr, nullptr);
+    }
+
+    // 2. D2D デバイスとデバイスコンテキスト
+    IDXGIDevice* pDxgiDevice = nullptr;
+    if (SUCCEEDED(hr)) {
+        hr = m_pD3DDevice->QueryInterface(__uuidof(IDXGIDevice), (void**)&pDxgiDevice);
+    }
+    if (SUCCEEDED(hr)) {
+        hr = pFactory1->CreateDevice(pDxgiDevice, &m_pD2DDevice);
+    }
+    if (SUCCEEDED(hr)) {
+        hr = m_pD2DDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, &m_pDeviceContext);
+    }
+
+    // 3. フリップモデルのスワップチェーン
+    IDXGIAdapter* pAdapter = nullptr;
+    IDXGIFactory2* pDxgiFactory = nullptr;
+    if (SUCCEEDED(hr)) {
+        hr = pDxgiDevice->GetAdapter(&pAdapter);
+    }
+    if (SUCCEEDED(hr)) {
+        hr = pAdapter->GetParent(__uuidof(IDXGIFactory2), (void**)&pDxgiFactory);
+    }
+    if (SUCCEEDED(hr)) {
+        DXGI_SWAP_CHAIN_DESC1 desc = {};
+        desc.Width = width;
+        desc.Height = height;
+        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.SampleDesc.Count = 1;
+        desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+        desc.BufferCount = 2;
+        desc.Scaling = DXGI_SCALING_NONE;
+        desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+        desc.AlphaMode = DXGI_ALPHA_MODE_IGNORE;
+
+        hr = pDxgiFactory->CreateSwapChainForHwnd(m_pD3DDevice, m_hWnd, &desc, nullptr, nullptr, &m_pSwapChain);
+        if (FAILED(hr)) {
+            // FLIP_DISCARD は Windows 10 以降のため、古い環境では FLIP_SEQUENTIAL で再試行
+            desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+            hr = pDxgiFactory->CreateSwapChainForHwnd(m_pD3DDevice, m_hWnd, &desc, nullptr, nullptr, &m_pSwapChain);
+        }
+        if (SUCCEEDED(hr)) {
+            pDxgiFactory->MakeWindowAssociation(m_hWnd, DXGI_MWA_NO_ALT_ENTER);
+        }
+    }
+
+    if (pDxgiFactory) pDxgiFactory->Release();
+    if (pAdapter) pAdapter->Release();
+    if (pDxgiDevice) pDxgiDevice->Release();
+
+    // 4. バックバッファを描画先に設定 (HwndRenderTarget と同じくデスクトップの DPI を使う)
+    if (SUCCEEDED(hr)) {
+        FLOAT dpiX = 96.0f, dpiY = 96.0f;
+        pFactory->GetDesktopDpi(&dpiX, &dpiY);
+        m_pDeviceContext->SetDpi(dpiX, dpiY);
+        hr = CreateTargetBitmap();
+    }
+
+    pFactory1->Release();
+    return hr;
+}
+
+HRESULT CRenderBackend::CreateTargetBitmap() {
+    IDXGISurface* pSurface = nullptr;
+    HRESULT hr = m_pSwapChain->GetBuffer(0, __uuidof(IDXGISurface), (void**)&pSurface);
+    if (SUCCEEDED(hr)) {
+        FLOAT dpiX = 96.0f, dpiY = 96.0f;
+        m_pDeviceContext->GetDpi(&dpiX, &dpiY);
+        D2D1_BITMAP_PROPERTIES1 props = D2D1::BitmapProperties1(
+            D2D1_BITMAP_OPTIONS_TARGET | D2D1_BITMAP_OPTIONS_CANNOT_DRAW,
+            D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE),
+            dpiX, dpiY
+        );
+        hr = m_pDeviceContext->CreateBitmapFromDxgiSurface(pSurface, &props, &m_pTargetBitmap);
+        pSurface->Release();
+    }
+    if (SUCCEEDED(hr)) {
+        m_pDeviceContext->SetTarget(m_pTargetBitmap);
+        m_needsFullPresent = true;
+    }
+    return hr;
+}
+
+HRESULT CRenderBackend::CreateHwndBackend(ID2D1Factory* pFactory, UINT width, UINT height) {
+    // 部分再描画のため、Present後もバックバッファの内容を保持する
+    // 垂直同期を別に待つ場合は Present で待たない
+    D2D1_PRESENT_OPTIONS presentOptions = D2D1_PRESENT_OPTIONS_RETAIN_CONTENTS;
+    if (!m_waitForVBlank) {
+        presentOptions = (D2D1_PRESENT_OPTIONS)(presentOptions | D2D1_PRESENT_OPTIONS_IMMEDIATELY);
+    }
+    return pFactory->CreateHwndRenderTarget(
+        D2D1::RenderTargetProperties(),
+        D2D1::HwndRenderTargetProperties(m_hWnd, D2D1::SizeU(width, height), presentOptions),
+        &m_pHwndTarget
+    );
+}
+
+void CRenderBackend::Discard() {
+    if (m_pDeviceContext) m_pDeviceContext->SetTarget(nullptr);
+    if (m_pTargetBitmap) { m_pTargetBitmap->Release(); m_pTargetBitmap = nullptr; }
+    if (m_pSwapChain) { m_pSwapChain->Release(); m_pSwapChain = nullptr; }
+    if (m_pDeviceContext) { m_pDeviceContext->Release(); m_pDeviceContext = nullptr; }
+    if (m_pD2DDevice) { m_pD2DDevice->Release(); m_pD2DDevice = nullptr; }
+    if (m_pD3DDevice) { m_pD3DDevice->Release(); m_pD3DDevice = nullptr; }
+    if (m_pHwndTarget) { m_pHwndTarget->Release(); m_pHwndTarget = nullptr; }
+    m_kind = Kind::None;
+}
+
+ID2D1RenderTarget* CRenderBackend::GetTarget() const {
+    if (m_kind == Kind::DeviceContext) return m_pDeviceContext;
+    if (m_kind == Kind::HwndRenderTarget) return m_pHwndTarget;
+    return nullptr;
+}
+
+HRESULT CRenderBackend::Resize(UINT width, UINT height) {
+    if (m_kind == Kind::HwndRenderTarget) {
+        return m_pHwndTarget->Resize(D2D1::SizeU(width, height));
+    }
+    if (m_kind != Kind::DeviceContext) return S_OK;
+
+    // バックバッファへの参照をすべて外してからリサイズする
+    m_pDeviceContext->SetTarget(nullptr);
+    if (m_pTargetBitmap) {
+        m_pTargetBitmap->Release();
+        m_pTargetBitmap = nullptr;
+    }
+
+    HRESULT hr = m_pSwapChain->ResizeBuffers(0, width, height, DXGI_FORMAT_UNKNOWN, 0);
+    if (SUCCEEDED(hr)) {
+        hr = CreateTargetBitmap();
+    }
+    if (hr == DXGI_ERROR_DEVICE_REMOVED || hr == DXGI_ERROR_DEVICE_RESET) {
+        hr = D2DERR_RECREATE_TARGET;
+    }
+    return hr;
+}
+
+HRESULT CRenderBackend::Present(const RECT* pDirty) {
+    // HwndRenderTarget は EndDraw で表示まで行う
+    if (m_kind != Kind::DeviceContext) return S_OK;
+
+    DXGI_PRESENT_PARAMETERS params = {};
+    RECT dirty = { 0 };
+    if (pDirty && !m_needsFullPresent) {
+        // 変化した範囲を DWM に伝える (バックバッファ自体は全体を描画済み)
+        RECT rcClient;
+        GetClientRect(m_hWnd, &rcClient);
+        if (IntersectRect(&dirty, pDirty, &rcClient)) {
+            params.DirtyRectsCount = 1;
+            params.pDirtyRects = &dirty;
+        }
+    }
+
+    HRESULT hr = m_pSwapChain->Present1(m_waitForVBlank ? 1 : 0, 0, &params);
+    if (hr == DXGI_ERROR_DEVICE_REMOVED || hr == DXGI_ERROR_DEVICE_RESET) {
+        return D2DERR_RECREATE_TARGET;
+    }
+    if (SUCCEEDED(hr)) {
+        m_needsFullPresent = false;
+    }
+    return hr;
+}
@@ -0,0 +1,58 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <d2d1_1.h>
+#include <d3d11.h>
+#include <dxgi1_2.h>
+
+// --- ウィンドウ描画のバックエンド ---
+// D3D11 デバイス上の ID2D1DeviceContext とフリップモデルのスワップチェーンで描画する
+// 作成できない環境 (Direct2D 1.1 非対応など) では ID2D1HwndRenderTarget にフォールバックする
+class CRenderBackend {
+public:
+    enum class Kind { None, DeviceContext, HwndRenderTarget };
+
+private:
+    Kind m_kind;
+    HWND m_hWnd;
+    bool m_waitForVBlank; // Present で垂直同期を待つか
+
+    // DeviceContext 経路
+    ID3D11Device* m_pD3DDevice;
+    ID2D1Device* m_pD2DDevice;
+    ID2D1DeviceContext* m_pDeviceContext;
+    IDXGISwapChain1* m_pSwapChain;
+    ID2D1Bitmap1* m_pTargetBitmap; // バックバッファを指すターゲット
+    bool m_needsFullPresent;       // 作成・リサイズ直後は部分 Present できない
+
+    // フォールバック経路
+    ID2D1HwndRenderTarget* m_pHwndTarget;
+
+    HRESULT CreateDeviceContextBackend(ID2D1Factory* pFactory, UINT width, UINT height);
+    HRESULT CreateHwndBackend(ID2D1Factory* pFactory, UINT width, UINT height);
+    HRESULT CreateTargetBitmap();
+
+public:
+    CRenderBackend();
+    ~CRenderBackend() { Discard(); }
+    CRenderBackend(const CRenderBackend&) = delete;
+    CRenderBackend& operator=(const CRenderBackend&) = delete;
+
+    // preferDeviceContext が false の場合は常に HwndRenderTarget を使う
+    HRESULT Create(HWND hWnd, ID2D1Factory* pFactory, bool preferDeviceContext, bool waitForVBlank);
+    void Discard();
+
+    bool IsCreated() const { return m_kind != Kind::None; }
+    Kind GetKind() const { return m_kind; }
+    ID2D1RenderTarget* GetTarget() const;
+    ID2D1DeviceContext* GetDeviceContext() const { return m_pDeviceContext; } // フォールバック時は nullptr
+
+    // Present 後もバックバッファの内容が残るか (残らない場合は毎フレーム全体を描画する)
+    bool PreservesContents() const { return m_kind == Kind::HwndRenderTarget; }
+
+    HRESULT Resize(UINT width, UINT height);
+
+    // EndDraw の後に呼び出す。pDirty は前回から変化した範囲 (nullptr で全体)
+    // デバイスが失われた場合は D2DERR_RECREATE_TARGET を返す
+    HRESULT Present(const RECT* pDirty);
+};
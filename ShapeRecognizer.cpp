@@ -0,0 +1,530 @@
+﻿#include "ShapeRecognizer.h"
+#include "BezierFit.h"
+
+// === ヘルパー関数: 3次方程式 λ^3 + a λ^2 + b λ + c = 0 の実数解 ===
+static int SolveCubic(double a, double b, double c, double roots[3]) {
+    const double PI = 3.14159265358979323846;
+    double q = (a * a - 3.0 * b) / 9.0;
+    double r = (2.0 * a * a * a - 9.0 * a * b + 27.0 * c) / 54.0;
+    double q3 = q * q * q;
+
+    if (r * r < q3) {
+        double theta = std::acos(max(-1.0, min(1.0, r / std::sqrt(q3))));
+        double m = -2.0 * std::sqrt(q);
+        roots[0] = m * std::cos(theta / 3.0) - a / 3.0;
+        roots[1] = m * std::cos((theta + 2.0 * PI) / 3.0) - a / 3.0;
+        roots[2] = m * std::cos((theta - 2.0 * PI) / 3.0) - a / 3.0;
+        return 3;
+    }
+
+    double A = -std::cbrt(r + (r < 0.0 ? -1.0 : 1.0) * std::sqrt(r * r - q3));
+    double B = (A != 0.0) ? q / A : 0.0;
+    roots[0] = (A + B) - a / 3.0;
+    return 1;
+}
+
+// === ヘルパー関数: 3x3 行列の固有値 lambda に対する固有ベクトル ===
+static bool EigenVector3(const double m[3][3], double lambda, double out[3]) {
+    double rows[3][3];
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            rows[r][c] = m[r][c] - (r == c ? lambda : 0.0);
+        }
+    }
+
+    // (M - λI) の2行の外積のうち、最も大きいものを零空間の基底とする
+    double best = 0.0;
+    for (int p = 0; p < 3; ++p) {
+        const double* u = rows[p];
+        const double* v = rows[(p + 1) % 3];
+        double cross[3] = {
+            u[1] * v[2] - u[2] * v[1],
+            u[2] * v[0] - u[0] * v[2],
+            u[0] * v[1] - u[1] * v[0],
+        };
+        double normSq = cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2];
+        if (normSq > best) {
+            best = normSq;
+            out[0] = cross[0];
+            out[1] = cross[1];
+            out[2] = cross[2];
+        }
+    }
+    return best > 0.0;
+}
+
+// === ヘルパー関数: 3x3 行列の逆行列 ===
+static bool Invert3(const double m[3][3], double out[3][3]) {
+    double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+        - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+        + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    if (std::abs(det) < 1e-12) return false;
+
+    double inv = 1.0 / det;
+    out[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv;
+    out[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv;
+    out[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv;
+    out[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv;
+    out[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv;
+    out[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv;
+    out[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv;
+    out[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv;
+    out[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv;
+    return true;
+}
+
+// === ヘルパー関数: 楕円フィッティング (直接最小二乗法) ===
+// Fitzgibbon の楕円制約付き最小二乗法を Halir-Flusser の分割形式で解く。
+// 散布行列は累積済みのモーメントから組み立てるため、点列を走査しない。
+// outRotation には楕円のx軸からの回転角 (度) を返す。
+static const int MaxMomentOrder = CStrokeMoments::MaxOrder;
+
+bool FitEllipse(const CStrokeMoments& moments, float tolerance, D2D1_ELLIPSE& outEllipse, float& outRotation, float* outPixelError) {
+    size_t n = moments.GetCount();
+    if (n < 5) return false;
+
+    // 1. 重心と平均半径で座標を正規化し、散布行列の条件数を抑える
+    double count = (double)n;
+    double mx = moments.Sum(1, 0) / count;
+    double my = moments.Sum(0, 1) / count;
+    double spread = (moments.CenteredSum(2, 0, mx, my) + moments.CenteredSum(0, 2, mx, my)) / (2.0 * count);
+    if (spread <= 1e-6) return false;
+    double scale = std::sqrt(spread);
+
+    double M[MaxMomentOrder + 1][MaxMomentOrder + 1] = { { 0 } };
+    for (int a = 0; a <= MaxMomentOrder; ++a) {
+        for (int b = 0; a + b <= MaxMomentOrder; ++b) {
+            M[a][b] = moments.CenteredSum(a, b, mx, my) / std::pow(scale, a + b);
+        }
+    }
+
+    // 2. 散布行列 S = [S1 S2; S2^T S3] (設計行列の列は u^2, uv, v^2, u, v, 1)
+    double S1[3][3] = {
+        { M[4][0], M[3][1], M[2][2] },
+        { M[3][1], M[2][2], M[1][3] },
+        { M[2][2], M[1][3], M[0][4] },
+    };
+    double S2[3][3] = {
+        { M[3][0], M[2][1], M[2][0] },
+        { M[2][1], M[1][2], M[1][1] },
+        { M[1][2], M[0][3], M[0][2] },
+    };
+    double S3[3][3] = {
+        { M[2][0], M[1][1], M[1][0] },
+        { M[1][1], M[0][2], M[0][1] },
+        { M[1][0], M[0][1], M[0][0] },
+    };
+
+    // 3. 線形項を消去: T = -S3^-1 S2^T, 縮約行列 = S1 + S2 T
+    double S3inv[3][3];
+    if (!Invert3(S3, S3inv)) return false;
+
+    double T[3][3];
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            double sum = 0.0;
+            for (int k = 0; k < 3; ++k) sum += S3inv[r][k] * S2[c][k];
+            T[r][c] = -sum;
+        }
+    }
+
+    double R[3][3];
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            double sum = S1[r][c];
+            for (int k = 0; k < 3; ++k) sum += S2[r][k] * T[k][c];
+            R[r][c] = sum;
+        }
+    }
+
+    // 楕円制約 4ac - b^2 = 1 の制約行列 C1 の逆を左から掛ける
+    double E[3][3];
+    for (int c = 0; c < 3; ++c) {
+        E[0][c] = R[2][c] / 2.0;
+        E[1][c] = -R[1][c];
+        E[2][c] = R[0][c] / 2.0;
+    }
+
+    // 4. 固有ベクトルのうち 4ac - b^2 > 0 を満たすものが解
+    double trace = E[0][0] + E[1][1] + E[2][2];
+    double minorSum = (E[0][0] * E[1][1] - E[0][1] * E[1][0])
+        + (E[0][0] * E[2][2] - E[0][2] * E[2][0])
+        + (E[1][1] * E[2][2] - E[1][2] * E[2][1]);
+    double det = E[0][0] * (E[1][1] * E[2][2] - E[1][2] * E[2][1])
+        - E[0][1] * (E[1][0] * E[2][2] - E[1][2] * E[2][0])
+        + E[0][2] * (E[1][0] * E[2][1] - E[1][1] * E[2][0]);
+
+    double roots[3];
+    int rootCount = SolveCubic(-trace, minorSum, -det, roots);
+
+    double a1[3] = { 0 };
+    bool found = false;
+    for (int k = 0; k < rootCount && !found; ++k) {
+        double v[3];
+        if (!EigenVector3(E, roots[k], v)) continue;
+        if (4.0 * v[0] * v[2] - v[1] * v[1] > 0.0) {
+            a1[0] = v[0]; a1[1] = v[1]; a1[2] = v[2];
+            found = true;
+        }
+    }
+    if (!found) return false;
+
+    double a2[3];
+    for (int r = 0; r < 3; ++r) {
+        a2[r] = T[r][0] * a1[0] + T[r][1] * a1[1] + T[r][2] * a1[2];
+    }
+
+    // 5. 円錐曲線 A u^2 + B uv + C v^2 + D u + E v + F = 0 から中心・半径・回転角を求める
+    double A = a1[0], B = a1[1], C = a1[2];
+    double D = a2[0], Ec = a2[1], F = a2[2];
+
+    double denom = 4.0 * A * C - B * B;
+    if (denom <= 1e-12) return false;
+    double u0 = (B * Ec - 2.0 * C * D) / denom;
+    double v0 = (B * D - 2.0 * A * Ec) / denom;
+    double F0 = A * u0 * u0 + B * u0 * v0 + C * v0 * v0 + D * u0 + Ec * v0 + F;
+    if (std::abs(F0) < 1e-12) return false;
+
+    // 二次形式 [[A, B/2], [B/2, C]] の固有値が主軸方向の係数
+    double halfDiff = (A - C) / 2.0;
+    double radius = std::sqrt(halfDiff * halfDiff + B * B / 4.0);
+    double lambda1 = (A + C) / 2.0 + radius;
+    double lambda2 = (A + C) / 2.0 - radius;
+    if (-F0 / lambda1 <= 0.0 || -F0 / lambda2 <= 0.0) return false;
+
+    // λ1 (大きい固有値 = 短軸) 方向の角度。長軸はこれと直交するため、下で 90度を加える
+    double theta = 0.5 * std::atan2(B, A - C);
+    double radiusMajor = std::sqrt(-F0 / lambda2) * scale;
+    double radiusMinor = std::sqrt(-F0 / lambda1) * scale;
+
+    // 楕円が小さすぎる場合は無視
+    if (radiusMajor < 10.0 || radiusMinor < 10.0) return false;
+
+    const double PI = 3.14159265358979323846;
+    D2D1_POINT_2F origin = moments.GetOrigin();
+    outEllipse.point = D2D1::Point2F(
+        (float)(origin.x + mx + u0 * scale),
+        (float)(origin.y + my + v0 * scale)
+    );
+    // 回転角は長軸を基準にするため、(theta + 90度) 方向の軸を radiusX とする
+    outEllipse.radiusX = (float)radiusMajor;
+    outEllipse.radiusY = (float)radiusMinor;
+    outRotation = (float)((theta + PI / 2.0) * 180.0 / PI);
+
+    // 6. 適合度の判定
+    // 正規化偏差 d = -Q(u,v) / F0 の二乗和は a^T S a / F0^2 で求まる
+    double residual = 0.0;
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            residual += a1[r] * S1[r][c] * a1[c];
+            residual += 2.0 * a1[r] * S2[r][c] * a2[c];
+            residual += a2[r] * S3[r][c] * a2[c];
+        }
+    }
+    double rmsDeviation = std::sqrt(max(0.0, residual) / (F0 * F0) / count);
+
+    // d はおよそ半径の相対誤差の2倍なので、平均半径を掛けて画素単位の誤差に換算
+    double pixelError = rmsDeviation * (radiusMajor + radiusMinor) / 4.0;
+    if (pixelError > tolerance) return false;
+    if (outPixelError) *outPixelError = (float)pixelError;
+
+    // ほぼ閉じたストロークのみ楕円とみなす (円弧を楕円に補完しない)
+    D2D1_POINT_2F last = moments.GetLast();
+    double gapX = (double)last.x - origin.x;
+    double gapY = (double)last.y - origin.y;
+    return std::sqrt(gapX * gapX + gapY * gapY) < (radiusMajor + radiusMinor) / 2.0;
+}
+// ===================================
+
+
+// === ヘルパー関数: 2点間の距離 ===
+static float Distance(D2D1_POINT_2F a, D2D1_POINT_2F b) {
+    float dx = b.x - a.x;
+    float dy = b.y - a.y;
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+// === ヘルパー関数: 頂点 i での2辺のなす角の余弦 (閉じた多角形として前後の頂点を取る) ===
+static float CornerCosine(const std::vector<D2D1_POINT_2F>& vertices, size_t i) {
+    size_t count = vertices.size();
+    D2D1_POINT_2F prev = vertices[(i + count - 1) % count];
+    D2D1_POINT_2F next = vertices[(i + 1) % count];
+    D2D1_POINT_2F p = vertices[i];
+    float ax = prev.x - p.x, ay = prev.y - p.y;
+    float bx = next.x - p.x, by = next.y - p.y;
+    float la = std::sqrt(ax * ax + ay * ay);
+    float lb = std::sqrt(bx * bx + by * by);
+    if (la <= 0.0f || lb <= 0.0f) return -1.0f; // 重なった頂点は直線上とみなす
+    return (ax * bx + ay * by) / (la * lb);
+}
+
+
+// --- CRecognitionContext 実装 ---
+
+CRecognitionContext::CRecognitionContext(const CFreehandStroke& stroke)
+    : m_stroke(stroke), m_moments(stroke.GetMoments()), m_count(stroke.GetMoments().GetCount()),
+      m_hasPoints(false), m_hasCorners(false) {
+    D2D1_RECT_F bounds = m_moments.GetBounds();
+    float width = bounds.right - bounds.left;
+    float height = bounds.bottom - bounds.top;
+    m_diagonal = std::sqrt(width * width + height * height);
+
+    // 始点 (モーメントの原点) と終点を結ぶ直線からの距離の二乗平均を求める
+    D2D1_POINT_2F start = m_moments.GetOrigin();
+    D2D1_POINT_2F end = m_moments.GetLast();
+    m_closureGap = Distance(start, end);
+    m_lineTolerance = stroke.GetStrokeWidth() * 2.0f;
+
+    double dx = (double)end.x - start.x;
+    double dy = (double)end.y - start.y;
+    double L = std::sqrt(dx * dx + dy * dy);
+    double sumXX = m_moments.Sum(2, 0);
+    double sumXY = m_moments.Sum(1, 1);
+    double sumYY = m_moments.Sum(0, 2);
+    double meanSqDistance;
+    if (L > stroke.GetStrokeWidth()) {
+        double nx = -dy / L;
+        double ny = dx / L;
+        meanSqDistance = (nx * nx * sumXX + 2.0 * nx * ny * sumXY + ny * ny * sumYY) / (double)m_count;
+    }
+    else {
+        // 始点と終点がほぼ一致する (閉じた) ストロークは始点からの距離で評価
+        meanSqDistance = (sumXX + sumYY) / (double)m_count;
+    }
+
+    // 二乗平均から最大偏差を概算 (緩やかな弧ではおよそ 1.4 倍)
+    m_lineDeviation = (float)(std::sqrt(max(0.0, meanSqDistance)) * 1.4);
+}
+
+const std::vector<D2D1_POINT_2F>& CRecognitionContext::GetPoints() const {
+    if (!m_hasPoints) {
+        m_points.reserve(m_stroke.GetPointCount());
+        m_stroke.VisitPoints([this](D2D1_POINT_2F p) {
+            m_points.push_back(p);
+            return true;
+        });
+        m_hasPoints = true;
+    }
+    return m_points;
+}
+
+const std::vector<D2D1_POINT_2F>& CRecognitionContext::GetCorners() const {
+    if (!m_hasCorners) {
+        SimplifyPolyline(GetPoints(), GetCornerTolerance(), m_corners);
+        m_hasCorners = true;
+    }
+    return m_corners;
+}
+
+float CRecognitionContext::MaxDeviation(const std::vector<D2D1_POINT_2F>& vertices, bool isClosed) const {
+    if (vertices.empty()) return 0.0f;
+
+    size_t segmentCount = isClosed ? vertices.size() : vertices.size() - 1;
+    float maxDeviation = 0.0f;
+    for (const D2D1_POINT_2F& p : GetPoints()) {
+        float nearest = Distance(p, vertices[0]);
+        for (size_t i = 0; i < segmentCount; ++i) {
+            nearest = min(nearest, DistanceToSegment(p, vertices[i], vertices[(i + 1) % vertices.size()]));
+        }
+        maxDeviation = max(maxDeviation, nearest);
+    }
+    return maxDeviation;
+}
+
+float CRecognitionContext::MaxLineDeviation() const {
+    D2D1_POINT_2F start = m_moments.GetOrigin();
+    D2D1_POINT_2F end = m_moments.GetLast();
+    float dx = end.x - start.x;
+    float dy = end.y - start.y;
+    float L = std::sqrt(dx * dx + dy * dy);
+
+    float maxDeviation = 0.0f;
+    for (const D2D1_POINT_2F& p : GetPoints()) {
+        // 閉じたストロークは GetLineDeviation と同じく始点からの距離で評価
+        float distance = L > m_stroke.GetStrokeWidth()
+            ? std::abs(dx * (p.y - start.y) - dy * (p.x - start.x)) / L
+            : Distance(p, start);
+        maxDeviation = max(maxDeviation, distance);
+    }
+    return maxDeviation;
+}
+
+
+// --- 判定器の実装 ---
+
+bool CLineDetector::Accepts(const CRecognitionContext& context) {
+    // 二乗平均は最大偏差を超えないため、二乗平均 (概算の 1 / 1.4) が許容値以上なら直線ではない
+    return context.GetLineDeviation() < context.GetLineTolerance() * 1.4f;
+}
+
+bool CLineDetector::Fit(const CRecognitionContext& context, ShapeCandidate& out) {
+    // 端の短いはね等は二乗平均にほとんど現れないため、最大偏差で確かめる
+    // (確定後の点列は単純化されており、直線に近いストロークでは点が少ない。はねの頂点は単純化でも残る)
+    float deviation = context.MaxLineDeviation();
+    if (deviation >= context.GetLineTolerance()) return false;
+
+    out.shape = CFreehandStroke::ShapeType::Line;
+    out.points.assign({ context.GetMoments().GetOrigin(), context.GetMoments().GetLast() });
+    out.score = 1.0f - deviation / context.GetLineTolerance();
+    return true;
+}
+
+bool CEllipseDetector::Accepts(const CRecognitionContext& context) {
+    // 直線に近いストロークは当てはめない
+    return context.GetCount() >= 5 && context.GetLineDeviation() > 5.0f * context.GetLineTolerance();
+}
+
+bool CEllipseDetector::Fit(const CRecognitionContext& context, ShapeCandidate& out) {
+    const float ELLIPSE_FIT_TOLERANCE = 10.0f;
+    float error = 0.0f;
+    if (!FitEllipse(context.GetMoments(), ELLIPSE_FIT_TOLERANCE, out.ellipse, out.rotation, &error)) return false;
+
+    out.shape = CFreehandStroke::ShapeType::Ellipse;
+    out.score = 1.0f - error / ELLIPSE_FIT_TOLERANCE;
+    return true;
+}
+
+bool CRectangleDetector::Accepts(const CRecognitionContext& context) {
+    return context.GetCount() >= 8 && context.IsClosed() &&
+        context.GetDiagonal() > context.GetStrokeWidth() * 8.0f;
+}
+
+bool CRectangleDetector::Fit(const CRecognitionContext& context, ShapeCandidate& out) {
+    // 1. 単純化した折れ線から角を取り出す
+    // 終点は始点と重なるため除き、辺の途中から書き始めた場合の直線上の頂点も除く
+    std::vector<D2D1_POINT_2F> corners = context.GetCorners();
+    float tolerance = context.GetCornerTolerance();
+    if (corners.size() > 2 && Distance(corners.front(), corners.back()) < tolerance * 2.0f) {
+        corners.pop_back();
+    }
+    for (size_t i = 0; i < corners.size() && corners.size() > 4;) {
+        if (CornerCosine(corners, i) < -0.9f) {
+            corners.erase(corners.begin() + i);
+        }
+        else {
+            ++i;
+        }
+    }
+    if (corners.size() != 4) return false;
+
+    // 2. 角がすべてほぼ直角であること (70～110度)
+    for (size_t i = 0; i < 4; ++i) {
+        if (std::abs(CornerCosine(corners, i)) > 0.35f) return false;
+    }
+
+    // 3. 辺の向きを 90 度周期で平均して回転角を求め、中心からの距離で大きさを決める
+    double sumCos = 0.0, sumSin = 0.0;
+    for (size_t i = 0; i < 4; ++i) {
+        D2D1_POINT_2F a = corners[i];
+        D2D1_POINT_2F b = corners[(i + 1) % 4];
+        double length = Distance(a, b);
+        double angle = std::atan2((double)b.y - a.y, (double)b.x - a.x);
+        sumCos += length * std::cos(4.0 * angle);
+        sumSin += length * std::sin(4.0 * angle);
+    }
+    double theta = std::atan2(sumSin, sumCos) / 4.0;
+    float ux = (float)std::cos(theta), uy = (float)std::sin(theta);
+
+    D2D1_POINT_2F center = D2D1::Point2F(
+        (corners[0].x + corners[1].x + corners[2].x + corners[3].x) / 4.0f,
+        (corners[0].y + corners[1].y + corners[2].y + corners[3].y) / 4.0f);
+    float halfU = 0.0f, halfV = 0.0f;
+    for (const D2D1_POINT_2F& c : corners) {
+        float dx = c.x - center.x;
+        float dy = c.y - center.y;
+        halfU += std::abs(dx * ux + dy * uy) / 4.0f;
+        halfV += std::abs(-dx * uy + dy * ux) / 4.0f;
+    }
+    if (halfU < tolerance || halfV < tolerance) return false;
+
+    out.points = {
+        D2D1::Point2F(center.x - halfU * ux + halfV * uy, center.y - halfU * uy - halfV * ux),
+        D2D1::Point2F(center.x + halfU * ux + halfV * uy, center.y + halfU * uy - halfV * ux),
+        D2D1::Point2F(center.x + halfU * ux - halfV * uy, center.y + halfU * uy + halfV * ux),
+        D2D1::Point2F(center.x - halfU * ux - halfV * uy, center.y - halfU * uy + halfV * ux),
+    };
+
+    // 4. 辺からの最大距離で評価する (角の丸まりや手ぶれを許容する)
+    float deviation = context.MaxDeviation(out.points, true);
+    if (deviation > tolerance * 1.5f) return false;
+
+    out.shape = CFreehandStroke::ShapeType::Rectangle;
+    out.isClosed = true;
+    out.score = 1.0f - deviation / (tolerance * 1.5f);
+    return true;
+}
+
+bool CPolylineDetector::Accepts(const CRecognitionContext& context) {
+    return context.GetCount() >= 3 && context.GetDiagonal() > context.GetStrokeWidth() * 4.0f;
+}
+
+bool CPolylineDetector::Fit(const CRecognitionContext& context, ShapeCandidate& out) {
+    std::vector<D2D1_POINT_2F> vertices = context.GetCorners();
+    float tolerance = context.GetCornerTolerance();
+    bool isClosed = context.IsClosed() && vertices.size() > 3 && Distance(vertices.front(), vertices.back()) < tolerance * 2.0f;
+    if (isClosed) {
+        vertices.pop_back();
+    }
+    if (vertices.size() < 3 || vertices.size() > MaxVertices) return false;
+
+    // 短すぎる辺は手ぶれとみなす
+    size_t segmentCount = isClosed ? vertices.size() : vertices.size() - 1;
+    for (size_t i = 0; i < segmentCount; ++i) {
+        if (Distance(vertices[i], vertices[(i + 1) % vertices.size()]) < tolerance * 2.0f) return false;
+    }
+
+    // 単純化の誤差は常に tolerance 以下になるが、滑らかな曲線を弦で近似した場合は
+    // どの辺でも tolerance 近くまでずれるため、十分小さい場合だけ折れ線とみなす
+    float deviation = context.MaxDeviation(vertices, isClosed);
+    if (deviation > tolerance * 0.6f) return false;
+
+    out.shape = CFreehandStroke::ShapeType::Polyline;
+    out.points = std::move(vertices);
+    out.isClosed = isClosed;
+    out.score = 1.0f - deviation / tolerance;
+    return true;
+}
+
+bool CBezierDetector::Accepts(const CRecognitionContext& context) {
+    // 点列の復号と当てはめは重いため、線幅に比べて小さいストロークは統計量だけで除く
+    return context.GetCount() > 10 && context.GetDiagonal() > context.GetStrokeWidth() * 4.0f;
+}
+
+bool CBezierDetector::Fit(const CRecognitionContext& context, ShapeCandidate& out) {
+    const std::vector<D2D1_POINT_2F>& points = context.GetPoints();
+    float tolerance = max(context.GetStrokeWidth(), 1.0f);
+    if (!FitCubicBeziers(points, tolerance, MaxSegments, out.points)) return false;
+
+    // 制御点が元の点より少なくならなければ置き換える意味がない
+    if (out.points.size() >= points.size()) return false;
+
+    // 許容誤差に収まるまで細かく分割した曲線は、手書きの揺れをなぞっているだけなので置き換えない
+    // (区間の平均の長さが下限に満たないものを除く)
+    size_t segmentCount = (out.points.size() - 1) / 3;
+    float length = 0.0f;
+    for (size_t i = 1; i < points.size(); ++i) {
+        length += Distance(points[i - 1], points[i]);
+    }
+    float minSegmentLength = max(MinSegmentLength, context.GetStrokeWidth() * MinSegmentWidths);
+    float averageLength = length / (float)segmentCount;
+    if (averageLength < minSegmentLength) return false;
+
+    // 区間が少なく、1区間が長いほど滑らかな曲線として優先する
+    out.shape = CFreehandStroke::ShapeType::Curve;
+    out.score = min(1.0f, averageLength / (minSegmentLength * 2.0f)) / (1.0f + 0.1f * (float)(segmentCount - 1));
+    return true;
+}
+
+
+// --- IShapeRecognizer 実装 ---
+
+ShapeCandidate IShapeRecognizer::SelectBest(std::vector<ShapeCandidate>& candidates) {
+    size_t best = candidates.size();
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (best == candidates.size() || candidates[i].score > candidates[best].score) best = i;
+    }
+    if (best == candidates.size()) {
+        return ShapeCandidate{ CFreehandStroke::ShapeType::None, { 0 }, 0.0f, {}, false, 0.0f };
+    }
+    return std::move(candidates[best]);
+}
@@ -0,0 +1,158 @@
+﻿#pragma once
+
+#include <d2d1.h>
+#include <vector>
+#include "DrawingObject.h"
+
+typedef CFreehandStroke::ComplementResult ShapeCandidate;
+
+// 楕円フィッティング (直接最小二乗法)。累積済みのモーメントだけで求める
+// outPixelError には当てはめた楕円からの画素単位の誤差の概算を返す
+bool FitEllipse(const CStrokeMoments& moments, float tolerance, D2D1_ELLIPSE& outEllipse, float& outRotation, float* outPixelError = nullptr);
+
+// --- 形状判定の入力 ---
+// 外接矩形や端点間の距離など O(1) で求まる特徴量は作成時に計算し、判定器の早期棄却に使う
+// 点列を必要とする判定器のために、復号した点列や角の候補は最初に要求されたときだけ求めて共有する
+class CRecognitionContext {
+private:
+    const CFreehandStroke& m_stroke;
+    const CStrokeMoments& m_moments;
+    size_t m_count;
+    float m_diagonal;        // 外接矩形 (線幅を含まない) の対角線の長さ
+    float m_closureGap;      // 始点と終点の距離
+    float m_lineTolerance;   // 直線とみなす最大偏差
+    float m_lineDeviation;   // 始点と終点を結ぶ直線からの最大偏差の概算
+
+    mutable std::vector<D2D1_POINT_2F> m_points;
+    mutable bool m_hasPoints;
+    mutable std::vector<D2D1_POINT_2F> m_corners;
+    mutable bool m_hasCorners;
+
+public:
+    explicit CRecognitionContext(const CFreehandStroke& stroke);
+    CRecognitionContext(const CRecognitionContext&) = delete;
+    CRecognitionContext& operator=(const CRecognitionContext&) = delete;
+
+    const CFreehandStroke& GetStroke() const { return m_stroke; }
+    const CStrokeMoments& GetMoments() const { return m_moments; }
+    size_t GetCount() const { return m_count; }
+    float GetStrokeWidth() const { return m_stroke.GetStrokeWidth(); }
+    float GetDiagonal() const { return m_diagonal; }
+    float GetClosureGap() const { return m_closureGap; }
+    float GetLineTolerance() const { return m_lineTolerance; }
+    float GetLineDeviation() const { return m_lineDeviation; }
+
+    // 始点と終点が外接矩形の大きさに比べて十分近いか
+    bool IsClosed() const { return m_closureGap < max(m_diagonal * 0.2f, m_stroke.GetStrokeWidth() * 4.0f); }
+
+    // 角の検出に使う許容誤差 (線幅と大きさに比例させ、手ぶれを角とみなさない)
+    float GetCornerTolerance() const { return max(m_stroke.GetStrokeWidth() * 2.0f, m_diagonal * 0.04f); }
+
+    // 点列 (符号化済みの点列は復号する)
+    const std::vector<D2D1_POINT_2F>& GetPoints() const;
+    // 点列を GetCornerTolerance で単純化した折れ線の頂点 (端点を含む)
+    const std::vector<D2D1_POINT_2F>& GetCorners() const;
+
+    // 点列から折れ線 (閉じている場合は最後の頂点から先頭へ戻る辺を含む) までの最大距離
+    float MaxDeviation(const std::vector<D2D1_POINT_2F>& vertices, bool isClosed) const;
+    // 点列の始点と終点を結ぶ直線からの最大距離 (GetLineDeviation の概算を点列で確かめる)
+    float MaxLineDeviation() const;
+};
+
+// --- 形状の判定器 ---
+// 判定器は次の静的メンバーを持つ型で、CShapeRecognizerPipeline に並べて使う
+//   Preference       : 適合度に掛ける優先度 (単純な形状ほど大きくする)
+//   ShortCircuitScore: 優先度を掛けた score がこの値以上なら以降の判定器を実行しない
+//   Accepts(context) : 特徴量だけで判定できる安価な早期棄却
+//   Fit(context, out): 当てはめ (適合しない場合は false)
+
+// 直線 (モーメントで早期棄却し、確定後は単純化された点列で確かめる)
+struct CLineDetector {
+    static constexpr float Preference = 1.0f;
+    static constexpr float ShortCircuitScore = 0.0f; // 直線として適合すれば常に確定する
+    static bool Accepts(const CRecognitionContext& context);
+    static bool Fit(const CRecognitionContext& context, ShapeCandidate& out);
+};
+
+// 楕円 (モーメントのみで判定)
+struct CEllipseDetector {
+    static constexpr float Preference = 1.0f;
+    static constexpr float ShortCircuitScore = 0.7f;
+    static bool Accepts(const CRecognitionContext& context);
+    static bool Fit(const CRecognitionContext& context, ShapeCandidate& out);
+};
+
+// 回転を含む矩形 (閉じたストロークの角が4つで、ほぼ直角の場合)
+struct CRectangleDetector {
+    static constexpr float Preference = 1.0f;
+    static constexpr float ShortCircuitScore = 0.7f;
+    static bool Accepts(const CRecognitionContext& context);
+    static bool Fit(const CRecognitionContext& context, ShapeCandidate& out);
+};
+
+// 折れ線 (開いたストロークの角が少数の場合)
+struct CPolylineDetector {
+    static const size_t MaxVertices = 8;
+    static constexpr float Preference = 0.9f;
+    static constexpr float ShortCircuitScore = 0.8f;
+    static bool Accepts(const CRecognitionContext& context);
+    static bool Fit(const CRecognitionContext& context, ShapeCandidate& out);
+};
+
+// 3次ベジェ曲線 (他の形状に適合しない滑らかな曲線)
+// 誤差が線幅以内に収まるように区間を分割し、区間数が多すぎるもの、
+// 長さに比べて区間が多い (細かく曲がっている) ものは曲線とみなさない
+struct CBezierDetector {
+    static const size_t MaxSegments = 32;
+    static constexpr float MinSegmentLength = 40.0f; // 区間の平均の長さの下限
+    static constexpr float MinSegmentWidths = 15.0f; // 区間の平均の長さの下限 (線幅の倍数)
+    static constexpr float Preference = 0.5f;
+    static constexpr float ShortCircuitScore = 1.0f;
+    static bool Accepts(const CRecognitionContext& context);
+    static bool Fit(const CRecognitionContext& context, ShapeCandidate& out);
+};
+
+// --- 形状の認識エンジン ---
+class IShapeRecognizer {
+public:
+    virtual ~IShapeRecognizer() = default;
+
+    // ストロークに適合する形状の候補を candidates に返す (順序は判定器の順)
+    virtual void Recognize(const CFreehandStroke& stroke, std::vector<ShapeCandidate>& candidates) const = 0;
+
+    // 候補のうち最も score の高いもの (同じ場合は先の候補。候補が無ければ ShapeType::None)
+    static ShapeCandidate SelectBest(std::vector<ShapeCandidate>& candidates);
+};
+
+// --- 判定器を並べた認識エンジン ---
+// 判定器の呼び出しはコンパイル時に展開されるため、仮想関数の呼び出しは Recognize の1回だけになる
+// 安価な判定器から順に並べ、確定できた時点で残りの判定器 (点列の走査を伴うもの) を省略する
+template <class... Detectors>
+class CShapeRecognizerPipeline : public IShapeRecognizer {
+private:
+    // 判定器を1つ実行する (以降の判定器を省略する場合は true)
+    template <class Detector>
+    static bool Run(const CRecognitionContext& context, std::vector<ShapeCandidate>& candidates) {
+        if (!Detector::Accepts(context)) return false;
+
+        ShapeCandidate candidate = { CFreehandStroke::ShapeType::None, { 0 }, 0.0f, {}, false, 0.0f };
+        if (!Detector::Fit(context, candidate)) return false;
+
+        candidate.score *= Detector::Preference;
+        bool isConclusive = candidate.score >= Detector::ShortCircuitScore;
+        candidates.push_back(std::move(candidate));
+        return isConclusive;
+    }
+
+public:
+    void Recognize(const CFreehandStroke& stroke, std::vector<ShapeCandidate>& candidates) const override {
+        candidates.clear();
+        if (stroke.GetMoments().GetCount() < 2) return;
+
+        CRecognitionContext context(stroke);
+        (Run<Detectors>(context, candidates) || ...);
+    }
+};
+
+// 既定の認識エンジン (O(1) の判定器を先に実行する)
+typedef CShapeRecognizerPipeline<CLineDetector, CEllipseDetector, CRectangleDetector, CPolylineDetector, CBezierDetector> CDefaultShapeRecognizer;
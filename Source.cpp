@@ -2,49 +2,244 @@
 #include <windowsx.h>
 #include <d2d1.h>
 #include <wincodec.h>
+#include <execution>
+#include <commdlg.h>
+#include <string>
+#include <mutex>
 #include "DrawingObject.h" 
+#include "FrameScheduler.h"
+#include "RenderBackend.h"
+#include "DocumentFile.h"
+#include "PerfMonitor.h"
+#include "InputRecording.h"
+#include "TileCache.h"
+#include "DocumentJournal.h"
 
 #pragma comment(lib, "d2d1.lib")
 #pragma comment(lib, "windowscodecs.lib")
+#pragma comment(lib, "comdlg32.lib")
+#pragma comment(lib, "shell32.lib")
 
 // グローバル変数
 CDocument g_document;
 ID2D1Factory* g_pD2DFactory = nullptr;
-ID2D1HwndRenderTarget* g_pRenderTarget = nullptr;
+CRenderBackend g_renderBackend;                   // D3D11 + フリップモデル (非対応ならHwndRenderTarget)
+bool g_useDeviceContext = true;                  // false の場合は常に HwndRenderTarget を使う
+ID2D1RenderTarget* g_pRenderTarget = nullptr;    // g_renderBackend の描画先 (所有しない)
+CRenderContext g_renderContext; // ブラシなどデバイス依存リソースのキャッシュ
+
+// 確定済みオブジェクトをタイルに分けてラスタライズしたキャッシュ (変化した範囲のタイルのみ再描画)
+bool g_useTileCache = true;
+CTileCache g_tileCache;
+
+// 描き直すタイルをワーカースレッドでコマンドリストに記録する (Undo や読み込み後の全体の描き直し用)
+// DeviceContext 経路でのみ有効 (HwndRenderTarget では1枚ずつ描画する)
+bool g_useParallelRecording = true;
+
+// 表示範囲 (オブジェクトと入力の点はドキュメント座標で扱う)
+// 中ボタンのドラッグかホイールでスクロール、Ctrl+ホイールで拡大縮小、Ctrl+0 で元に戻す
+CViewport g_viewport;
+bool g_isPanning = false;
+POINT g_panLastPoint = { 0 }; // クライアント座標
+
+// ターゲット作成直後は保持内容が無いため、次の描画でクライアント領域全体を描き直す
+bool g_needsFullRepaint = true;
 
 // 描画中のストローク
 std::shared_ptr<CFreehandStroke> g_currentStroke = nullptr;
 bool g_isDrawing = false;
 
+// 最後にストロークへ取り込んだマウス移動 (スクリーン座標と時刻)
+// WM_MOUSEMOVE が間引かれた場合に、この点より後の履歴をまとめて取り出す
+MOUSEMOVEPOINT g_lastMouseMovePoint = { 0 };
+std::vector<D2D1_POINT_2F> g_inputBatch;
+
 // AI補完プレビュー関連のグローバル変数
 std::shared_ptr<IDrawableObject> g_pComplementPreview = nullptr; // 補完後のオブジェクト（半透明で表示）
 std::shared_ptr<IDrawableObject> g_pOriginalObject = nullptr;    // 補完前のオブジェクト（プレビュー確定時に必要）
-size_t g_previewIndex = 0; // 置き換え対象のインデックス
+ObjectId g_previewId = InvalidObjectId; // 置き換え対象のID
+
+// 非同期補完 (ワーカースレッドで判定し、結果をメッセージで受け取る)
+const UINT WM_APP_COMPLEMENT_READY = WM_APP + 1;
+unsigned int g_complementGeneration = 0; // プレビュー破棄のたびに進め、古い結果を捨てる
+
+// フレーム単位の描画 (入力による無効化をまとめ、垂直同期ごとに最大1回描画する)
+const UINT WM_APP_FRAME = WM_APP + 2;
+CFrameScheduler g_frameScheduler;
+RECT g_pendingDirtyRect = { 0 }; // 次のフレームで無効化する範囲
+bool g_hasPendingDirty = false;
+
+// 保存・読み込み
+std::wstring g_documentPath; // 最後に保存または読み込んだファイル (未保存なら空)
+const wchar_t* const DocumentFileFilter = L"AIPaint ドキュメント (*.aipd)\0*.aipd\0すべてのファイル (*.*)\0*.*\0";
+
+// 自動保存 (異常終了した場合は次回の起動時に復元する。正常に終了した場合は記録を削除する)
+// 入力の記録・再生中は空のドキュメントから始める必要があるため使わない
+CDocumentJournal g_documentJournal;
+
+// 処理時間の計測 (F3 でオーバーレイを表示)
+CPerfMonitor g_perfMonitor;
+CPerfOverlay g_perfOverlay;
+
+// 入力の記録と再生
+// /record <file> で起動すると、ドキュメントを変化させる入力を記録して終了時に保存する
+// /replay <file> で起動すると記録した入力を元の間隔で再生する (/fast で待たずに再生、
+// /out <file.aipd> で再生後のドキュメントを保存して終了)
+// 再生中の補完判定はUIスレッドで同期的に行い、記録時と同じドキュメントになるようにする
+const UINT WM_APP_REPLAY_STEP = WM_APP + 3;
+const UINT_PTR ReplayTimerId = 1;
+const wchar_t WindowTitle[] = L"Direct2D AI 補完ペイント";
+CInputRecording g_inputRecording;
+std::wstring g_recordPath;       // 空でなければ記録する
+std::wstring g_replayOutputPath; // 空でなければ再生後に保存して終了する
+bool g_isReplaying = false;
+bool g_replayFast = false;
+size_t g_replayIndex = 0;        // 次に適用するイベント
+DWORD g_replayStartTime = 0;
+
+struct ComplementJob {
+    HWND hWnd;
+    unsigned int generation;
+    ObjectId id;                                 // 置き換え対象のID
+    std::shared_ptr<CFreehandStroke> stroke;     // 判定対象 (確定済みのため読み取り専用)
+    std::shared_ptr<IDrawableObject> preview;    // ワーカーが生成した補完結果
+};
+
+// 補完判定のワーカーはクリーンアップグループに登録し、WM_DESTROY で完了を待つ
+// ジョブはストロークとプレビューの最後の参照を持つことがあるため、破棄は必ずUIスレッドで行う
+TP_CALLBACK_ENVIRON g_complementEnvironment;
+PTP_CLEANUP_GROUP g_pComplementCleanupGroup = NULL;
+std::mutex g_undeliveredJobsMutex;
+std::vector<ComplementJob*> g_undeliveredJobs; // PostMessage に失敗したジョブ
 
 // Direct2Dの初期化
 HRESULT CreateD2DResources(HWND hWnd) {
     HRESULT hr = S_OK;
-    if (!g_pRenderTarget) {
-        RECT rc;
-        GetClientRect(hWnd, &rc);
-
-        D2D1_SIZE_U size = D2D1::SizeU(rc.right - rc.left, rc.bottom - rc.top);
-
-        // レンダリングターゲットの作成
-        hr = g_pD2DFactory->CreateHwndRenderTarget(
-            D2D1::RenderTargetProperties(),
-            D2D1::HwndRenderTargetProperties(hWnd, size),
-            &g_pRenderTarget
-        );
+    if (!g_renderBackend.IsCreated()) {
+        // フレームスケジューラが垂直同期に合わせて描画する場合は、Present で待たない
+        hr = g_renderBackend.Create(hWnd, g_pD2DFactory, g_useDeviceContext, !g_frameScheduler.IsRunning());
+        if (SUCCEEDED(hr)) {
+            g_pRenderTarget = g_renderBackend.GetTarget();
+            g_renderContext.SetTarget(g_pRenderTarget);
+            g_needsFullRepaint = true;
+        }
     }
     return hr;
 }
 
 // Direct2Dのリソース破棄
 void DiscardD2DResources() {
-    if (g_pRenderTarget) {
-        g_pRenderTarget->Release();
-        g_pRenderTarget = nullptr;
+    g_tileCache.Discard();
+    g_renderContext.DiscardResources();
+    g_renderContext.SetTarget(nullptr);
+    g_pRenderTarget = nullptr;
+    g_renderBackend.Discard();
+}
+
+// ヘルパー関数: 画面上の範囲 (DIP) をピクセル単位に丸めて無効化する
+void InvalidateScreenBounds(HWND hWnd, const D2D1_RECT_F& bounds) {
+    // アンチエイリアスのにじみ分として1ピクセル余分に含める
+    RECT rc;
+    rc.left = (LONG)std::floor(bounds.left) - 1;
+    rc.top = (LONG)std::floor(bounds.top) - 1;
+    rc.right = (LONG)std::ceil(bounds.right) + 1;
+    rc.bottom = (LONG)std::ceil(bounds.bottom) + 1;
+
+    if (!g_frameScheduler.IsRunning()) {
+        InvalidateRect(hWnd, &rc, FALSE);
+        return;
+    }
+
+    // 次のフレームまで範囲を蓄積する
+    if (g_hasPendingDirty) {
+        UnionRect(&g_pendingDirtyRect, &g_pendingDirtyRect, &rc);
+    }
+    else {
+        g_pendingDirtyRect = rc;
+        g_hasPendingDirty = true;
+    }
+    g_frameScheduler.RequestFrame();
+}
+
+// ヘルパー関数: ドキュメント座標の描画範囲を無効化する
+void InvalidateBounds(HWND hWnd, const D2D1_RECT_F& bounds) {
+    InvalidateScreenBounds(hWnd, g_viewport.WorldToScreen(bounds));
+}
+
+// ヘルパー関数: クライアント領域全体を無効化する (スクロールや拡大縮小の後)
+// フレームスケジューラが動いていれば、続けて呼ばれても垂直同期ごとに1回の描画にまとめられる
+void InvalidateView(HWND hWnd) {
+    RECT rc;
+    GetClientRect(hWnd, &rc);
+    InvalidateScreenBounds(hWnd, D2D1::RectF((float)rc.left, (float)rc.top, (float)rc.right, (float)rc.bottom));
+}
+
+// ヘルパー関数: 垂直同期ごとのフレーム処理。蓄積した範囲を無効化してすぐに描画する
+void OnFrame(HWND hWnd) {
+    g_frameScheduler.BeginFrame();
+    if (!g_hasPendingDirty) return;
+
+    InvalidateRect(hWnd, &g_pendingDirtyRect, FALSE);
+    g_hasPendingDirty = false;
+    UpdateWindow(hWnd);
+}
+
+// ヘルパー関数: 現在のマウス位置を履歴の照合用に記録する
+void ResetMouseMoveHistory(HWND hWnd, LPARAM lParam) {
+    POINT pt = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+    ClientToScreen(hWnd, &pt);
+    g_lastMouseMovePoint.x = pt.x & 0x0000FFFF; // 履歴と同じ16ビットの座標で保持
+    g_lastMouseMovePoint.y = pt.y & 0x0000FFFF;
+    g_lastMouseMovePoint.time = GetMessageTime();
+}
+
+// ヘルパー関数: 前回の取り込み以降のマウス移動を古い順に outPoints (クライアント座標) へ取り出す
+// システムが統合した WM_MOUSEMOVE の途中の点も GetMouseMovePointsEx の履歴から復元する
+void CollectMouseMovePoints(HWND hWnd, LPARAM lParam, std::vector<D2D1_POINT_2F>& outPoints) {
+    outPoints.clear();
+
+    POINT current = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+    POINT screen = current;
+    ClientToScreen(hWnd, &screen);
+
+    MOUSEMOVEPOINT query = { 0 };
+    query.x = screen.x & 0x0000FFFF; // 履歴は16ビットの座標で照合される
+    query.y = screen.y & 0x0000FFFF;
+    query.time = GetMessageTime();
+
+    const int MAX_HISTORY = 64;
+    MOUSEMOVEPOINT history[MAX_HISTORY];
+    int count = GetMouseMovePointsEx(sizeof(MOUSEMOVEPOINT), &query, history, MAX_HISTORY, GMMP_USE_DISPLAY_POINTS);
+
+    if (count > 0) {
+        // 履歴は新しい順。前回取り込んだ点に達するまでを集める
+        int newCount = 0;
+        for (; newCount < count; ++newCount) {
+            const MOUSEMOVEPOINT& mp = history[newCount];
+            if (mp.time < g_lastMouseMovePoint.time) break;
+            if (mp.time == g_lastMouseMovePoint.time && mp.x == g_lastMouseMovePoint.x && mp.y == g_lastMouseMovePoint.y) break;
+        }
+
+        for (int i = newCount - 1; i >= 0; --i) {
+            POINT pt = { history[i].x, history[i].y };
+            // マルチモニターで負の座標は65536を足した値で返される
+            if (pt.x > 32767) pt.x -= 65536;
+            if (pt.y > 32767) pt.y -= 65536;
+            ScreenToClient(hWnd, &pt);
+            outPoints.push_back(D2D1::Point2F((float)pt.x, (float)pt.y));
+        }
+
+        if (newCount > 0) {
+            g_lastMouseMovePoint = history[0];
+        }
+    }
+
+    // 履歴が取得できない場合はメッセージの座標のみを使う
+    if (outPoints.empty()) {
+        outPoints.push_back(D2D1::Point2F((float)current.x, (float)current.y));
+        g_lastMouseMovePoint.x = query.x;
+        g_lastMouseMovePoint.y = query.y;
+        g_lastMouseMovePoint.time = query.time;
     }
 }
 
@@ -52,198 +247,752 @@ void DiscardD2DResources() {
 void DiscardPreview() {
     g_pComplementPreview = nullptr;
     g_pOriginalObject = nullptr;
+    g_previewId = InvalidObjectId;
+    ++g_complementGeneration; // 実行中の補完結果は無効
+}
+
+// ヘルパー関数: 形状判定の結果からプレビューオブジェクトを生成する (ワーカースレッドから呼ばれる)
+std::shared_ptr<IDrawableObject> CreateComplementObject(const CFreehandStroke& stroke, const CFreehandStroke::ComplementResult& result) {
+    D2D1_COLOR_F previewColor = D2D1::ColorF(0.0f, 0.0f, 0.0f, 1.0f);
+    float previewWidth = 3.0f;
+
+    // 検出された形状に応じてプレビューオブジェクトを生成
+    switch (result.shape) {
+    case CFreehandStroke::ShapeType::Line: {
+        D2D1_POINT_2F start = stroke.GetFirstPoint();
+        D2D1_POINT_2F end = stroke.GetLastPoint();
+        return std::make_shared<CLineSegment>(start, end, previewColor, previewWidth);
+    }
+    case CFreehandStroke::ShapeType::Ellipse:
+        return std::make_shared<CEllipseSegment>(result.ellipse, previewColor, previewWidth, result.rotation);
+    case CFreehandStroke::ShapeType::Curve:
+        return std::make_shared<CBezierSegment>(result.points, previewColor, previewWidth);
+    case CFreehandStroke::ShapeType::Polyline:
+    case CFreehandStroke::ShapeType::Rectangle:
+        return std::make_shared<CPolylineSegment>(result.points, result.isClosed, previewColor, previewWidth);
+    default:
+        return nullptr;
+    }
+}
+
+std::shared_ptr<IDrawableObject> CreateComplementPreview(const CFreehandStroke& stroke) {
+    return CreateComplementObject(stroke, stroke.Recognize());
+}
+
+// ヘルパー関数: ドキュメント内のすべてのストロークを並列に形状判定し、
+// 形状と判定されたものを1つの Undo 単位としてまとめて置き換える
+// 置き換えた数を返す
+size_t ComplementAll() {
+    struct Candidate {
+        ObjectId id;
+        std::shared_ptr<CFreehandStroke> stroke;
+        std::shared_ptr<IDrawableObject> result;
+    };
+
+    // 1. 対象のストロークを集める (ドキュメントへのアクセスはUIスレッドのみ)
+    std::vector<ObjectId> ids;
+    g_document.GetObjectIds(ids);
+
+    std::vector<Candidate> candidates;
+    for (ObjectId id : ids) {
+        auto stroke = ObjectCast<CFreehandStroke>(g_document.FindObject(id));
+        if (stroke) {
+            candidates.push_back(Candidate{ id, stroke, nullptr });
+        }
+    }
+
+    // 2. 形状判定は各ストロークで独立しているため並列に実行する
+    // (楕円以外の判定は点列を走査するため、全体の処理時間は総点数に比例する)
+    // (曲線は制御点だけを持つベジェ曲線に置き換わるため、大きなドキュメントほどメモリと描画コストが減る)
+    std::for_each(std::execution::par, candidates.begin(), candidates.end(), [](Candidate& candidate) {
+        CFreehandStroke::ComplementResult result = candidate.stroke->Recognize();
+        if (result.shape != CFreehandStroke::ShapeType::None) {
+            candidate.result = CreateComplementObject(*candidate.stroke, result);
+        }
+    });
+
+    // 3. 結果を1つのトランザクションで適用する
+    std::vector<ObjectId> replacedIds;
+    std::vector<std::shared_ptr<IDrawableObject>> results;
+    g_document.BeginTransaction();
+    for (const Candidate& candidate : candidates) {
+        if (!candidate.result) continue;
+        g_document.ExecuteCommand(std::make_unique<CComplementCommand>(&g_document, candidate.id, candidate.stroke, candidate.result));
+        replacedIds.push_back(candidate.id);
+        results.push_back(candidate.result);
+    }
+    g_document.CommitTransaction();
+    g_documentJournal.RecordComplement(g_document, replacedIds, results);
+    return replacedIds.size();
+}
+
+// ヘルパー関数: ドキュメントを保存する (未保存、または saveAs の場合は保存先を尋ねる)
+bool SaveDocument(HWND hWnd, bool saveAs) {
+    std::wstring path = g_documentPath;
+    if (saveAs || path.empty()) {
+        wchar_t fileName[MAX_PATH] = L"";
+        OPENFILENAME ofn = { 0 };
+        ofn.lStructSize = sizeof(ofn);
+        ofn.hwndOwner = hWnd;
+        ofn.lpstrFilter = DocumentFileFilter;
+        ofn.lpstrFile = fileName;
+        ofn.nMaxFile = MAX_PATH;
+        ofn.lpstrDefExt = L"aipd";
+        ofn.Flags = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST;
+        if (!GetSaveFileName(&ofn)) return false;
+        path = fileName;
+    }
+
+    if (FAILED(SaveDocumentFile(g_document, path.c_str()))) {
+        MessageBox(hWnd, L"ドキュメントを保存できませんでした。", L"エラー", MB_OK | MB_ICONERROR);
+        return false;
+    }
+    g_documentPath = path;
+    return true;
+}
+
+// ヘルパー関数: ファイルを選んでドキュメントを読み込む (現在の内容と履歴は破棄される)
+bool OpenDocument(HWND hWnd) {
+    wchar_t fileName[MAX_PATH] = L"";
+    OPENFILENAME ofn = { 0 };
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFilter = DocumentFileFilter;
+    ofn.lpstrFile = fileName;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST;
+    if (!GetOpenFileName(&ofn)) return false;
+
+    DiscardPreview();
+    if (FAILED(LoadDocumentFile(g_document, fileName))) {
+        MessageBox(hWnd, L"ドキュメントを読み込めませんでした。", L"エラー", MB_OK | MB_ICONERROR);
+        return false;
+    }
+    g_documentPath = fileName;
+    g_documentJournal.RecordSnapshot(g_document);
+    return true;
+}
+
+// ワーカースレッド: 補完判定を行い、結果をUIスレッドへ送る
+void CALLBACK ComplementWorker(PTP_CALLBACK_INSTANCE, void* context) {
+    ComplementJob* job = static_cast<ComplementJob*>(context);
+    {
+        CScopedPerfTimer timer(g_perfMonitor, PerfStage::Complement);
+        job->preview = CreateComplementPreview(*job->stroke);
+    }
+
+    if (!PostMessage(job->hWnd, WM_APP_COMPLEMENT_READY, 0, reinterpret_cast<LPARAM>(job))) {
+        // メッセージキューが一杯の場合など。ここで破棄せず、UIスレッドに破棄させる
+        std::lock_guard<std::mutex> lock(g_undeliveredJobsMutex);
+        g_undeliveredJobs.push_back(job);
+    }
+}
+
+// ヘルパー関数: 結果を送れなかったジョブを破棄する (UIスレッドから)
+void FreeUndeliveredComplementJobs() {
+    std::vector<ComplementJob*> jobs;
+    {
+        std::lock_guard<std::mutex> lock(g_undeliveredJobsMutex);
+        jobs.swap(g_undeliveredJobs);
+    }
+    for (ComplementJob* job : jobs) {
+        delete job;
+    }
+}
+
+// ヘルパー関数: 補完判定のワーカーを開始する
+void StartComplementWorkers() {
+    InitializeThreadpoolEnvironment(&g_complementEnvironment);
+    g_pComplementCleanupGroup = CreateThreadpoolCleanupGroup();
+    if (g_pComplementCleanupGroup) {
+        SetThreadpoolCallbackCleanupGroup(&g_complementEnvironment, g_pComplementCleanupGroup, NULL);
+    }
+    else {
+        DestroyThreadpoolEnvironment(&g_complementEnvironment); // UIスレッドで判定する
+    }
+}
+
+// ヘルパー関数: 実行中・待機中の補完判定の完了を待ち、届いていない結果をUIスレッドで破棄する
+void StopComplementWorkers(HWND hWnd) {
+    if (g_pComplementCleanupGroup) {
+        CloseThreadpoolCleanupGroupMembers(g_pComplementCleanupGroup, FALSE, NULL);
+        CloseThreadpoolCleanupGroup(g_pComplementCleanupGroup);
+        g_pComplementCleanupGroup = NULL;
+        DestroyThreadpoolEnvironment(&g_complementEnvironment);
+    }
+
+    MSG msg;
+    while (PeekMessage(&msg, hWnd, WM_APP_COMPLEMENT_READY, WM_APP_COMPLEMENT_READY, PM_REMOVE)) {
+        delete reinterpret_cast<ComplementJob*>(msg.lParam);
+    }
+    FreeUndeliveredComplementJobs();
+}
+
+// ヘルパー関数: 補完判定の結果をプレビューとして表示する
+void ApplyComplementJob(HWND hWnd, std::unique_ptr<ComplementJob> job) {
+    // 依頼後に新しいストロークの開始や Undo があった場合は結果を捨てる
+    if (job->generation != g_complementGeneration || !job->preview) {
+        return;
+    }
+    if (g_document.FindObject(job->id) != job->stroke) {
+        return;
+    }
+
+    g_pComplementPreview = job->preview;
+    g_pOriginalObject = job->stroke;
+    g_previewId = job->id;
+    InvalidateBounds(hWnd, g_pComplementPreview->GetBounds());
+}
+
+// ヘルパー関数: 確定したストロークの補完判定をワーカーに依頼する
+void RequestComplement(HWND hWnd, std::shared_ptr<CFreehandStroke> stroke, ObjectId id) {
+    FreeUndeliveredComplementJobs();
+    ComplementJob* job = new ComplementJob{ hWnd, g_complementGeneration, id, stroke, nullptr };
+    if (g_isReplaying) {
+        // 再生中は結果を待ってから次の入力を適用する
+        {
+            CScopedPerfTimer timer(g_perfMonitor, PerfStage::Complement);
+            job->preview = CreateComplementPreview(*job->stroke);
+        }
+        ApplyComplementJob(hWnd, std::unique_ptr<ComplementJob>(job));
+        return;
+    }
+    if (!g_pComplementCleanupGroup || !TrySubmitThreadpoolCallback(ComplementWorker, job, &g_complementEnvironment)) {
+        // スレッドプールが使えない場合はUIスレッドで判定する
+        ComplementWorker(NULL, job);
+    }
+}
+
+// ヘルパー関数: ストロークを開始する (プレビューと判定中の補完結果は破棄する)
+void BeginStroke(HWND hWnd, D2D1_POINT_2F pt) {
+    if (g_pComplementPreview) {
+        InvalidateBounds(hWnd, g_pComplementPreview->GetBounds());
+    }
+    DiscardPreview();
+
+    D2D1_COLOR_F color = D2D1::ColorF(0.0f, 0.0f, 0.0f, 1.0f); // 黒
+    float width = 3.0f;
+    g_currentStroke = std::make_shared<CFreehandStroke>(color, width);
+    g_currentStroke->AddPoint(pt);
+    g_isDrawing = true;
+}
+
+// ヘルパー関数: 入力中のストロークへ点を追加し、追加された線分の範囲を一度だけ無効化する
+// (間引かれた点は描画に影響しない)
+void ContinueStroke(HWND hWnd, const std::vector<D2D1_POINT_2F>& points) {
+    if (!g_isDrawing || !g_currentStroke) return;
+    CScopedPerfTimer timer(g_perfMonitor, PerfStage::Input);
+
+    bool added = false;
+    D2D1_RECT_F dirty = D2D1::RectF();
+    for (const D2D1_POINT_2F& pt : points) {
+        if (!g_currentStroke->AddPoint(pt)) continue;
+
+        D2D1_RECT_F segment = g_currentStroke->GetLastSegmentBounds();
+        dirty = added ? UnionBounds(dirty, segment) : segment;
+        added = true;
+    }
+    if (added) {
+        InvalidateBounds(hWnd, dirty);
+        g_perfMonitor.MarkInput(GetMessageTime());
+    }
+}
+
+// ヘルパー関数: 入力中のストロークを確定してドキュメントに追加し、補完判定を依頼する
+void EndStroke(HWND hWnd) {
+    if (g_isDrawing && g_currentStroke && g_currentStroke->GetInputPointCount() > 1) {
+        CScopedPerfTimer timer(g_perfMonitor, PerfStage::Finalize);
+
+        // 0. 入力を確定し、描画用ジオメトリを構築
+        g_currentStroke->Finalize(g_pD2DFactory);
+        InvalidateBounds(hWnd, g_currentStroke->GetBounds());
+        g_perfMonitor.MarkInput(GetMessageTime());
+
+        // 1. オブジェクトをドキュメントに追加し、Undo の履歴に記録
+        ObjectId id = g_document.AddObject(g_currentStroke);
+        g_documentJournal.RecordAdd(g_document, g_currentStroke);
+
+        // 2. 補完判定をワーカーに依頼 (結果は WM_APP_COMPLEMENT_READY で受け取る)
+        RequestComplement(hWnd, g_currentStroke, id);
+
+        g_currentStroke = nullptr;
+    }
+    g_isDrawing = false;
+}
+
+// ヘルパー関数: 表示中のプレビューで元のストロークを置き換える (プレビューが無ければ false)
+bool AcceptComplement(HWND hWnd) {
+    if (!g_pComplementPreview) return false;
+
+    // 補完コマンドを作成・実行・記録
+    auto complementCommand = std::make_unique<CComplementCommand>(
+        &g_document,
+        g_previewId,
+        g_pOriginalObject,
+        g_pComplementPreview
+    );
+
+    g_document.ExecuteCommand(std::move(complementCommand));
+    g_documentJournal.RecordComplement(g_document, { g_previewId }, { g_pComplementPreview });
+
+    InvalidateBounds(hWnd, UnionBounds(g_pOriginalObject->GetBounds(), g_pComplementPreview->GetBounds()));
+    DiscardPreview();
+    return true;
+}
+
+// ヘルパー関数: Undo / Redo (プレビューは破棄する)
+void UndoDocument(HWND hWnd) {
+    DiscardPreview();
+    if (g_document.CanUndo()) {
+        g_document.Undo();
+        g_documentJournal.RecordUndo(g_document);
+    }
+    InvalidateRect(hWnd, NULL, FALSE);
+}
+
+void RedoDocument(HWND hWnd) {
+    DiscardPreview();
+    if (g_document.CanRedo()) {
+        g_document.Redo();
+        g_documentJournal.RecordRedo(g_document);
+    }
+    InvalidateRect(hWnd, NULL, FALSE);
+}
+
+// ヘルパー関数: すべてのストロークを補完する
+void ComplementAllStrokes(HWND hWnd) {
+    DiscardPreview();
+    if (ComplementAll() > 0) {
+        InvalidateRect(hWnd, NULL, FALSE);
+    }
+}
+
+// ヘルパー関数: 入力を記録する (記録中でなければ何もしない)
+void RecordInput(InputEventType type, const D2D1_POINT_2F* points = nullptr, size_t pointCount = 0) {
+    if (g_recordPath.empty()) return;
+    g_inputRecording.Add(type, GetMessageTime(), points, pointCount);
+}
+
+// ヘルパー関数: 記録したイベントを1つ適用する
+void ApplyInputEvent(HWND hWnd, const InputEvent& event) {
+    switch (event.type) {
+    case InputEventType::ButtonDown:
+        if (!event.points.empty()) {
+            BeginStroke(hWnd, event.points[0]);
+        }
+        break;
+    case InputEventType::MouseMove:
+        ContinueStroke(hWnd, event.points);
+        break;
+    case InputEventType::ButtonUp:
+        EndStroke(hWnd);
+        break;
+    case InputEventType::AcceptComplement:
+        AcceptComplement(hWnd);
+        break;
+    case InputEventType::Undo:
+        UndoDocument(hWnd);
+        break;
+    case InputEventType::Redo:
+        RedoDocument(hWnd);
+        break;
+    case InputEventType::ComplementAll:
+        ComplementAllStrokes(hWnd);
+        break;
+    }
+}
+
+// ヘルパー関数: 再生を終了する
+void FinishReplay(HWND hWnd) {
+    g_isReplaying = false;
+    KillTimer(hWnd, ReplayTimerId);
+
+    if (!g_replayOutputPath.empty()) {
+        if (FAILED(SaveDocumentFile(g_document, g_replayOutputPath.c_str()))) {
+            MessageBox(hWnd, L"再生結果を保存できませんでした。", L"エラー", MB_OK | MB_ICONERROR);
+        }
+        DestroyWindow(hWnd);
+        return;
+    }
+
+    std::wstring title = WindowTitle;
+    title += L" - 再生完了";
+    SetWindowText(hWnd, title.c_str());
+}
+
+// ヘルパー関数: 再生を進める
+// 元の間隔で再生する場合は時刻に達したイベントをすべて適用し、次のイベントの時刻まで待つ
+// 待たずに再生する場合は1つずつ適用し、間に描画などのメッセージを処理させる
+void StepReplay(HWND hWnd) {
+    if (!g_isReplaying) return;
+
+    const std::vector<InputEvent>& events = g_inputRecording.GetEvents();
+    DWORD elapsed = GetTickCount() - g_replayStartTime;
+    while (g_replayIndex < events.size()) {
+        if (!g_replayFast && events[g_replayIndex].time > elapsed) break;
+        ApplyInputEvent(hWnd, events[g_replayIndex++]);
+        if (g_replayFast) break;
+    }
+
+    if (g_replayIndex >= events.size()) {
+        FinishReplay(hWnd);
+    }
+    else if (g_replayFast) {
+        // ポストしたメッセージは WM_PAINT より先に取り出されるため、ここで描画しておく
+        if (!g_frameScheduler.IsRunning()) {
+            UpdateWindow(hWnd);
+        }
+        PostMessage(hWnd, WM_APP_REPLAY_STEP, 0, 0);
+    }
+    else {
+        SetTimer(hWnd, ReplayTimerId, events[g_replayIndex].time - elapsed, NULL);
+    }
+}
+
+// ヘルパー関数: 読み込んだ記録の再生を開始する
+void StartReplay(HWND hWnd) {
+    g_isReplaying = true;
+    g_replayIndex = 0;
+    g_replayStartTime = GetTickCount();
+    PostMessage(hWnd, WM_APP_REPLAY_STEP, 0, 0);
+}
+
+// ヘルパー関数: 自動保存を開始する (前回の記録が残っていれば復元するか尋ねる)
+void StartAutoSave(HWND hWnd) {
+    // 他のプロセスが使用中の場合は自動保存しない
+    if (FAILED(g_documentJournal.Open(CDocumentJournal::GetDefaultDirectory()))) return;
+
+    if (g_documentJournal.HasRecoveryData() &&
+        MessageBox(hWnd, L"前回終了したときの内容が自動保存されています。復元しますか?", WindowTitle, MB_YESNO | MB_ICONQUESTION) == IDYES) {
+        if (FAILED(g_documentJournal.Recover(g_document))) {
+            MessageBox(hWnd, L"自動保存した内容を復元できませんでした。", L"エラー", MB_OK | MB_ICONERROR);
+        }
+        InvalidateRect(hWnd, NULL, FALSE);
+    }
+    g_documentJournal.Start(g_document);
+}
+
+// ヘルパー関数: コマンドラインの記録・再生の指定を読み取る (不正な指定の場合は false)
+bool ParseCommandLine() {
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLine(), &argc);
+    if (!argv) return true;
+
+    bool valid = true;
+    std::wstring replayPath;
+    for (int i = 1; i < argc && valid; ++i) {
+        std::wstring arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == L"/record" && hasValue) {
+            g_recordPath = argv[++i];
+        }
+        else if (arg == L"/replay" && hasValue) {
+            replayPath = argv[++i];
+        }
+        else if (arg == L"/out" && hasValue) {
+            g_replayOutputPath = argv[++i];
+        }
+        else if (arg == L"/fast") {
+            g_replayFast = true;
+        }
+        else {
+            valid = false;
+        }
+    }
+    LocalFree(argv);
+
+    if (!valid || (!replayPath.empty() && !g_recordPath.empty())) {
+        MessageBox(NULL, L"使い方: /record <file> または /replay <file> [/fast] [/out <file.aipd>]", WindowTitle, MB_OK | MB_ICONERROR);
+        return false;
+    }
+    if (!replayPath.empty() && FAILED(g_inputRecording.Load(replayPath.c_str()))) {
+        MessageBox(NULL, L"入力の記録を読み込めませんでした。", L"エラー", MB_OK | MB_ICONERROR);
+        return false;
+    }
+    return true;
 }
 
 // 描画処理
 void OnPaint(HWND hWnd) {
+    CScopedPerfTimer paintTimer(g_perfMonitor, PerfStage::Paint);
     HRESULT hr = CreateD2DResources(hWnd);
     if (SUCCEEDED(hr)) {
         PAINTSTRUCT ps;
         BeginPaint(hWnd, &ps);
 
+        // 無効化された範囲のみを描き直す
+        RECT rcPaint = ps.rcPaint;
+        bool fullPresent = g_needsFullRepaint;
+        if (g_needsFullRepaint) {
+            GetClientRect(hWnd, &rcPaint);
+            g_needsFullRepaint = false;
+        }
+        else if (g_perfOverlay.IsVisible()) {
+            // オーバーレイは描画のたびに最新の計測値で描き直す
+            D2D1_RECT_F overlay = g_perfOverlay.GetBounds();
+            RECT rcOverlay = { (LONG)overlay.left, (LONG)overlay.top, (LONG)std::ceil(overlay.right), (LONG)std::ceil(overlay.bottom) };
+            UnionRect(&rcPaint, &rcPaint, &rcOverlay);
+        }
+
+        // フリップモデルではバックバッファの内容が残らないため全体を描く
+        // (変化した範囲は Present に伝える)
+        RECT rcDraw = rcPaint;
+        if (!g_renderBackend.PreservesContents()) {
+            GetClientRect(hWnd, &rcDraw);
+        }
+        D2D1_RECT_F clip = D2D1::RectF(
+            (float)rcDraw.left, (float)rcDraw.top, (float)rcDraw.right, (float)rcDraw.bottom
+        );
+        D2D1_RECT_F worldClip = g_viewport.ScreenToWorld(clip); // オブジェクトの判定用 (ドキュメント座標)
+
+        // 確定済みオブジェクトはタイルに描画済みのものを使う
+        bool useTiles = false;
+        if (g_useTileCache) {
+            CScopedPerfTimer timer(g_perfMonitor, PerfStage::DrawCommitted);
+            useTiles = SUCCEEDED(g_tileCache.Prepare(g_pRenderTarget, g_renderContext, g_document, g_viewport, clip));
+        }
+
         g_pRenderTarget->BeginDraw();
-        g_pRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::White));
+        g_pRenderTarget->SetTransform(D2D1::Matrix3x2F::Identity());
+        g_pRenderTarget->PushAxisAlignedClip(clip, D2D1_ANTIALIAS_MODE_ALIASED);
+        g_pRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::White)); // 描画が間に合わなかったタイルの部分
+
+        if (useTiles) {
+            g_tileCache.Draw(g_pRenderTarget);
+        }
 
-        // ドキュメント内の全オブジェクトを描画
-        g_document.DrawAll(g_pRenderTarget);
+        // 以降はドキュメント座標で描画する
+        g_pRenderTarget->SetTransform(g_viewport.GetTransform());
+        g_renderContext.SetScale(g_viewport.GetZoom());
+
+        if (!useTiles) {
+            // 範囲内のオブジェクトを描画
+            CScopedPerfTimer timer(g_perfMonitor, PerfStage::DrawCommitted);
+            g_document.DrawAll(g_renderContext, &worldClip);
+        }
 
         // 現在描画中のストロークを描画
-        if (g_currentStroke) {
-            g_currentStroke->Draw(g_pRenderTarget);
+        if (g_currentStroke && BoundsIntersect(g_currentStroke->GetBounds(), worldClip)) {
+            CScopedPerfTimer timer(g_perfMonitor, PerfStage::DrawLive);
+            g_currentStroke->Draw(g_renderContext);
         }
 
         // AI補完プレビューの描画 (半透明)
-        if (g_pComplementPreview) {
-            ID2D1Layer* pLayer = nullptr;
-            g_pRenderTarget->CreateLayer(NULL, &pLayer);
-
-            // Direct2D 1.0 の D2D1_LAYER_PARAMETERS を使用 (前回のビルドエラー対策)
-            D2D1_LAYER_PARAMETERS layerParams = D2D1::LayerParameters(
-                D2D1::RectF(0, 0, g_pRenderTarget->GetSize().width, g_pRenderTarget->GetSize().height),
-                NULL,
-                D2D1_ANTIALIAS_MODE_PER_PRIMITIVE,
-                D2D1::Matrix3x2F::Identity(),
-                0.5f, // 不透明度 50%
-                NULL,
-                D2D1_LAYER_OPTIONS_NONE
-            );
+        // プレビュー (直線・楕円・折れ線・矩形・ベジェ曲線) は常に1つのジオメトリを1回の呼び出し
+        // (DrawLine / DrawEllipse / DrawGeometry) で線として描くため、重なった部分が二重に塗られることはない
+        // そのため、オフスクリーンのレイヤーを使わずに不透明度 50% のブラシで直接描画しても同じ結果になる
+        if (g_pComplementPreview && BoundsIntersect(g_pComplementPreview->GetBounds(), worldClip)) {
+            CScopedPerfTimer timer(g_perfMonitor, PerfStage::DrawPreview);
+            g_renderContext.SetOpacity(0.5f);
+            g_pComplementPreview->Draw(g_renderContext);
+            g_renderContext.SetOpacity(1.0f);
+        }
 
-            g_pRenderTarget->PushLayer(layerParams, pLayer);
+        g_pRenderTarget->SetTransform(D2D1::Matrix3x2F::Identity());
+        g_renderContext.SetScale(1.0f);
 
-            // プレビューを描画
-            g_pComplementPreview->Draw(g_pRenderTarget);
+        // 計測値のオーバーレイ (最前面、画面座標)
+        g_perfOverlay.Draw(g_renderContext, g_perfMonitor);
 
-            g_pRenderTarget->PopLayer();
-            if (pLayer) pLayer->Release();
+        g_pRenderTarget->PopAxisAlignedClip();
+        {
+            CScopedPerfTimer timer(g_perfMonitor, PerfStage::EndDraw);
+            hr = g_pRenderTarget->EndDraw();
+        }
+        if (SUCCEEDED(hr)) {
+            CScopedPerfTimer timer(g_perfMonitor, PerfStage::Present);
+            hr = g_renderBackend.Present(fullPresent ? nullptr : &rcPaint);
+        }
+        if (SUCCEEDED(hr) && hr != D2DERR_RECREATE_TARGET) {
+            g_perfMonitor.MarkPresented();
         }
-
-        hr = g_pRenderTarget->EndDraw();
         if (FAILED(hr) || hr == D2DERR_RECREATE_TARGET) {
             DiscardD2DResources();
         }
 
         EndPaint(hWnd, &ps);
+
+        // 描画が間に合わなかったタイルは次のフレームで描画する
+        if (useTiles && !g_tileCache.IsComplete()) {
+            InvalidateView(hWnd);
+        }
     }
 }
 
+// ヘルパー関数: 表示範囲をスクロールする (画面上の移動量)
+void PanView(HWND hWnd, float dx, float dy) {
+    g_viewport.Pan(dx, dy);
+    InvalidateView(hWnd);
+}
+
+// ヘルパー関数: クライアント座標の point を中心に拡大縮小する
+void ZoomView(HWND hWnd, D2D1_POINT_2F point, float factor) {
+    g_viewport.ZoomAt(point, factor);
+    InvalidateView(hWnd);
+}
+
 // ウィンドウプロシージャ
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
     switch (message) {
     case WM_CREATE:
-        if (FAILED(D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &g_pD2DFactory))) {
+        // タイルの並列記録ではワーカースレッドからもファクトリとデバイスを使う
+        if (FAILED(D2D1CreateFactory(D2D1_FACTORY_TYPE_MULTI_THREADED, &g_pD2DFactory))) {
             return -1;
         }
+        g_tileCache.SetParallelRecording(g_useParallelRecording);
+        StartComplementWorkers();
+        // 開始できない場合は従来どおり無効化のたびに描画する
+        g_frameScheduler.Start(hWnd, WM_APP_FRAME);
         return 0;
 
     case WM_SIZE:
-        if (g_pRenderTarget) {
+        if (g_renderBackend.IsCreated()) {
             RECT rc;
             GetClientRect(hWnd, &rc);
-            g_pRenderTarget->Resize(D2D1::SizeU(rc.right, rc.bottom));
+            if (FAILED(g_renderBackend.Resize(rc.right, rc.bottom))) {
+                DiscardD2DResources(); // 次の描画で作り直す
+            }
+            g_needsFullRepaint = true;
+            InvalidateRect(hWnd, NULL, FALSE);
         }
         return 0;
 
     case WM_LBUTTONDOWN:
     {
-        // プレビュー中に描画を開始した場合、プレビューを破棄
-        if (g_pComplementPreview) {
-            DiscardPreview();
-            InvalidateRect(hWnd, NULL, FALSE);
-        }
-
-        int x = GET_X_LPARAM(lParam);
-        int y = GET_Y_LPARAM(lParam);
+        if (g_isReplaying) return 0;
 
-        D2D1_COLOR_F color = D2D1::ColorF(0.0f, 0.0f, 0.0f, 1.0f); // 黒
-        float width = 3.0f;
-        g_currentStroke = std::make_shared<CFreehandStroke>(color, width);
-        g_currentStroke->AddPoint(D2D1::Point2F((float)x, (float)y));
-        g_isDrawing = true;
+        // 描画を開始した場合、プレビューと判定中の補完結果を破棄
+        // (記録する点もドキュメント座標のため、表示範囲に関係なく再生できる)
+        D2D1_POINT_2F pt = g_viewport.ScreenToWorld(D2D1::Point2F((float)GET_X_LPARAM(lParam), (float)GET_Y_LPARAM(lParam)));
+        RecordInput(InputEventType::ButtonDown, &pt, 1);
+        BeginStroke(hWnd, pt);
+        ResetMouseMoveHistory(hWnd, lParam);
         SetCapture(hWnd);
         return 0;
     }
 
     case WM_MOUSEMOVE:
-        if (g_isDrawing && g_currentStroke) {
-            int x = GET_X_LPARAM(lParam);
-            int y = GET_Y_LPARAM(lParam);
-            g_currentStroke->AddPoint(D2D1::Point2F((float)x, (float)y));
-            InvalidateRect(hWnd, NULL, FALSE);
+        if (g_isPanning) {
+            POINT pt = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+            PanView(hWnd, (float)(pt.x - g_panLastPoint.x), (float)(pt.y - g_panLastPoint.y));
+            g_panLastPoint = pt;
+        }
+        if (g_isDrawing && g_currentStroke && !g_isReplaying) {
+            // 前回以降の移動をまとめて取り込む
+            CollectMouseMovePoints(hWnd, lParam, g_inputBatch);
+            for (D2D1_POINT_2F& p : g_inputBatch) {
+                p = g_viewport.ScreenToWorld(p);
+            }
+            RecordInput(InputEventType::MouseMove, g_inputBatch.data(), g_inputBatch.size());
+            ContinueStroke(hWnd, g_inputBatch);
         }
         return 0;
 
     case WM_LBUTTONUP:
-        if (g_isDrawing && g_currentStroke && g_currentStroke->GetPoints().size() > 1) {
-            // 1. オブジェクトをドキュメントのリストに追加 (コマンド記録なし)
-            g_document.AddObject(g_currentStroke, false);
-
-            // 2. Addコマンドを作成し、Execute()でインデックスを保存し、スタックに記録
-            auto addCommand = std::make_unique<CAddObjectCommand>(&g_document, g_currentStroke);
-            addCommand->Execute();
-            g_document.RecordCommand(std::move(addCommand));
-
-            // 3. 補完プレビューを試みる
-            std::shared_ptr<IDrawableObject> lastObj = g_document.GetLastObject();
-            size_t index = g_document.GetLastObjectIndex();
-
-            if (lastObj) {
-                std::shared_ptr<CFreehandStroke> stroke =
-                    std::dynamic_pointer_cast<CFreehandStroke>(lastObj);
-
-                if (stroke) {
-                    stroke->Complement(); // 補完可能かの判定を実行
-
-                    if (stroke->IsComplementable()) {
-
-                        D2D1_COLOR_F previewColor = D2D1::ColorF(0.0f, 0.0f, 0.0f, 1.0f);
-                        float previewWidth = 3.0f;
-
-                        // 検出された形状に応じてプレビューオブジェクトを生成
-                        switch (stroke->m_detectedShape) {
-                        case CFreehandStroke::ShapeType::Line: {
-                            D2D1_POINT_2F start = stroke->GetPoints().front();
-                            D2D1_POINT_2F end = stroke->GetPoints().back();
-                            g_pComplementPreview = std::make_shared<CLineSegment>(
-                                start, end, previewColor, previewWidth
-                            );
-                            break;
-                        }
-                        case CFreehandStroke::ShapeType::Ellipse:
-                        case CFreehandStroke::ShapeType::Curve: { // 曲線と楕円は、ここではCEllipseSegmentでプレビュー
-                            g_pComplementPreview = std::make_shared<CEllipseSegment>(
-                                stroke->m_complementEllipse, previewColor, previewWidth
-                            );
-                            break;
-                        }
-                        default:
-                            break;
-                        }
-
-                        if (g_pComplementPreview) {
-                            g_pOriginalObject = lastObj;
-                            g_previewIndex = index;
-                            InvalidateRect(hWnd, NULL, FALSE);
-                        }
-                    }
-                }
-            }
+        if (g_isReplaying) return 0;
+        if (g_isDrawing) {
+            RecordInput(InputEventType::ButtonUp);
+        }
+        EndStroke(hWnd);
+        if (!g_isPanning) ReleaseCapture();
+        return 0;
+
+    // 中ボタンのドラッグでスクロール (表示範囲はドキュメントを変更しないため記録しない)
+    case WM_MBUTTONDOWN:
+        g_isPanning = true;
+        g_panLastPoint.x = GET_X_LPARAM(lParam);
+        g_panLastPoint.y = GET_Y_LPARAM(lParam);
+        SetCapture(hWnd);
+        return 0;
+
+    case WM_MBUTTONUP:
+        g_isPanning = false;
+        if (!g_isDrawing) ReleaseCapture();
+        return 0;
+
+    // ホイールで縦、Shift+ホイールで横にスクロールし、Ctrl+ホイールで拡大縮小する
+    case WM_MOUSEWHEEL:
+    {
+        float notches = (float)GET_WHEEL_DELTA_WPARAM(wParam) / WHEEL_DELTA;
+        WORD keys = GET_KEYSTATE_WPARAM(wParam);
+        if (keys & MK_CONTROL) {
+            POINT pt = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) }; // スクリーン座標
+            ScreenToClient(hWnd, &pt);
+            ZoomView(hWnd, D2D1::Point2F((float)pt.x, (float)pt.y), std::pow(1.25f, notches));
+        }
+        else if (keys & MK_SHIFT) {
+            PanView(hWnd, notches * 120.0f, 0.0f);
+        }
+        else {
+            PanView(hWnd, 0.0f, notches * 120.0f);
+        }
+        return 0;
+    }
+
+    case WM_APP_COMPLEMENT_READY:
+        ApplyComplementJob(hWnd, std::unique_ptr<ComplementJob>(reinterpret_cast<ComplementJob*>(lParam)));
+        return 0;
+
+    case WM_APP_REPLAY_STEP:
+        StepReplay(hWnd);
+        return 0;
 
-            g_currentStroke = nullptr;
+    case WM_TIMER:
+        if (wParam == ReplayTimerId) {
+            KillTimer(hWnd, ReplayTimerId);
+            StepReplay(hWnd);
         }
-        g_isDrawing = false;
-        ReleaseCapture();
         return 0;
 
     case WM_KEYDOWN:
     {
+        // 再生中はドキュメントを変更する操作を受け付けない
+        if (g_isReplaying && wParam != VK_F3 && wParam != '0') return 0;
+
         // Ctrl+Z (Undo)
         if (wParam == 'Z' && GetKeyState(VK_CONTROL) & 0x8000) {
-            DiscardPreview();
-            g_document.Undo();
-            InvalidateRect(hWnd, NULL, FALSE);
+            RecordInput(InputEventType::Undo);
+            UndoDocument(hWnd);
         }
         // Ctrl+Y (Redo)
         else if (wParam == 'Y' && GetKeyState(VK_CONTROL) & 0x8000) {
-            DiscardPreview();
-            g_document.Redo();
-            InvalidateRect(hWnd, NULL, FALSE);
+            RecordInput(InputEventType::Redo);
+            RedoDocument(hWnd);
+        }
+        // Ctrl+S (保存) / Ctrl+Shift+S (名前を付けて保存)
+        else if (wParam == 'S' && GetKeyState(VK_CONTROL) & 0x8000) {
+            if (!g_isDrawing) {
+                SaveDocument(hWnd, (GetKeyState(VK_SHIFT) & 0x8000) != 0);
+            }
+        }
+        // Ctrl+O (開く)
+        // 記録中は再生と同じ空のドキュメントから始まる状態を保つため、開かない
+        else if (wParam == 'O' && GetKeyState(VK_CONTROL) & 0x8000) {
+            if (!g_isDrawing && g_recordPath.empty() && OpenDocument(hWnd)) {
+                InvalidateRect(hWnd, NULL, FALSE);
+            }
+        }
+        // Ctrl+0 (表示範囲を元に戻す)
+        else if (wParam == '0' && GetKeyState(VK_CONTROL) & 0x8000) {
+            g_viewport.Reset();
+            InvalidateView(hWnd);
+        }
+        // F3 (処理時間のオーバーレイ表示の切り替え)
+        else if (wParam == VK_F3) {
+            g_perfOverlay.SetVisible(!g_perfOverlay.IsVisible());
+            InvalidateScreenBounds(hWnd, g_perfOverlay.GetBounds());
+        }
+        // Shift+Tab (すべてのストロークを補完)
+        else if (wParam == VK_TAB && GetKeyState(VK_SHIFT) & 0x8000) {
+            RecordInput(InputEventType::ComplementAll);
+            ComplementAllStrokes(hWnd);
         }
         // Tab (AI補完確定)
         else if (wParam == VK_TAB) {
+            // プレビューが無い場合は何も変わらないため記録しない
             if (g_pComplementPreview) {
-                // 補完コマンドを作成・実行・記録
-                auto complementCommand = std::make_unique<CComplementCommand>(
-                    &g_document,
-                    g_previewIndex,
-                    g_pOriginalObject,
-                    g_pComplementPreview
-                );
-
-                complementCommand->Execute();
-                g_document.RecordCommand(std::move(complementCommand));
-
-                DiscardPreview();
-                InvalidateRect(hWnd, NULL, FALSE);
+                RecordInput(InputEventType::AcceptComplement);
+                AcceptComplement(hWnd);
             }
         }
         return 0;
@@ -253,7 +1002,17 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         OnPaint(hWnd);
         return 0;
 
+    case WM_APP_FRAME:
+        OnFrame(hWnd);
+        return 0;
+
     case WM_DESTROY:
+        // 復元したストロークがスナップショットをマップしたままだと削除できないため、先にドキュメントを空にする
+        DiscardPreview();
+        g_document.Clear();
+        g_documentJournal.Close(true); // 正常な終了では復元の必要が無い
+        StopComplementWorkers(hWnd); // ファクトリを解放する前に補完結果を破棄する
+        g_frameScheduler.Stop();
         DiscardD2DResources();
         if (g_pD2DFactory) g_pD2DFactory->Release();
         PostQuitMessage(0);
@@ -268,6 +1027,10 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     const wchar_t CLASS_NAME[] = L"D2D Drawing App";
 
+    if (!ParseCommandLine()) {
+        return 0;
+    }
+
     WNDCLASS wc = {};
     wc.lpfnWndProc = WndProc;
     wc.hInstance = hInstance;
@@ -276,11 +1039,12 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     wc.hbrBackground = (HBRUSH)(COLOR_WINDOW + 1);
 
     RegisterClass(&wc);
+    g_perfMonitor.Register();
 
     HWND hWnd = CreateWindowEx(
         0,
         CLASS_NAME,
-        L"Direct2D AI 補完ペイント",
+        WindowTitle,
         WS_OVERLAPPEDWINDOW,
         CW_USEDEFAULT, CW_USEDEFAULT, 800, 600,
         NULL,
@@ -296,11 +1060,23 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     ShowWindow(hWnd, nCmdShow);
     UpdateWindow(hWnd);
 
+    if (!g_inputRecording.GetEvents().empty() && g_recordPath.empty()) {
+        StartReplay(hWnd);
+    }
+    else if (g_recordPath.empty()) {
+        StartAutoSave(hWnd);
+    }
+
     MSG msg = {};
     while (GetMessage(&msg, NULL, 0, 0)) {
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
 
+    if (!g_recordPath.empty() && FAILED(g_inputRecording.Save(g_recordPath.c_str()))) {
+        MessageBox(NULL, L"入力の記録を保存できませんでした。", L"エラー", MB_OK | MB_ICONERROR);
+    }
+
+    g_perfMonitor.Unregister();
     return 0;
 }
\ No newline at end of file
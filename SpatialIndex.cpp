@@ -0,0 +1,103 @@
+﻿#include "SpatialIndex.h"
+#include <algorithm>
+#include <cmath>
+
+// --- CSpatialGrid 実装 ---
+
+CSpatialGrid::CSpatialGrid(float cellSize, size_t maxCellsPerItem)
+    : m_cellSize(cellSize), m_maxCellsPerItem(maxCellsPerItem) {
+}
+
+long long CSpatialGrid::MakeKey(int cx, int cy) {
+    return (long long)(((unsigned long long)(unsigned int)cx << 32) | (unsigned int)cy);
+}
+
+bool CSpatialGrid::GetCellRange(const D2D1_RECT_F& bounds, int& x0, int& y0, int& x1, int& y1) const {
+    double cellsX = std::floor(bounds.right / m_cellSize) - std::floor(bounds.left / m_cellSize) + 1.0;
+    double cellsY = std::floor(bounds.bottom / m_cellSize) - std::floor(bounds.top / m_cellSize) + 1.0;
+    if (cellsX * cellsY > (double)m_maxCellsPerItem) return false;
+
+    x0 = (int)std::floor(bounds.left / m_cellSize);
+    y0 = (int)std::floor(bounds.top / m_cellSize);
+    x1 = (int)std::floor(bounds.right / m_cellSize);
+    y1 = (int)std::floor(bounds.bottom / m_cellSize);
+    return true;
+}
+
+void CSpatialGrid::Insert(size_t id, const D2D1_RECT_F& bounds) {
+    int x0, y0, x1, y1;
+    if (!GetCellRange(bounds, x0, y0, x1, y1)) {
+        m_largeItems.push_back(id);
+        return;
+    }
+
+    for (int cy = y0; cy <= y1; ++cy) {
+        for (int cx = x0; cx <= x1; ++cx) {
+            m_cells[MakeKey(cx, cy)].push_back(id);
+        }
+    }
+}
+
+void CSpatialGrid::Remove(size_t id, const D2D1_RECT_F& bounds) {
+    int x0, y0, x1, y1;
+    if (!GetCellRange(bounds, x0, y0, x1, y1)) {
+        auto it = std::find(m_largeItems.begin(), m_largeItems.end(), id);
+        if (it != m_largeItems.end()) m_largeItems.erase(it);
+        return;
+    }
+
+    for (int cy = y0; cy <= y1; ++cy) {
+        for (int cx = x0; cx <= x1; ++cx) {
+            auto cell = m_cells.find(MakeKey(cx, cy));
+            if (cell == m_cells.end()) continue;
+
+            // セル内の順序は問わないので末尾と入れ替えて削除
+            std::vector<size_t>& ids = cell->second;
+            auto it = std::find(ids.begin(), ids.end(), id);
+            if (it != ids.end()) {
+                *it = ids.back();
+                ids.pop_back();
+            }
+            if (ids.empty()) m_cells.erase(cell);
+        }
+    }
+}
+
+void CSpatialGrid::Clear() {
+    m_cells.clear();
+    m_largeItems.clear();
+}
+
+void CSpatialGrid::Query(const D2D1_RECT_F& area, std::vector<size_t>& outIds) const {
+    outIds.clear();
+    outIds.insert(outIds.end(), m_largeItems.begin(), m_largeItems.end());
+
+    double fx0 = std::floor(area.left / m_cellSize);
+    double fy0 = std::floor(area.top / m_cellSize);
+    double fx1 = std::floor(area.right / m_cellSize);
+    double fy1 = std::floor(area.bottom / m_cellSize);
+
+    // 検索範囲がセル数より広い場合は登録済みセルを走査する
+    double areaCells = (fx1 - fx0 + 1.0) * (fy1 - fy0 + 1.0);
+    if (areaCells > (double)m_cells.size()) {
+        for (const auto& cell : m_cells) {
+            double cx = (double)(int)(cell.first >> 32);
+            double cy = (double)(int)(unsigned int)(cell.first & 0xFFFFFFFF);
+            if (cx < fx0 || cx > fx1 || cy < fy0 || cy > fy1) continue;
+            outIds.insert(outIds.end(), cell.second.begin(), cell.second.end());
+        }
+    }
+    else {
+        int x0 = (int)fx0, y0 = (int)fy0, x1 = (int)fx1, y1 = (int)fy1;
+        for (int cy = y0; cy <= y1; ++cy) {
+            for (int cx = x0; cx <= x1; ++cx) {
+                auto cell = m_cells.find(MakeKey(cx, cy));
+                if (cell == m_cells.end()) continue;
+                outIds.insert(outIds.end(), cell->second.begin(), cell->second.end());
+            }
+        }
+    }
+
+    std::sort(outIds.begin(), outIds.end());
+    outIds.erase(std::unique(outIds.begin(), outIds.end()), outIds.end());
+}
@@ -0,0 +1,28 @@
+﻿#pragma once
+
+#include <d2d1.h>
+#include <vector>
+#include <unordered_map>
+
+// --- 一様グリッドによる空間インデックス ---
+// 要素IDを外接矩形が重なるセルに登録し、範囲検索で候補を絞り込む
+class CSpatialGrid {
+private:
+    float m_cellSize;
+    size_t m_maxCellsPerItem; // これを超える大きな要素はセルに登録しない
+    std::unordered_map<long long, std::vector<size_t>> m_cells;
+    std::vector<size_t> m_largeItems; // 常に検索結果に含める大きな要素
+
+    static long long MakeKey(int cx, int cy);
+    bool GetCellRange(const D2D1_RECT_F& bounds, int& x0, int& y0, int& x1, int& y1) const;
+
+public:
+    explicit CSpatialGrid(float cellSize = 256.0f, size_t maxCellsPerItem = 64);
+
+    void Insert(size_t id, const D2D1_RECT_F& bounds);
+    void Remove(size_t id, const D2D1_RECT_F& bounds); // 登録時と同じ矩形を指定する
+    void Clear();
+
+    // area と重なる可能性のある要素IDを昇順・重複なしで返す
+    void Query(const D2D1_RECT_F& area, std::vector<size_t>& outIds) const;
+};
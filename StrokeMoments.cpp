@@ -0,0 +1,258 @@
+﻿#include "StrokeMoments.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define STROKE_MOMENTS_AVX
+#elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STROKE_MOMENTS_SSE2
+#endif
+
+// --- CStrokeMoments 実装 ---
+
+CStrokeMoments& CStrokeMoments::operator=(const CStrokeMoments& other) {
+    if (this == &other) return *this;
+    m_count = other.m_count;
+    m_origin = other.m_origin;
+    m_last = other.m_last;
+    m_bounds = other.m_bounds;
+    for (int i = 0; i <= MaxOrder; ++i) {
+        for (int j = 0; j <= MaxOrder; ++j) {
+            m_sums[i][j] = other.m_sums[i][j];
+        }
+    }
+    m_pPending.reset();
+    m_pendingCount = 0;
+
+    // 複製元は読み取るだけにし (別スレッドから読まれている場合があるため)、保留中の点は複製先で集計する
+    if (other.m_pendingCount > 0) {
+        Accumulate(other.m_pPending->x, other.m_pPending->y, other.m_pendingCount);
+    }
+    return *this;
+}
+
+void CStrokeMoments::Reset() {
+    m_count = 0;
+    m_origin = D2D1::Point2F();
+    m_last = D2D1::Point2F();
+    m_bounds = D2D1::RectF();
+    m_pPending.reset();
+    m_pendingCount = 0;
+    for (int i = 0; i <= MaxOrder; ++i) {
+        for (int j = 0; j <= MaxOrder; ++j) {
+            m_sums[i][j] = 0.0;
+        }
+    }
+}
+
+void CStrokeMoments::Add(D2D1_POINT_2F p) {
+    if (m_count == 0) {
+        m_origin = p;
+        m_bounds = D2D1::RectF(p.x, p.y, p.x, p.y);
+    }
+    else {
+        m_bounds.left = min(m_bounds.left, p.x);
+        m_bounds.top = min(m_bounds.top, p.y);
+        m_bounds.right = max(m_bounds.right, p.x);
+        m_bounds.bottom = max(m_bounds.bottom, p.y);
+    }
+    m_last = p;
+    ++m_count;
+
+    if (!m_pPending) m_pPending.reset(new PendingBlock);
+    m_pPending->x[m_pendingCount] = p.x;
+    m_pPending->y[m_pendingCount] = p.y;
+    if (++m_pendingCount == BlockSize) {
+        Flush();
+    }
+}
+
+void CStrokeMoments::AddPoints(const float* xs, const float* ys, size_t count) {
+    if (count == 0) return;
+
+    Flush();
+    if (m_count == 0) {
+        m_origin = D2D1::Point2F(xs[0], ys[0]);
+        m_bounds = D2D1::RectF(xs[0], ys[0], xs[0], ys[0]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        m_bounds.left = min(m_bounds.left, xs[i]);
+        m_bounds.top = min(m_bounds.top, ys[i]);
+        m_bounds.right = max(m_bounds.right, xs[i]);
+        m_bounds.bottom = max(m_bounds.bottom, ys[i]);
+    }
+    m_last = D2D1::Point2F(xs[count - 1], ys[count - 1]);
+    m_count += count;
+
+    Accumulate(xs, ys, count);
+}
+
+void CStrokeMoments::Flush() const {
+    if (m_pendingCount == 0) return;
+    Accumulate(m_pPending->x, m_pPending->y, m_pendingCount);
+    m_pendingCount = 0;
+}
+
+void CStrokeMoments::ReleaseBuffer() {
+    Flush();
+    m_pPending.reset();
+}
+
+void CStrokeMoments::GetState(State& out) const {
+    Flush();
+    out.count = m_count;
+    out.origin = m_origin;
+    out.last = m_last;
+    out.bounds = m_bounds;
+
+    int term = 0;
+    for (int a = 0; a <= MaxOrder; ++a) {
+        for (int b = 0; a + b <= MaxOrder; ++b, ++term) {
+            out.sums[term] = m_sums[a][b];
+        }
+    }
+}
+
+void CStrokeMoments::SetState(const State& state) {
+    Reset();
+    m_count = (size_t)state.count;
+    m_origin = state.origin;
+    m_last = state.last;
+    m_bounds = state.bounds;
+
+    int term = 0;
+    for (int a = 0; a <= MaxOrder; ++a) {
+        for (int b = 0; a + b <= MaxOrder; ++b, ++term) {
+            m_sums[a][b] = state.sums[term];
+        }
+    }
+}
+
+void CStrokeMoments::Accumulate(const float* xs, const float* ys, size_t count) const {
+    const double ox = m_origin.x;
+    const double oy = m_origin.y;
+    size_t i = 0;
+
+#if defined(STROKE_MOMENTS_AVX) || defined(STROKE_MOMENTS_SSE2)
+    // 単項式 x^a y^b (a + b <= 4) ごとのアキュムレータを倍精度のレーンで並列に加算する
+    const int termCount = SumCount;
+#if defined(STROKE_MOMENTS_AVX)
+    const size_t lanes = 4;
+    __m256d acc[termCount];
+    for (int k = 0; k < termCount; ++k) acc[k] = _mm256_setzero_pd();
+    const __m256d vox = _mm256_set1_pd(ox);
+    const __m256d voy = _mm256_set1_pd(oy);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    for (; i + lanes <= count; i += lanes) {
+        __m256d x = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(xs + i)), vox);
+        __m256d y = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(ys + i)), voy);
+
+        __m256d xp[MaxOrder + 1], yp[MaxOrder + 1];
+        xp[0] = yp[0] = one;
+        for (int k = 1; k <= MaxOrder; ++k) {
+            xp[k] = _mm256_mul_pd(xp[k - 1], x);
+            yp[k] = _mm256_mul_pd(yp[k - 1], y);
+        }
+
+        int term = 0;
+        for (int a = 0; a <= MaxOrder; ++a) {
+            for (int b = 0; a + b <= MaxOrder; ++b, ++term) {
+                acc[term] = _mm256_add_pd(acc[term], _mm256_mul_pd(xp[a], yp[b]));
+            }
+        }
+    }
+
+    int term = 0;
+    for (int a = 0; a <= MaxOrder; ++a) {
+        for (int b = 0; a + b <= MaxOrder; ++b, ++term) {
+            alignas(32) double lane[4];
+            _mm256_store_pd(lane, acc[term]);
+            m_sums[a][b] += (lane[0] + lane[1]) + (lane[2] + lane[3]);
+        }
+    }
+#else
+    const size_t lanes = 2;
+    __m128d acc[termCount];
+    for (int k = 0; k < termCount; ++k) acc[k] = _mm_setzero_pd();
+    const __m128d vox = _mm_set1_pd(ox);
+    const __m128d voy = _mm_set1_pd(oy);
+    const __m128d one = _mm_set1_pd(1.0);
+
+    for (; i + lanes <= count; i += lanes) {
+        __m128d x = _mm_sub_pd(_mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(xs + i)))), vox);
+        __m128d y = _mm_sub_pd(_mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(ys + i)))), voy);
+
+        __m128d xp[MaxOrder + 1], yp[MaxOrder + 1];
+        xp[0] = yp[0] = one;
+        for (int k = 1; k <= MaxOrder; ++k) {
+            xp[k] = _mm_mul_pd(xp[k - 1], x);
+            yp[k] = _mm_mul_pd(yp[k - 1], y);
+        }
+
+        int term = 0;
+        for (int a = 0; a <= MaxOrder; ++a) {
+            for (int b = 0; a + b <= MaxOrder; ++b, ++term) {
+                acc[term] = _mm_add_pd(acc[term], _mm_mul_pd(xp[a], yp[b]));
+            }
+        }
+    }
+
+    int term = 0;
+    for (int a = 0; a <= MaxOrder; ++a) {
+        for (int b = 0; a + b <= MaxOrder; ++b, ++term) {
+            alignas(16) double lane[2];
+            _mm_store_pd(lane, acc[term]);
+            m_sums[a][b] += lane[0] + lane[1];
+        }
+    }
+#endif
+#endif
+
+    // 残りの点 (SIMD 非対応環境では全点) をスカラーで加算
+    for (; i < count; ++i) {
+        double x = (double)xs[i] - ox;
+        double y = (double)ys[i] - oy;
+
+        double xPow[MaxOrder + 1] = { 1.0 };
+        double yPow[MaxOrder + 1] = { 1.0 };
+        for (int k = 1; k <= MaxOrder; ++k) {
+            xPow[k] = xPow[k - 1] * x;
+            yPow[k] = yPow[k - 1] * y;
+        }
+
+        for (int a = 0; a <= MaxOrder; ++a) {
+            for (int b = 0; a + b <= MaxOrder; ++b) {
+                m_sums[a][b] += xPow[a] * yPow[b];
+            }
+        }
+    }
+}
+
+double CStrokeMoments::CenteredSum(int i, int j, double cx, double cy) const {
+    Flush();
+
+    // 二項展開: Σ (x - cx)^i (y - cy)^j = Σa Σb C(i,a) C(j,b) (-cx)^(i-a) (-cy)^(j-b) Σ x^a y^b
+    static const double binomial[MaxOrder + 1][MaxOrder + 1] = {
+        { 1, 0, 0, 0, 0 },
+        { 1, 1, 0, 0, 0 },
+        { 1, 2, 1, 0, 0 },
+        { 1, 3, 3, 1, 0 },
+        { 1, 4, 6, 4, 1 },
+    };
+
+    double negCxPow[MaxOrder + 1] = { 1.0 };
+    double negCyPow[MaxOrder + 1] = { 1.0 };
+    for (int k = 1; k <= MaxOrder; ++k) {
+        negCxPow[k] = negCxPow[k - 1] * -cx;
+        negCyPow[k] = negCyPow[k - 1] * -cy;
+    }
+
+    double total = 0.0;
+    for (int a = 0; a <= i; ++a) {
+        for (int b = 0; b <= j; ++b) {
+            total += binomial[i][a] * binomial[j][b] * negCxPow[i - a] * negCyPow[j - b] * m_sums[a][b];
+        }
+    }
+    return total;
+}
@@ -0,0 +1,75 @@
+﻿#pragma once
+
+#include <d2d1.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// --- ストロークの逐次統計量 (オンライン形状認識用) ---
+// 点を追加するたびに外接矩形と次数4までのモーメントを累積し、
+// 直線・楕円の当てはめを点列の再走査なしで行えるようにする
+// モーメントは小さなブロック単位で SIMD 化したカーネルにまとめて加算する
+class CStrokeMoments {
+public:
+    static const int MaxOrder = 4;
+    static const size_t BlockSize = 64;
+    static const int SumCount = (MaxOrder + 1) * (MaxOrder + 2) / 2; // i + j <= MaxOrder の項の数
+
+    // 集計済みの状態 (ファイルへの保存用。固定レイアウト)
+    struct State {
+        uint64_t count;
+        D2D1_POINT_2F origin;
+        D2D1_POINT_2F last;
+        D2D1_RECT_F bounds;
+        double sums[SumCount]; // i の昇順、同じ i の中では j の昇順
+    };
+
+private:
+    size_t m_count;
+    D2D1_POINT_2F m_origin; // 最初の点 (桁落ちを避けるため相対座標で累積)
+    D2D1_POINT_2F m_last;
+    D2D1_RECT_F m_bounds;
+    mutable double m_sums[MaxOrder + 1][MaxOrder + 1]; // m_sums[i][j] = Σ x^i y^j (i + j <= MaxOrder)
+
+    // まだモーメントに加算していない点 (SoA)
+    // 入力中のストロークだけが必要とするため、最初の追加時に確保し ReleaseBuffer で解放する
+    struct PendingBlock {
+        float x[BlockSize];
+        float y[BlockSize];
+    };
+    mutable std::unique_ptr<PendingBlock> m_pPending;
+    mutable size_t m_pendingCount;
+
+    void Accumulate(const float* xs, const float* ys, size_t count) const;
+
+public:
+    CStrokeMoments() { Reset(); }
+    CStrokeMoments(const CStrokeMoments& other) { *this = other; }
+    CStrokeMoments& operator=(const CStrokeMoments& other); // 保留中の点は複製先で集計する (複製元は変更しない)
+
+    void Reset();
+    void Add(D2D1_POINT_2F p);
+    void AddPoints(const float* xs, const float* ys, size_t count); // SoA 配列からまとめて追加
+
+    // 保留中の点をモーメントへ反映する
+    // (集計値の取得時にも自動で呼ばれるが、別スレッドへ渡す前には明示的に呼び出すこと)
+    void Flush() const;
+
+    // 保留中の点を集計し、保留用のバッファを解放する (入力が完了したストロークで呼ぶ)
+    void ReleaseBuffer();
+
+    size_t GetCount() const { return m_count; }
+    D2D1_POINT_2F GetOrigin() const { return m_origin; }
+    D2D1_POINT_2F GetLast() const { return m_last; }
+    D2D1_RECT_F GetBounds() const { return m_bounds; }
+
+    // 原点からの相対座標による Σ x^i y^j
+    double Sum(int i, int j) const { Flush(); return m_sums[i][j]; }
+
+    // 中心 (cx, cy) (原点からの相対座標) まわりの Σ (x - cx)^i (y - cy)^j
+    double CenteredSum(int i, int j, double cx, double cy) const;
+
+    // 状態の保存と復元 (保存時は保留中の点を先に集計する)
+    void GetState(State& out) const;
+    void SetState(const State& state);
+};
@@ -0,0 +1,488 @@
+﻿#include "StrokePoints.h"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+// --- CPointChunkPool 実装 ---
+
+CPointChunkPool::CPointChunkPool(size_t maxFreeCount)
+    : m_pFreeList(nullptr), m_freeCount(0), m_maxFreeCount(maxFreeCount) {
+}
+
+CPointChunkPool::~CPointChunkPool() {
+    Trim();
+}
+
+CPointChunk* CPointChunkPool::Acquire() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pFreeList) {
+            CPointChunk* pChunk = m_pFreeList;
+            m_pFreeList = pChunk->pNextFree;
+            --m_freeCount;
+            return pChunk;
+        }
+    }
+    return new CPointChunk;
+}
+
+void CPointChunkPool::Release(CPointChunk* pChunk) {
+    if (!pChunk) return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_freeCount < m_maxFreeCount) {
+            pChunk->pNextFree = m_pFreeList;
+            m_pFreeList = pChunk;
+            ++m_freeCount;
+            return;
+        }
+    }
+    delete pChunk;
+}
+
+void CPointChunkPool::Trim() {
+    CPointChunk* pList = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        pList = m_pFreeList;
+        m_pFreeList = nullptr;
+        m_freeCount = 0;
+    }
+    while (pList) {
+        CPointChunk* pNext = pList->pNextFree;
+        delete pList;
+        pList = pNext;
+    }
+}
+
+CPointChunkPool& CPointChunkPool::Shared() {
+    // 静的オブジェクトのデストラクタからも返却されるため、意図的に破棄しない
+    // (関数内の static だとグローバルなストロークより先に破棄されることがある)
+    static CPointChunkPool* pPool = new CPointChunkPool;
+    return *pPool;
+}
+
+
+// --- CStrokePoints 実装 ---
+
+CStrokePoints::CStrokePoints(const CStrokePoints& other)
+    : m_size(0), m_pExternalX(nullptr), m_pExternalY(nullptr) {
+    *this = other;
+}
+
+CStrokePoints& CStrokePoints::operator=(const CStrokePoints& other) {
+    if (this == &other) return *this;
+    Clear();
+
+    // 外部の配列は読み取り専用なので、複製せずに同じ配列を参照する
+    if (other.m_pExternalX) {
+        m_pExternalX = other.m_pExternalX;
+        m_pExternalY = other.m_pExternalY;
+        m_pExternalOwner = other.m_pExternalOwner;
+        m_size = other.m_size;
+        return *this;
+    }
+
+    CPointChunkPool& pool = CPointChunkPool::Shared();
+    m_chunks.reserve(other.m_chunks.size());
+    for (size_t k = 0; k < other.m_chunks.size(); ++k) {
+        CPointChunk* pChunk = pool.Acquire();
+        size_t count = other.GetChunkSize(k);
+        std::memcpy(pChunk->x, other.m_chunks[k]->x, count * sizeof(float));
+        std::memcpy(pChunk->y, other.m_chunks[k]->y, count * sizeof(float));
+        m_chunks.push_back(pChunk);
+    }
+    m_size = other.m_size;
+    return *this;
+}
+
+CStrokePoints::CStrokePoints(CStrokePoints&& other) noexcept
+    : m_chunks(std::move(other.m_chunks)), m_size(other.m_size),
+      m_pExternalX(other.m_pExternalX), m_pExternalY(other.m_pExternalY),
+      m_pExternalOwner(std::move(other.m_pExternalOwner)) {
+    other.m_chunks.clear();
+    other.m_size = 0;
+    other.m_pExternalX = nullptr;
+    other.m_pExternalY = nullptr;
+}
+
+CStrokePoints& CStrokePoints::operator=(CStrokePoints&& other) noexcept {
+    if (this == &other) return *this;
+    Clear();
+    m_chunks.swap(other.m_chunks);
+    m_size = other.m_size;
+    m_pExternalX = other.m_pExternalX;
+    m_pExternalY = other.m_pExternalY;
+    m_pExternalOwner = std::move(other.m_pExternalOwner);
+    other.m_size = 0;
+    other.m_pExternalX = nullptr;
+    other.m_pExternalY = nullptr;
+    return *this;
+}
+
+CStrokePoints CStrokePoints::FromExternal(const float* xs, const float* ys, size_t count, std::shared_ptr<const void> owner) {
+    CStrokePoints points;
+    if (count == 0) return points;
+    points.m_pExternalX = xs;
+    points.m_pExternalY = ys;
+    points.m_pExternalOwner = std::move(owner);
+    points.m_size = count;
+    return points;
+}
+
+void CStrokePoints::Materialize() {
+    const float* xs = m_pExternalX;
+    const float* ys = m_pExternalY;
+    std::shared_ptr<const void> owner = std::move(m_pExternalOwner);
+    size_t count = m_size;
+    m_pExternalX = nullptr;
+    m_pExternalY = nullptr;
+    m_size = 0;
+
+    CPointChunkPool& pool = CPointChunkPool::Shared();
+    size_t capacity = CPointChunk::Capacity;
+    m_chunks.reserve((count + capacity - 1) >> CPointChunk::Shift);
+    for (size_t first = 0; first < count; first += capacity) {
+        CPointChunk* pChunk = pool.Acquire();
+        size_t run = min(capacity, count - first);
+        std::memcpy(pChunk->x, xs + first, run * sizeof(float));
+        std::memcpy(pChunk->y, ys + first, run * sizeof(float));
+        m_chunks.push_back(pChunk);
+    }
+    m_size = count;
+}
+
+void CStrokePoints::Add(D2D1_POINT_2F p) {
+    if (m_pExternalX) Materialize();
+
+    size_t offset = m_size & (CPointChunk::Capacity - 1);
+    if (offset == 0 && (m_size >> CPointChunk::Shift) == m_chunks.size()) {
+        m_chunks.push_back(CPointChunkPool::Shared().Acquire());
+    }
+
+    CPointChunk* pChunk = m_chunks.back();
+    pChunk->x[offset] = p.x;
+    pChunk->y[offset] = p.y;
+    ++m_size;
+}
+
+void CStrokePoints::Clear() {
+    if (!m_chunks.empty()) {
+        CPointChunkPool& pool = CPointChunkPool::Shared();
+        for (CPointChunk* pChunk : m_chunks) {
+            pool.Release(pChunk);
+        }
+        m_chunks.clear();
+    }
+    m_size = 0;
+    m_pExternalX = nullptr;
+    m_pExternalY = nullptr;
+    m_pExternalOwner.reset();
+}
+
+size_t CStrokePoints::GetChunkSize(size_t chunk) const {
+    if (m_pExternalX) return chunk == 0 ? m_size : 0;
+    size_t first = chunk << CPointChunk::Shift;
+    if (first >= m_size) return 0;
+    size_t capacity = CPointChunk::Capacity;
+    return min(capacity, m_size - first);
+}
+
+void CStrokePoints::CopyTo(size_t first, size_t count, D2D1_POINT_2F* out) const {
+    size_t end = min(first + count, m_size);
+    if (m_pExternalX) {
+        for (size_t i = first; i < end; ++i) {
+            out->x = m_pExternalX[i];
+            out->y = m_pExternalY[i];
+            ++out;
+        }
+        return;
+    }
+
+    size_t capacity = CPointChunk::Capacity;
+    size_t i = first;
+    while (i < end) {
+        const CPointChunk* pChunk = m_chunks[i >> CPointChunk::Shift];
+        size_t offset = i & (capacity - 1);
+        size_t run = min(capacity - offset, end - i);
+        for (size_t k = 0; k < run; ++k) {
+            out->x = pChunk->x[offset + k];
+            out->y = pChunk->y[offset + k];
+            ++out;
+        }
+        i += run;
+    }
+}
+
+// Ramer-Douglas-Peucker 法で残す点に印を付ける (at(i) で i 番目の点を取得する)
+template <class PointAt>
+static void MarkSimplifiedPoints(size_t size, float tolerance, const PointAt& at, std::vector<char>& keep) {
+    keep.assign(size, 0);
+    keep[0] = 1;
+    keep[size - 1] = 1;
+
+    // 再帰の代わりに区間のスタックで分割する (長いストロークでもスタックを消費しない)
+    std::vector<std::pair<size_t, size_t>> ranges;
+    ranges.push_back(std::make_pair((size_t)0, size - 1));
+    float toleranceSq = tolerance * tolerance;
+
+    while (!ranges.empty()) {
+        size_t first = ranges.back().first;
+        size_t last = ranges.back().second;
+        ranges.pop_back();
+        if (last - first < 2) continue;
+
+        D2D1_POINT_2F a = at(first);
+        D2D1_POINT_2F b = at(last);
+        float dx = b.x - a.x;
+        float dy = b.y - a.y;
+        float lengthSq = dx * dx + dy * dy;
+
+        // 区間内で線分 ab から最も遠い点を探す
+        float maxDistSq = -1.0f;
+        size_t farthest = first;
+        for (size_t i = first + 1; i < last; ++i) {
+            D2D1_POINT_2F p = at(i);
+            float px = p.x - a.x;
+            float py = p.y - a.y;
+            float distSq;
+            if (lengthSq > 0.0f) {
+                float t = (px * dx + py * dy) / lengthSq;
+                t = max(0.0f, min(1.0f, t));
+                float ex = px - t * dx;
+                float ey = py - t * dy;
+                distSq = ex * ex + ey * ey;
+            }
+            else {
+                distSq = px * px + py * py;
+            }
+            if (distSq > maxDistSq) {
+                maxDistSq = distSq;
+                farthest = i;
+            }
+        }
+
+        if (maxDistSq > toleranceSq) {
+            keep[farthest] = 1;
+            ranges.push_back(std::make_pair(first, farthest));
+            ranges.push_back(std::make_pair(farthest, last));
+        }
+    }
+}
+
+size_t CStrokePoints::Simplify(float tolerance) {
+    if (m_size < 3 || tolerance <= 0.0f) return 0;
+
+    std::vector<char> keep;
+    MarkSimplifiedPoints(m_size, tolerance, [this](size_t i) { return (*this)[i]; }, keep);
+
+    // 残す点だけで点列を作り直す
+    CStrokePoints simplified;
+    for (size_t i = 0; i < m_size; ++i) {
+        if (keep[i]) simplified.Add((*this)[i]);
+    }
+
+    size_t removed = m_size - simplified.m_size;
+    *this = std::move(simplified);
+    return removed;
+}
+
+void SimplifyPolyline(const std::vector<D2D1_POINT_2F>& points, float tolerance, std::vector<D2D1_POINT_2F>& out) {
+    out.clear();
+    if (points.size() < 3 || tolerance <= 0.0f) {
+        out = points;
+        return;
+    }
+
+    std::vector<char> keep;
+    MarkSimplifiedPoints(points.size(), tolerance, [&points](size_t i) { return points[i]; }, keep);
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (keep[i]) out.push_back(points[i]);
+    }
+}
+
+
+// --- CEncodedPoints 実装 ---
+
+static const int64_t MaxQuantizedCoordinate = (int64_t)1 << 30;
+static const size_t MaxVarintBytes = 5; // 差分の最大値 (2 * MaxQuantizedCoordinate) を zig-zag 符号化したときのバイト数
+
+static int64_t QuantizeCoordinate(float value, uint32_t scale) {
+    double q = std::floor((double)value * (double)scale + 0.5);
+    if (!(q == q)) return 0; // NaN
+    double limit = (double)MaxQuantizedCoordinate;
+    return (int64_t)max(-limit, min(limit, q));
+}
+
+// 座標を 1/scale の格子に丸めたときの誤差が、最も細かい格子 (CEncodedPoints::Scale) での最大誤差以下か
+static bool FitsGrid(float value, uint32_t scale) {
+    double q = (double)value * (double)scale;
+    return std::abs(q - std::floor(q + 0.5)) / (double)scale <= 0.5 / (double)CEncodedPoints::Scale;
+}
+
+// すべての点が誤差の上限に収まる最も粗い格子を選ぶ
+// 格子は2のべき乗なので粗い格子の点は細かい格子にも含まれ、収まらない座標があれば細かくするだけでよい
+static uint32_t ChooseScale(const CStrokePoints& points) {
+    uint32_t scale = 1;
+    for (size_t k = 0; k < points.GetChunkCount() && scale < CEncodedPoints::Scale; ++k) {
+        const float* xs = points.GetChunkX(k);
+        const float* ys = points.GetChunkY(k);
+        size_t count = points.GetChunkSize(k);
+        for (size_t i = 0; i < count; ++i) {
+            while (scale < CEncodedPoints::Scale && !(FitsGrid(xs[i], scale) && FitsGrid(ys[i], scale))) {
+                scale <<= 1;
+            }
+        }
+    }
+    return scale;
+}
+
+static uint64_t ZigZagEncode(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t ZigZagDecode(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void WriteVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static bool ReadVarint(const uint8_t*& p, const uint8_t* end, uint64_t& out) {
+    uint64_t v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CEncodedPoints::Reader::Next(D2D1_POINT_2F& out) {
+    if (m_remaining == 0) return false;
+
+    uint64_t dx, dy;
+    if (!ReadVarint(m_p, m_end, dx) || !ReadVarint(m_p, m_end, dy)) return false;
+    // 壊れたデータで加算があふれないよう、座標の範囲で取り得ない差分は先に拒否する
+    int64_t deltaX = ZigZagDecode(dx);
+    int64_t deltaY = ZigZagDecode(dy);
+    if (deltaX < -2 * MaxQuantizedCoordinate || deltaX > 2 * MaxQuantizedCoordinate ||
+        deltaY < -2 * MaxQuantizedCoordinate || deltaY > 2 * MaxQuantizedCoordinate) {
+        return false;
+    }
+    int64_t x = m_x + deltaX;
+    int64_t y = m_y + deltaY;
+    if (x < -MaxQuantizedCoordinate || x > MaxQuantizedCoordinate ||
+        y < -MaxQuantizedCoordinate || y > MaxQuantizedCoordinate) {
+        return false;
+    }
+
+    m_x = x;
+    m_y = y;
+    --m_remaining;
+    out = D2D1::Point2F((float)((double)x / m_scale), (float)((double)y / m_scale));
+    return true;
+}
+
+void CEncodedPoints::Encode(const CStrokePoints& points) {
+    Clear();
+    if (points.Empty()) return;
+
+    uint32_t scale = ChooseScale(points);
+
+    // 近接した点の差分は格子 4 以下ではほぼ1座標1バイト、それより細かい格子では最大2バイトになる
+    size_t bytesPerCoordinate = scale <= 4 ? 1 : 2;
+    m_storage.reserve(points.Size() * 2 * bytesPerCoordinate + 8);
+    int64_t prevX = 0, prevY = 0;
+    for (size_t k = 0; k < points.GetChunkCount(); ++k) {
+        const float* xs = points.GetChunkX(k);
+        const float* ys = points.GetChunkY(k);
+        size_t count = points.GetChunkSize(k);
+        for (size_t i = 0; i < count; ++i) {
+            int64_t x = QuantizeCoordinate(xs[i], scale);
+            int64_t y = QuantizeCoordinate(ys[i], scale);
+            WriteVarint(m_storage, ZigZagEncode(x - prevX));
+            WriteVarint(m_storage, ZigZagEncode(y - prevY));
+            prevX = x;
+            prevY = y;
+        }
+    }
+    m_storage.shrink_to_fit();
+
+    m_byteCount = m_storage.size();
+    m_count = points.Size();
+    m_scale = scale;
+    m_back = D2D1::Point2F((float)((double)prevX / scale), (float)((double)prevY / scale));
+}
+
+bool CEncodedPoints::AssignExternal(const uint8_t* data, size_t byteCount, size_t count, uint32_t scale, D2D1_POINT_2F back,
+    std::shared_ptr<const void> owner) {
+    if (!IsValidScale(scale)) return false;
+
+    // 1点は差分2つで、Reader が受け付ける差分は1つあたり 1 から MaxVarintBytes バイトになる
+    // 点ごとには復号しない (壊れたデータは復号するときに Reader が検出する)
+    if (count == 0) {
+        if (byteCount != 0) return false;
+        Clear();
+        return true;
+    }
+    if (byteCount / 2 < count || (byteCount + 2 * MaxVarintBytes - 1) / (2 * MaxVarintBytes) > count) return false;
+    if (data[byteCount - 1] & 0x80) return false; // 末尾が可変長整数の途中で終わっている
+
+    // 末尾の点は格子上にあるため、記録された座標を格子点に丸めて使う
+    double limit = (double)MaxQuantizedCoordinate;
+    double backX = std::floor((double)back.x * scale + 0.5);
+    double backY = std::floor((double)back.y * scale + 0.5);
+    if (!(backX >= -limit && backX <= limit && backY >= -limit && backY <= limit)) return false; // NaN も拒否する
+
+    Clear();
+    m_pExternal = data;
+    m_pExternalOwner = std::move(owner);
+    m_byteCount = byteCount;
+    m_count = count;
+    m_scale = scale;
+    m_back = D2D1::Point2F((float)(backX / scale), (float)(backY / scale));
+    return true;
+}
+
+void CEncodedPoints::DetachExternal() {
+    if (!m_pExternal) return;
+    m_storage.assign(m_pExternal, m_pExternal + m_byteCount);
+    m_pExternal = nullptr;
+    m_pExternalOwner.reset();
+}
+
+void CEncodedPoints::Clear() {
+    m_storage.clear();
+    m_storage.shrink_to_fit();
+    m_pExternal = nullptr;
+    m_pExternalOwner.reset();
+    m_byteCount = 0;
+    m_count = 0;
+    m_scale = Scale;
+    m_back = D2D1::Point2F();
+}
+
+void CEncodedPoints::Decode(CStrokePoints& out) const {
+    out.Clear();
+    Reader reader = GetReader();
+    D2D1_POINT_2F p;
+    while (reader.Next(p)) {
+        out.Add(p);
+    }
+}
+
+D2D1_POINT_2F CEncodedPoints::Front() const {
+    D2D1_POINT_2F p = D2D1::Point2F();
+    Reader reader = GetReader();
+    reader.Next(p);
+    return p;
+}
@@ -0,0 +1,188 @@
+﻿#pragma once
+
+#include <d2d1.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+// --- 点列のチャンク (SoA 形式) ---
+struct CPointChunk {
+    static const size_t Capacity = 256; // 2のべき乗 (インデックス計算をシフトで行う)
+    static const size_t Shift = 8;
+
+    float x[Capacity];
+    float y[Capacity];
+    CPointChunk* pNextFree; // プール内の空きリスト用
+};
+
+// --- 点列チャンクのプール ---
+// ストロークの破棄で返されたチャンクを再利用し、入力中のヒープ確保を減らす
+// (補完ワーカーがストロークを最後に解放することがあるため、排他制御する)
+class CPointChunkPool {
+private:
+    std::mutex m_mutex;
+    CPointChunk* m_pFreeList;
+    size_t m_freeCount;
+    size_t m_maxFreeCount; // これを超えて返されたチャンクは解放する
+
+public:
+    explicit CPointChunkPool(size_t maxFreeCount = 1024);
+    ~CPointChunkPool();
+    CPointChunkPool(const CPointChunkPool&) = delete;
+    CPointChunkPool& operator=(const CPointChunkPool&) = delete;
+
+    CPointChunk* Acquire();
+    void Release(CPointChunk* pChunk);
+    void Trim(); // 保持している空きチャンクをすべて解放
+
+    // アプリケーション全体で共有するプール (終了時も破棄しない)
+    static CPointChunkPool& Shared();
+};
+
+// --- ストロークの点列 ---
+// 固定長チャンクの列に x, y を別々の配列として格納する
+// 追加時に既存の点が移動しないため、再確保によるコピーが発生しない
+// ファイルから読み込んだ点列は、コピーせずにマップしたメモリ上の連続した配列を参照できる
+// (参照中の点列へ追加するときに初めてチャンクへ複製する)
+class CStrokePoints {
+private:
+    std::vector<CPointChunk*> m_chunks;
+    size_t m_size;
+
+    // 外部の連続した配列を参照している場合 (m_pExternalX != nullptr)、m_chunks は空
+    const float* m_pExternalX;
+    const float* m_pExternalY;
+    std::shared_ptr<const void> m_pExternalOwner; // 参照先の寿命を保つ所有者 (マップしたファイルなど)
+
+    void Materialize(); // 外部の配列をチャンクへ複製する
+
+public:
+    CStrokePoints() : m_size(0), m_pExternalX(nullptr), m_pExternalY(nullptr) {}
+    ~CStrokePoints() { Clear(); }
+    CStrokePoints(const CStrokePoints& other);
+    CStrokePoints& operator=(const CStrokePoints& other);
+    CStrokePoints(CStrokePoints&& other) noexcept;
+    CStrokePoints& operator=(CStrokePoints&& other) noexcept;
+
+    // 外部の SoA 配列を参照する点列を作る (owner が参照先を保持している間だけ有効)
+    static CStrokePoints FromExternal(const float* xs, const float* ys, size_t count, std::shared_ptr<const void> owner);
+    bool IsExternal() const { return m_pExternalX != nullptr; }
+    // 外部の配列を参照していればチャンクへ複製し、参照先の所有者を手放す
+    void DetachExternal() { if (m_pExternalX) Materialize(); }
+
+    void Add(D2D1_POINT_2F p);
+    void Clear();
+
+    size_t Size() const { return m_size; }
+    bool Empty() const { return m_size == 0; }
+
+    D2D1_POINT_2F operator[](size_t i) const {
+        if (m_pExternalX) return D2D1::Point2F(m_pExternalX[i], m_pExternalY[i]);
+        const CPointChunk* pChunk = m_chunks[i >> CPointChunk::Shift];
+        size_t offset = i & (CPointChunk::Capacity - 1);
+        return D2D1::Point2F(pChunk->x[offset], pChunk->y[offset]);
+    }
+    D2D1_POINT_2F Front() const { return (*this)[0]; }
+    D2D1_POINT_2F Back() const { return (*this)[m_size - 1]; }
+
+    // チャンク単位の走査 (SoA 配列を直接読むカーネル用)
+    // 外部の配列を参照している場合は全体を1つのチャンクとして返す
+    size_t GetChunkCount() const { return m_pExternalX ? (m_size > 0 ? 1 : 0) : m_chunks.size(); }
+    size_t GetChunkSize(size_t chunk) const;
+    const float* GetChunkX(size_t chunk) const { return m_pExternalX ? m_pExternalX : m_chunks[chunk]->x; }
+    const float* GetChunkY(size_t chunk) const { return m_pExternalY ? m_pExternalY : m_chunks[chunk]->y; }
+
+    // 確保しているチャンクのメモリ量 (バイト。外部の配列は含まない)
+    size_t GetMemoryUsage() const { return m_chunks.size() * sizeof(CPointChunk) + m_chunks.capacity() * sizeof(CPointChunk*); }
+
+    // [first, first + count) の点を AoS 形式で取り出す
+    void CopyTo(size_t first, size_t count, D2D1_POINT_2F* out) const;
+
+    // Ramer-Douglas-Peucker 法で折れ線を単純化する (端点は常に残す)
+    // 残った折れ線と元の点との距離は tolerance 以下になる。削除した点の数を返す
+    size_t Simplify(float tolerance);
+};
+
+// 連続した配列の折れ線を CStrokePoints::Simplify と同じ方法で単純化し、残った点を out に返す
+// (チャンクを確保しないため、形状判定のように一時的な点列を扱う場合に使う)
+void SimplifyPolyline(const std::vector<D2D1_POINT_2F>& points, float tolerance, std::vector<D2D1_POINT_2F>& out);
+
+// --- 差分符号化した点列 (確定済みストロークの保持用) ---
+// 座標を 1/scale 単位の整数に量子化し、先頭の点と以降の点の差分を
+// zig-zag 符号化した可変長整数 (下位から7ビットずつ) として並べる
+// 入力の点は拡大表示中の画面の画素をドキュメント座標に変換したものになるため、
+// 新しく符号化する点列は、最大倍率 (CViewport::MaxZoom) でも丸めの誤差が 1/4 DIP 以下に収まる最も粗い格子を
+// 1 から Scale までの2のべき乗から点列ごとに選ぶ (表示状態に依存しないため、再生しても同じ結果になる)
+// 等倍で描いた画素単位の点列は格子 1 になり、近接した点は1座標あたりおよそ1バイト、
+// 格子 Scale ではおよそ1.5バイトになる
+// ランダムアクセスはできないため、Reader で先頭から順に復号する
+class CEncodedPoints {
+public:
+    static const uint32_t Scale = 16;      // Encode で使う最も細かい格子 (ドキュメント座標 1 あたり)
+    static const uint32_t LegacyScale = 4; // 格子の細かさを記録していないファイルの点列
+    static const uint32_t MaxScale = 256;
+
+    // 復号できる格子の細かさか (1 以上 MaxScale 以下の2のべき乗。座標を誤差なく割れるように)
+    static bool IsValidScale(uint32_t scale) { return scale != 0 && scale <= MaxScale && (scale & (scale - 1)) == 0; }
+
+    // 先頭から順に点を復号する
+    class Reader {
+    private:
+        const uint8_t* m_p;
+        const uint8_t* m_end;
+        size_t m_remaining;
+        int64_t m_x;
+        int64_t m_y;
+        double m_scale;
+
+    public:
+        Reader(const uint8_t* data, size_t byteCount, size_t count, uint32_t scale)
+            : m_p(data), m_end(data + byteCount), m_remaining(count), m_x(0), m_y(0), m_scale((double)scale) {}
+
+        // 次の点を取り出す (すべて読み終えたか、データが壊れている場合は false)
+        bool Next(D2D1_POINT_2F& out);
+    };
+
+private:
+    std::vector<uint8_t> m_storage;
+    const uint8_t* m_pExternal; // 外部のデータを参照している場合 (m_storage は空)
+    std::shared_ptr<const void> m_pExternalOwner;
+    size_t m_byteCount;
+    size_t m_count;
+    uint32_t m_scale;
+    D2D1_POINT_2F m_back; // 末尾の点 (全体を復号せずに取得できるように保持)
+
+public:
+    CEncodedPoints() : m_pExternal(nullptr), m_byteCount(0), m_count(0), m_scale(Scale), m_back(D2D1::Point2F()) {}
+
+    // 点列を誤差の上限に収まる最も粗い格子で符号化する (格子上にない座標は最も近い格子点に丸める)
+    void Encode(const CStrokePoints& points);
+
+    // 外部の符号化済みデータを参照する (owner が参照先を保持している間だけ有効)
+    // back は末尾の点 (符号化前の座標でよい)。点を復号せずにバイト数と座標の範囲だけを検証し、
+    // count 個の点として取り得ない場合は false を返して変更しない (データの破損は復号時に Reader が検出する)
+    bool AssignExternal(const uint8_t* data, size_t byteCount, size_t count, uint32_t scale, D2D1_POINT_2F back,
+        std::shared_ptr<const void> owner);
+
+    bool IsExternal() const { return m_pExternal != nullptr; }
+    // 外部のデータを参照していれば複製し、参照先の所有者を手放す
+    void DetachExternal();
+
+    void Clear();
+    void Decode(CStrokePoints& out) const;
+
+    Reader GetReader() const { return Reader(GetData(), m_byteCount, m_count, m_scale); }
+    size_t Size() const { return m_count; }
+    uint32_t GetScale() const { return m_scale; }
+    bool Empty() const { return m_count == 0; }
+    D2D1_POINT_2F Front() const;
+    D2D1_POINT_2F Back() const { return m_back; }
+
+    const uint8_t* GetData() const { return m_pExternal ? m_pExternal : m_storage.data(); }
+    size_t GetByteCount() const { return m_byteCount; }
+
+    // 確保しているメモリ量 (バイト。外部のデータは含まない)
+    size_t GetMemoryUsage() const { return m_storage.capacity(); }
+};
@@ -0,0 +1,327 @@
+﻿#include "TileCache.h"
+#include <algorithm>
+#include <cmath>
+
+// 一度にこれより多くの範囲が変化した場合は、タイルごとに判定せずすべて無効にする
+static const size_t MaxPartialChanges = 1024;
+
+static double ElapsedMs(const LARGE_INTEGER& start, LONGLONG frequency) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)(now.QuadPart - start.QuadPart) * 1000.0 / (double)frequency;
+}
+
+// 負の値も切り捨てる整数除算
+static int FloorDiv(int value, int divisor) {
+    int q = value / divisor;
+    return (value % divisor != 0 && value < 0) ? q - 1 : q;
+}
+
+static float LevelScale(int level) {
+    return std::ldexp(1.0f, level);
+}
+
+// 親ターゲットと同じ DPI・リソースドメインで作成し、ブラシを共有する
+static HRESULT CreateTileTarget(ID2D1RenderTarget* pParent, ID2D1BitmapRenderTarget*& pTarget) {
+    if (pTarget) return S_OK;
+    return pParent->CreateCompatibleRenderTarget(D2D1::SizeF((float)CTileCache::TileSize, (float)CTileCache::TileSize), &pTarget);
+}
+
+// --- CTileCache 実装 ---
+
+CTileCache::CTileCache()
+    : m_documentVersion(0), m_hasDocumentVersion(false), m_frame(0), m_pendingCount(0), m_useParallelRecording(false),
+      m_isParallelUnsupported(false) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    m_frequency = frequency.QuadPart;
+}
+
+long long CTileCache::MakeKey(int level, int x, int y) {
+    // 段階 8 ビット、x と y をそれぞれ 28 ビットに詰める
+    return ((long long)(level - MinLevel) << 56) | ((long long)(x & 0x0FFFFFFF) << 28) | (long long)(y & 0x0FFFFFFF);
+}
+
+D2D1_RECT_F CTileCache::GetTileBounds(int level, int x, int y) {
+    float size = (float)TileSize / LevelScale(level);
+    return D2D1::RectF(x * size, y * size, (x + 1) * size, (y + 1) * size);
+}
+
+int CTileCache::SelectLevel(float zoom) {
+    int level = (int)std::ceil(std::log2(zoom));
+    return max(MinLevel, min(MaxLevel, level));
+}
+
+void CTileCache::SetParallelRecording(bool enable) {
+    m_useParallelRecording = enable;
+    if (!enable) m_recorder.Discard();
+}
+
+void CTileCache::InvalidateAll() {
+    for (auto& entry : m_tiles) {
+        entry.second.isValid = false;
+    }
+}
+
+void CTileCache::InvalidateChanges(const CDocument& document) {
+    unsigned int version = document.GetVersion();
+    if (m_hasDocumentVersion && version == m_documentVersion) return;
+
+    bool partial = m_hasDocumentVersion && document.GetChangedBounds(m_documentVersion, m_changeBuffer) &&
+        m_changeBuffer.size() <= MaxPartialChanges;
+    for (auto& entry : m_tiles) {
+        Tile& tile = entry.second;
+        if (!tile.isValid) continue;
+        if (!partial) {
+            tile.isValid = false;
+            continue;
+        }
+
+        // アンチエイリアスで隣のタイルへはみ出す 1 画素分を含めて判定する
+        D2D1_RECT_F bounds = InflateBounds(GetTileBounds(tile.level, tile.x, tile.y), 1.0f / LevelScale(tile.level));
+        for (const D2D1_RECT_F& changed : m_changeBuffer) {
+            if (BoundsIntersect(changed, bounds)) {
+                tile.isValid = false;
+                break;
+            }
+        }
+    }
+    m_documentVersion = version;
+    m_hasDocumentVersion = true;
+}
+
+CTileCache::Tile& CTileCache::GetOrAddTile(int level, int x, int y) {
+    long long key = MakeKey(level, x, y);
+    auto it = m_tiles.find(key);
+    if (it != m_tiles.end()) return it->second;
+
+    Tile& tile = m_tiles[key];
+    tile = Tile{ level, x, y, nullptr, false, 0 };
+    return tile;
+}
+
+HRESULT CTileCache::RenderTile(ID2D1RenderTarget* pParent, CRenderContext& ctx, const CDocument& document, Tile& tile) {
+    HRESULT hr = CreateTileTarget(pParent, tile.pTarget);
+    if (FAILED(hr)) return hr;
+
+    float scale = LevelScale(tile.level);
+    D2D1_RECT_F bounds = GetTileBounds(tile.level, tile.x, tile.y);
+
+    ID2D1RenderTarget* pPreviousTarget = ctx.GetTarget();
+    float previousScale = ctx.GetScale();
+
+    tile.pTarget->BeginDraw();
+    tile.pTarget->SetTransform(D2D1::Matrix3x2F::Translation(-bounds.left, -bounds.top) * D2D1::Matrix3x2F::Scale(scale, scale));
+    tile.pTarget->Clear(D2D1::ColorF(D2D1::ColorF::White));
+
+    ctx.SetTarget(tile.pTarget);
+    ctx.SetScale(scale);
+    D2D1_RECT_F clip = InflateBounds(bounds, 1.0f / scale);
+    document.DrawAll(ctx, &clip);
+    ctx.SetTarget(pPreviousTarget);
+    ctx.SetScale(previousScale);
+
+    hr = tile.pTarget->EndDraw();
+    tile.isValid = SUCCEEDED(hr);
+    return hr;
+}
+
+HRESULT CTileCache::CompositeTile(ID2D1RenderTarget* pParent, Tile& tile, ID2D1CommandList* pCommandList) {
+    HRESULT hr = CreateTileTarget(pParent, tile.pTarget);
+    if (FAILED(hr)) return hr;
+
+    // デバイスコンテキストから作成した互換ターゲットはデバイスコンテキストとしても使える
+    ID2D1DeviceContext* pContext = nullptr;
+    hr = tile.pTarget->QueryInterface(__uuidof(ID2D1DeviceContext), (void**)&pContext);
+    if (FAILED(hr)) return hr;
+
+    // コマンドリストは記録時の変換を含むため、単位行列のまま描画する
+    pContext->BeginDraw();
+    pContext->SetTransform(D2D1::Matrix3x2F::Identity());
+    pContext->Clear(D2D1::ColorF(D2D1::ColorF::White));
+    pContext->DrawImage(pCommandList);
+    hr = pContext->EndDraw();
+    pContext->Release();
+
+    tile.isValid = SUCCEEDED(hr);
+    return hr;
+}
+
+HRESULT CTileCache::RenderTilesParallel(ID2D1RenderTarget* pParent, const CDocument& document, int level,
+    int x0, int y0, int x1, int y1, const LARGE_INTEGER& start, bool& hasRendered) {
+    m_jobTiles.clear();
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            auto it = m_tiles.find(MakeKey(level, x, y));
+            if (it == m_tiles.end() || !it->second.isValid) m_jobTiles.push_back(std::make_pair(x, y));
+        }
+    }
+    if (m_jobTiles.size() < 2) return S_OK; // 1 枚だけなら通常の描画と変わらない
+
+    HRESULT hr = m_recorder.Create(pParent);
+    if (hr != S_OK) return hr;
+
+    // ワーカー数の 2 倍ずつ記録して合成し、そのたびに予算を確認する
+    float scale = LevelScale(level);
+    size_t batchSize = m_recorder.GetWorkerCount() * 2;
+    for (size_t first = 0; first < m_jobTiles.size(); first += batchSize) {
+        if (hasRendered && ElapsedMs(start, m_frequency) >= RenderBudgetMs) break;
+
+        size_t last = min(m_jobTiles.size(), first + batchSize);
+        m_jobs.clear();
+        for (size_t i = first; i < last; ++i) {
+            D2D1_RECT_F bounds = GetTileBounds(level, m_jobTiles[i].first, m_jobTiles[i].second);
+            CParallelRecorder::Job job = {
+                D2D1::Matrix3x2F::Translation(-bounds.left, -bounds.top) * D2D1::Matrix3x2F::Scale(scale, scale),
+                scale, InflateBounds(bounds, 1.0f / scale), nullptr };
+            m_jobs.push_back(job);
+        }
+        hr = m_recorder.Record(document, m_jobs);
+        if (FAILED(hr)) return hr;
+
+        // 合成は描画先と同じ UI スレッドで行う
+        for (size_t i = 0; i < m_jobs.size(); ++i) {
+            if (SUCCEEDED(hr)) {
+                Tile& tile = GetOrAddTile(level, m_jobTiles[first + i].first, m_jobTiles[first + i].second);
+                hr = CompositeTile(pParent, tile, m_jobs[i].pCommandList);
+                if (FAILED(hr) && !tile.pTarget) m_tiles.erase(MakeKey(level, tile.x, tile.y));
+            }
+            m_jobs[i].pCommandList->Release();
+        }
+        if (FAILED(hr)) return hr;
+        hasRendered = true;
+    }
+    return S_OK;
+}
+
+CTileCache::Tile* CTileCache::FindFallback(int level, int x, int y) {
+    // 粗い段階ほどタイル1枚の範囲が広いため、近い段階から探す
+    for (int k = 1; k <= FallbackLevels && level - k >= MinLevel; ++k) {
+        auto it = m_tiles.find(MakeKey(level - k, FloorDiv(x, 1 << k), FloorDiv(y, 1 << k)));
+        if (it != m_tiles.end() && it->second.pTarget) return &it->second;
+    }
+    return nullptr;
+}
+
+HRESULT CTileCache::Prepare(ID2D1RenderTarget* pParent, CRenderContext& ctx, const CDocument& document,
+    const CViewport& viewport, const D2D1_RECT_F& area) {
+    m_placements.clear();
+    m_pendingCount = 0;
+    ++m_frame;
+    InvalidateChanges(document);
+
+    int level = SelectLevel(viewport.GetZoom());
+    float tileWorldSize = (float)TileSize / LevelScale(level);
+    D2D1_RECT_F world = viewport.ScreenToWorld(area);
+    int x0 = (int)std::floor(world.left / tileWorldSize);
+    int y0 = (int)std::floor(world.top / tileWorldSize);
+    int x1 = (int)std::floor(world.right / tileWorldSize);
+    int y1 = (int)std::floor(world.bottom / tileWorldSize);
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+    bool hasRendered = false; // 最初の1枚は時間に関係なく描画する (表示が進まなくなるのを防ぐ)
+
+    // 並列に記録できる場合は描き直すタイルを先にまとめて描画し、残りは以下で代用か次のフレームに回す
+    if (IsParallelRecording()) {
+        HRESULT hr = RenderTilesParallel(pParent, document, level, x0, y0, x1, y1, start, hasRendered);
+        if (hr == S_FALSE) {
+            // 描画先がデバイスコンテキストでないなど、並列に記録できない環境
+            // (設定はそのまま残し、描画先を作り直したときに再び試す)
+            m_isParallelUnsupported = true;
+            m_recorder.Discard();
+        }
+        else if (FAILED(hr)) {
+            m_placements.clear();
+            return hr;
+        }
+    }
+
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            long long key = MakeKey(level, x, y);
+            auto it = m_tiles.find(key);
+            Tile* pTile = (it != m_tiles.end()) ? &it->second : nullptr;
+            D2D1_RECT_F bounds = GetTileBounds(level, x, y);
+
+            if (!pTile || !pTile->isValid) {
+                if (!hasRendered || ElapsedMs(start, m_frequency) < RenderBudgetMs) {
+                    if (!pTile) pTile = &GetOrAddTile(level, x, y);
+                    HRESULT hr = RenderTile(pParent, ctx, document, *pTile);
+                    if (FAILED(hr)) {
+                        if (!pTile->pTarget) m_tiles.erase(key);
+                        m_placements.clear();
+                        return hr;
+                    }
+                    hasRendered = true;
+                }
+                else {
+                    ++m_pendingCount;
+                    if (!pTile) {
+                        // 粗い段階のタイルの該当部分を拡大して代用する
+                        pTile = FindFallback(level, x, y);
+                        if (!pTile) continue;
+                    }
+                    // 無効になったタイルは描き直すまで古い内容のまま表示する
+                }
+            }
+
+            pTile->lastUsed = m_frame;
+            D2D1_RECT_F tileBounds = GetTileBounds(pTile->level, pTile->x, pTile->y);
+            float tileScale = LevelScale(pTile->level);
+            D2D1_RECT_F source = D2D1::RectF(
+                (bounds.left - tileBounds.left) * tileScale, (bounds.top - tileBounds.top) * tileScale,
+                (bounds.right - tileBounds.left) * tileScale, (bounds.bottom - tileBounds.top) * tileScale);
+
+            // 隣り合うタイルの境界が同じ画素に揃うように丸める (継ぎ目が出ないように)
+            D2D1_RECT_F destination = viewport.WorldToScreen(bounds);
+            destination = D2D1::RectF(std::floor(destination.left + 0.5f), std::floor(destination.top + 0.5f),
+                std::floor(destination.right + 0.5f), std::floor(destination.bottom + 0.5f));
+            m_placements.push_back(Placement{ pTile->pTarget, source, destination });
+        }
+    }
+
+    Trim();
+    return S_OK;
+}
+
+void CTileCache::Draw(ID2D1RenderTarget* pRT) const {
+    for (const Placement& placement : m_placements) {
+        ID2D1Bitmap* pBitmap = nullptr;
+        placement.pTarget->GetBitmap(&pBitmap);
+        if (!pBitmap) continue;
+        pRT->DrawBitmap(pBitmap, placement.destination, 1.0f, D2D1_BITMAP_INTERPOLATION_MODE_LINEAR, placement.source);
+        pBitmap->Release();
+    }
+}
+
+void CTileCache::Trim() {
+    if (m_tiles.size() <= MaxTiles) return;
+
+    // 今回のフレームで使わなかったタイルを、最後に使った時期が古いものから捨てる
+    std::vector<std::pair<uint64_t, long long>> candidates;
+    for (const auto& entry : m_tiles) {
+        if (entry.second.lastUsed != m_frame) {
+            candidates.push_back(std::make_pair(entry.second.lastUsed, entry.first));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (size_t i = 0; i < candidates.size() && m_tiles.size() > MaxTiles; ++i) {
+        auto it = m_tiles.find(candidates[i].second);
+        if (it->second.pTarget) it->second.pTarget->Release();
+        m_tiles.erase(it);
+    }
+}
+
+void CTileCache::Discard() {
+    for (auto& entry : m_tiles) {
+        if (entry.second.pTarget) entry.second.pTarget->Release();
+    }
+    m_tiles.clear();
+    m_placements.clear();
+    m_recorder.Discard();
+    m_isParallelUnsupported = false; // 次の描画先で並列に記録できるか改めて確かめる
+    m_hasDocumentVersion = false;
+    m_pendingCount = 0;
+}
@@ -0,0 +1,104 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <d2d1.h>
+#include <vector>
+#include <unordered_map>
+#include "DrawingObject.h"
+#include "Viewport.h"
+#include "ParallelRecorder.h"
+
+// --- 確定済みオブジェクトのタイルキャッシュ ---
+// ドキュメント座標を一辺 TileSize / 2^level のタイルに分け、倍率 2^level で描画したビットマップを保持する
+// 表示倍率以上で最も近い段階のタイルを縮小して描くため、スクロールや拡大縮小ではタイルを描き直さない
+// ドキュメントが変化した場合は、変化した範囲と重なるタイルだけを描き直す
+//
+// 新しいタイルの描画は1フレームあたり RenderBudgetMs までとし、間に合わないタイルは
+// 粗い段階のタイル (無効になったタイルは古い内容) で代用して次のフレームに回す
+//
+// 並列記録を有効にすると、描き直すタイルをワーカースレッドでコマンドリストに記録してから合成する
+// (描画先がデバイスコンテキストでない場合は1枚ずつ描画する)
+class CTileCache {
+public:
+    static const int TileSize = 256;      // タイルの一辺 (DIP)
+    static const int MinLevel = -8;       // CViewport::MinZoom に対応
+    static const int MaxLevel = 3;        // CViewport::MaxZoom に対応
+    static const size_t MaxTiles = 256;   // 保持するタイル数の上限 (96 DPI で約 64MB)
+    static const int FallbackLevels = 3;  // 代用に使う粗い段階の数
+    static constexpr double RenderBudgetMs = 8.0;
+
+private:
+    struct Tile {
+        int level;
+        int x, y;
+        ID2D1BitmapRenderTarget* pTarget;
+        bool isValid;       // 現在のドキュメントの内容で描画済みか
+        uint64_t lastUsed;  // 最後に表示したフレーム (古いものから捨てる)
+    };
+
+    // 表示するタイルと画面上の位置 (Prepare で求め、Draw で描画する)
+    struct Placement {
+        ID2D1BitmapRenderTarget* pTarget;
+        D2D1_RECT_F source;      // タイル内の範囲 (DIP)
+        D2D1_RECT_F destination; // 画面上の範囲 (画素境界に揃える)
+    };
+
+    std::unordered_map<long long, Tile> m_tiles;
+    std::vector<Placement> m_placements;
+    std::vector<D2D1_RECT_F> m_changeBuffer;
+    unsigned int m_documentVersion;
+    bool m_hasDocumentVersion;
+    uint64_t m_frame;
+    size_t m_pendingCount; // 直前の Prepare で描画が間に合わなかったタイルの数
+    LONGLONG m_frequency;
+
+    CParallelRecorder m_recorder;
+    bool m_useParallelRecording;   // 要求された設定
+    bool m_isParallelUnsupported;  // 現在の描画先では並列に記録できない (Discard で解除する)
+    std::vector<CParallelRecorder::Job> m_jobs;
+    std::vector<std::pair<int, int>> m_jobTiles; // m_jobs に対応するタイルの位置
+
+    static long long MakeKey(int level, int x, int y);
+    static D2D1_RECT_F GetTileBounds(int level, int x, int y); // ドキュメント座標
+
+    void InvalidateChanges(const CDocument& document);
+    Tile& GetOrAddTile(int level, int x, int y);
+    HRESULT RenderTile(ID2D1RenderTarget* pParent, CRenderContext& ctx, const CDocument& document, Tile& tile);
+    HRESULT RenderTilesParallel(ID2D1RenderTarget* pParent, const CDocument& document, int level,
+        int x0, int y0, int x1, int y1, const LARGE_INTEGER& start, bool& hasRendered);
+    HRESULT CompositeTile(ID2D1RenderTarget* pParent, Tile& tile, ID2D1CommandList* pCommandList);
+    Tile* FindFallback(int level, int x, int y);
+    void Trim();
+
+public:
+    CTileCache();
+    ~CTileCache() { Discard(); }
+    CTileCache(const CTileCache&) = delete;
+    CTileCache& operator=(const CTileCache&) = delete;
+
+    // 倍率 zoom の表示に使う段階 (2^level >= zoom となる最小の level)
+    static int SelectLevel(float zoom);
+
+    // 描き直すタイルをワーカースレッドで並列に記録するか (既定は無効)
+    // 描画先が対応していない場合は、次の Discard まで1枚ずつ描画する
+    void SetParallelRecording(bool enable);
+    bool IsParallelRecording() const { return m_useParallelRecording && !m_isParallelUnsupported; }
+
+    // 画面上の area を表示するためのタイルを用意する (BeginDraw の前に呼び出す)
+    // タイルは pParent と互換のターゲットとして作成し、ctx のブラシを共有する
+    HRESULT Prepare(ID2D1RenderTarget* pParent, CRenderContext& ctx, const CDocument& document,
+        const CViewport& viewport, const D2D1_RECT_F& area);
+
+    // Prepare で用意したタイルを描画する (pRT の変換は単位行列であること)
+    void Draw(ID2D1RenderTarget* pRT) const;
+
+    // 描画が間に合わなかったタイルがある場合は false (次のフレームを要求する)
+    bool IsComplete() const { return m_pendingCount == 0; }
+    size_t GetTileCount() const { return m_tiles.size(); }
+
+    // すべてのタイルを次の Prepare で描き直す (ターゲットは再利用する)
+    void InvalidateAll();
+
+    // すべてのタイルを破棄する (ターゲットの再作成時)
+    void Discard();
+};
@@ -0,0 +1,44 @@
+﻿#include "Viewport.h"
+
+// --- CViewport 実装 ---
+
+void CViewport::Reset() {
+    m_origin = D2D1::Point2F();
+    m_zoom = 1.0f;
+}
+
+void CViewport::Pan(float dx, float dy) {
+    m_origin.x -= dx / m_zoom;
+    m_origin.y -= dy / m_zoom;
+}
+
+void CViewport::ZoomAt(D2D1_POINT_2F screenPoint, float factor) {
+    D2D1_POINT_2F anchor = ScreenToWorld(screenPoint);
+    m_zoom = max(MinZoom, min(MaxZoom, m_zoom * factor));
+    m_origin.x = anchor.x - screenPoint.x / m_zoom;
+    m_origin.y = anchor.y - screenPoint.y / m_zoom;
+}
+
+D2D1_POINT_2F CViewport::ScreenToWorld(D2D1_POINT_2F p) const {
+    return D2D1::Point2F(p.x / m_zoom + m_origin.x, p.y / m_zoom + m_origin.y);
+}
+
+D2D1_POINT_2F CViewport::WorldToScreen(D2D1_POINT_2F p) const {
+    return D2D1::Point2F((p.x - m_origin.x) * m_zoom, (p.y - m_origin.y) * m_zoom);
+}
+
+D2D1_RECT_F CViewport::ScreenToWorld(const D2D1_RECT_F& r) const {
+    D2D1_POINT_2F a = ScreenToWorld(D2D1::Point2F(r.left, r.top));
+    D2D1_POINT_2F b = ScreenToWorld(D2D1::Point2F(r.right, r.bottom));
+    return D2D1::RectF(a.x, a.y, b.x, b.y);
+}
+
+D2D1_RECT_F CViewport::WorldToScreen(const D2D1_RECT_F& r) const {
+    D2D1_POINT_2F a = WorldToScreen(D2D1::Point2F(r.left, r.top));
+    D2D1_POINT_2F b = WorldToScreen(D2D1::Point2F(r.right, r.bottom));
+    return D2D1::RectF(a.x, a.y, b.x, b.y);
+}
+
+D2D1_MATRIX_3X2_F CViewport::GetTransform() const {
+    return D2D1::Matrix3x2F::Translation(-m_origin.x, -m_origin.y) * D2D1::Matrix3x2F::Scale(m_zoom, m_zoom);
+}
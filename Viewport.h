@@ -0,0 +1,36 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <d2d1.h>
+
+// --- ビューポート (ドキュメント座標と画面座標の変換) ---
+// 画面座標 = (ドキュメント座標 - 原点) * 倍率
+// オブジェクトと入力の点はドキュメント座標で扱い、描画時にのみ変換する
+class CViewport {
+public:
+    static constexpr float MinZoom = 1.0f / 256.0f;
+    static constexpr float MaxZoom = 8.0f;
+
+private:
+    D2D1_POINT_2F m_origin; // 画面の左上に表示するドキュメント座標
+    float m_zoom;           // ドキュメント座標 1 あたりの DIP 数
+
+public:
+    CViewport() : m_origin(D2D1::Point2F()), m_zoom(1.0f) {}
+
+    D2D1_POINT_2F GetOrigin() const { return m_origin; }
+    float GetZoom() const { return m_zoom; }
+    bool IsIdentity() const { return m_zoom == 1.0f && m_origin.x == 0.0f && m_origin.y == 0.0f; }
+
+    void Reset();
+    void Pan(float dx, float dy); // 画面上の移動量 (DIP)。内容が (dx, dy) だけ動く
+    void ZoomAt(D2D1_POINT_2F screenPoint, float factor); // screenPoint の位置にある内容を動かさずに拡大縮小する
+
+    D2D1_POINT_2F ScreenToWorld(D2D1_POINT_2F p) const;
+    D2D1_POINT_2F WorldToScreen(D2D1_POINT_2F p) const;
+    D2D1_RECT_F ScreenToWorld(const D2D1_RECT_F& r) const;
+    D2D1_RECT_F WorldToScreen(const D2D1_RECT_F& r) const;
+
+    // ドキュメント座標から画面座標への変換行列 (SetTransform に渡す)
+    D2D1_MATRIX_3X2_F GetTransform() const;
+};